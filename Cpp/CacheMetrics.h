@@ -0,0 +1,417 @@
+//
+// Lock-free counters and latency histograms for the cache's operations.
+//
+
+#ifndef POC_CACHE_HIREDIS_CACHEMETRICS_H
+#define POC_CACHE_HIREDIS_CACHEMETRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * A latency histogram in microseconds with log-linear (HDR-style) buckets:
+ * 16 linear sub-buckets per power of two, so any recorded value is known to
+ * within 1/16 (about 6%). Values from 0 to 2^40 us (12 days) are kept; larger
+ * ones land in the last bucket. record() is a few relaxed atomic adds, safe
+ * from any number of threads.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int sub_bits = 4;
+    static constexpr int sub_count = 1 << sub_bits;
+    static constexpr int max_bits = 40;
+    static constexpr int bucket_count = (max_bits - sub_bits + 2) * sub_count;
+
+    /// A copy of a histogram's state, for percentiles and export.
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t max_us = 0;
+        std::vector<uint64_t> buckets;
+
+        double mean_us() const { return count ? (double)sum_us / (double)count : 0.0; }
+
+        /// Merge another snapshot into this one, e.g. the same histogram from several processes.
+        void add(const Snapshot& o) {
+            if (buckets.size() < o.buckets.size()) buckets.resize(o.buckets.size());
+            for (size_t i = 0; i < o.buckets.size(); ++i) buckets[i] += o.buckets[i];
+            count += o.count;
+            sum_us += o.sum_us;
+            max_us = std::max(max_us, o.max_us);
+        }
+
+        /// The value at quantile 'q' (0..1): the upper bound of the bucket holding it, capped at max_us.
+        uint64_t percentile(double q) const {
+            if (count == 0) return 0;
+            const auto rank = (uint64_t)(q * (double)(count - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                seen += buckets[i];
+                if (seen >= rank) return std::min(upper_bound((int)i), max_us);
+            }
+            return max_us;
+        }
+    };
+
+    LatencyHistogram() {
+        for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t us) {
+        buckets_[index(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_us_.fetch_add(us, std::memory_order_relaxed);
+        uint64_t m = max_us_.load(std::memory_order_relaxed);
+        while (us > m && !max_us_.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.buckets.resize(bucket_count);
+        for (int i = 0; i < bucket_count; ++i) s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        s.count = count_.load(std::memory_order_relaxed);
+        s.sum_us = sum_us_.load(std::memory_order_relaxed);
+        s.max_us = max_us_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset() {
+        for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        sum_us_.store(0, std::memory_order_relaxed);
+        max_us_.store(0, std::memory_order_relaxed);
+    }
+
+    static int index(uint64_t v) {
+        if (v < (uint64_t)sub_count) return (int)v;
+        int msb = 63;
+        while (!(v >> msb)) --msb;
+        if (msb > max_bits) return bucket_count - 1;
+        const int shift = msb - sub_bits;
+        return (shift + 1) * sub_count + (int)((v >> shift) - sub_count);
+    }
+
+    /// The largest value that lands in bucket 'i'.
+    static uint64_t upper_bound(int i) {
+        if (i < sub_count) return (uint64_t)i;
+        const int shift = i / sub_count - 1;
+        const uint64_t sub = (uint64_t)(i % sub_count + sub_count);
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[bucket_count];
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_us_{0};
+    std::atomic<uint64_t> max_us_{0};
+};
+
+/**
+ * The metrics of one RedisFileCache: a latency histogram per cache operation,
+ * the calls made to each Redis script and command (created on first use), and
+ * event counters.
+ *
+ * Redis calls are also charged to the cache operation the calling thread is
+ * in (see OpContext), so redis_report() can show which scripts and commands
+ * dominate a read, a write or an eviction.
+ *
+ * Recording is lock-free, and snapshot() and prometheus() may be called from
+ * another thread (e.g., an exporter) while the cache is in use. Counts are
+ * per process; aggregate across processes in the monitoring system.
+ */
+class CacheMetrics {
+public:
+    enum Op { read, write, read_lock, write_lock, fsync, rename, evict, op_count };
+    enum Counter {
+        reads_ok, read_misses, read_busy, bytes_read,
+        writes_ok, write_exists, write_busy, bytes_written,
+        evictions, evicted_bytes, counter_count
+    };
+
+    /// 'op_count' names Redis calls made outside any operation ("other": setup, maintenance passes).
+    static const char* op_name(Op o) {
+        static const char* names[op_count + 1] = {"read", "write", "read_lock", "write_lock", "fsync", "rename", "evict", "other"};
+        return names[o];
+    }
+    static const char* counter_name(Counter c) {
+        static const char* names[counter_count] = {
+            "reads_ok", "read_misses", "read_busy", "bytes_read",
+            "writes_ok", "write_exists", "write_busy", "bytes_written",
+            "evictions", "evicted_bytes"};
+        return names[c];
+    }
+
+    /// The operation Redis calls on this thread are charged to; op_count when none.
+    static int& current_op() {
+        static thread_local int op = op_count;
+        return op;
+    }
+
+    /// While alive, Redis calls made on this thread are charged to 'o'; the innermost context wins.
+    class OpContext {
+    public:
+        explicit OpContext(Op o) : prev_(current_op()) { current_op() = o; }
+        ~OpContext() { current_op() = prev_; }
+
+        OpContext(const OpContext&) = delete;
+        OpContext& operator=(const OpContext&) = delete;
+
+    private:
+        int prev_;
+    };
+
+    /// Calls to one Redis script or command.
+    struct Calls {
+        LatencyHistogram latency;
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> reloads{0};               /// NOSCRIPT reloads; scripts only
+        std::atomic<uint64_t> us_by_op[op_count + 1];   /// Time charged to each operation
+        std::atomic<uint64_t> calls_by_op[op_count + 1];
+
+        Calls() { clear_by_op(); }
+
+        void record(uint64_t us) {
+            latency.record(us);
+            const int o = current_op();
+            us_by_op[o].fetch_add(us, std::memory_order_relaxed);
+            calls_by_op[o].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void reset() {
+            latency.reset();
+            errors.store(0, std::memory_order_relaxed);
+            reloads.store(0, std::memory_order_relaxed);
+            clear_by_op();
+        }
+
+    private:
+        void clear_by_op() {
+            for (int o = 0; o <= op_count; ++o) {
+                us_by_op[o].store(0, std::memory_order_relaxed);
+                calls_by_op[o].store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    struct CallsSnapshot {
+        LatencyHistogram::Snapshot latency;
+        uint64_t errors = 0;
+        uint64_t reloads = 0;
+        std::vector<uint64_t> us_by_op;
+        std::vector<uint64_t> calls_by_op;
+    };
+
+    struct Snapshot {
+        std::map<std::string, LatencyHistogram::Snapshot> ops;
+        std::map<std::string, CallsSnapshot> scripts;
+        std::map<std::string, CallsSnapshot> commands;
+        std::map<std::string, uint64_t> counters;
+    };
+
+    CacheMetrics() {
+        for (auto& c : counters_) c.store(0, std::memory_order_relaxed);
+    }
+
+    CacheMetrics(const CacheMetrics&) = delete;
+    CacheMetrics& operator=(const CacheMetrics&) = delete;
+
+    LatencyHistogram& op(Op o) { return ops_[o]; }
+
+    /// The calls to the Redis script 'name'. The lookup takes a mutex; callers on a hot path keep the reference.
+    Calls& script(const std::string& name) { return calls(scripts_, name); }
+
+    /// The calls to the Redis command 'name' (e.g., "HSET"); a mutex and a map lookup, small next to a round trip.
+    Calls& command(const std::string& name) { return calls(commands_, name); }
+
+    void add(Counter c, uint64_t n = 1) { counters_[c].fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get(Counter c) const { return counters_[c].load(std::memory_order_relaxed); }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        for (int o = 0; o < op_count; ++o) s.ops[op_name((Op)o)] = ops_[o].snapshot();
+        for (int c = 0; c < counter_count; ++c) s.counters[counter_name((Counter)c)] = get((Counter)c);
+        std::lock_guard<std::mutex> g(mtx_);
+        for (const auto& kv : scripts_) s.scripts[kv.first] = snapshot(*kv.second);
+        for (const auto& kv : commands_) s.commands[kv.first] = snapshot(*kv.second);
+        return s;
+    }
+
+    void reset() {
+        for (auto& h : ops_) h.reset();
+        for (auto& c : counters_) c.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> g(mtx_);
+        for (auto& kv : scripts_) kv.second->reset();
+        for (auto& kv : commands_) kv.second->reset();
+    }
+
+    /**
+     * Which Redis calls dominate each operation. For read, write, evict and
+     * other, list the scripts and commands run on its behalf, ranked by total
+     * time, with their share of the operation's own time ('other' has none;
+     * the share there is of its Redis time). At most 'top' lines per operation.
+     */
+    std::string redis_report(size_t top = 10) const {
+        const Snapshot s = snapshot();
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(1);
+
+        struct Row { std::string name; uint64_t us, calls; const CallsSnapshot* c; };
+        for (int o : {(int)read, (int)write, (int)evict, (int)op_count}) {
+            std::vector<Row> rows;
+            uint64_t redis_us = 0;
+            auto collect = [&](const char* kind, const std::map<std::string, CallsSnapshot>& m) {
+                for (const auto& kv : m) {
+                    if (kv.second.calls_by_op[o] == 0) continue;
+                    rows.push_back({std::string(kind) + kv.first, kv.second.us_by_op[o], kv.second.calls_by_op[o], &kv.second});
+                    redis_us += kv.second.us_by_op[o];
+                }
+            };
+            collect("script:", s.scripts);
+            collect("cmd:", s.commands);
+            if (rows.empty()) continue;
+            std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.us > b.us; });
+
+            const uint64_t op_us = o < op_count ? s.ops.at(op_name((Op)o)).sum_us : redis_us;
+            out << op_name((Op)o) << ": ";
+            if (o < op_count) out << s.ops.at(op_name((Op)o)).count << " ops, " << (double)op_us / 1000.0 << " ms; ";
+            out << (double)redis_us / 1000.0 << " ms in Redis calls\n";
+            for (size_t i = 0; i < rows.size() && i < top; ++i) {
+                const auto& r = rows[i];
+                out << "  " << std::setw(5) << (op_us ? 100.0 * (double)r.us / (double)op_us : 0.0) << "%  "
+                    << std::left << std::setw(28) << r.name << std::right
+                    << " calls=" << r.calls
+                    << " mean_us=" << (double)r.us / (double)r.calls
+                    << " errors=" << r.c->errors;
+                if (r.c->reloads) out << " reloads=" << r.c->reloads;
+                out << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    /**
+     * The metrics in the Prometheus text exposition format. Histograms are
+     * exported with power-of-two 'le' bounds from 1 us to about 67 s. Each
+     * count is of the buckets whose upper bound is <= the 'le' bound; the fine
+     * buckets line up with those bounds, so the counts are exact up to 16 us
+     * and above that within 1 us (a value exactly on the bound lands in a
+     * bucket that reaches past it and is counted at the next bound).
+     */
+    std::string prometheus(const std::string& prefix = "poc_cache") const {
+        const Snapshot s = snapshot();
+        std::ostringstream out;
+
+        for (const auto& kv : s.counters) {
+            out << "# TYPE " << prefix << "_" << kv.first << "_total counter\n";
+            out << prefix << "_" << kv.first << "_total " << kv.second << "\n";
+        }
+
+        auto histogram = [&](const std::string& metric, const char* label,
+                             const std::map<std::string, const LatencyHistogram::Snapshot*>& hs) {
+            if (hs.empty()) return;
+            out << "# TYPE " << metric << " histogram\n";
+            for (const auto& kv : hs) {
+                const auto& h = *kv.second;
+                const std::string lbl = std::string(label) + "=\"" + kv.first + "\"";
+                uint64_t cum = 0;
+                int i = 0;
+                for (int p = 0; p <= 26; ++p) {
+                    const uint64_t bound = (uint64_t)1 << p;    // 1, 2, 4, ... us
+                    while (i < (int)h.buckets.size() && LatencyHistogram::upper_bound(i) <= bound) cum += h.buckets[i++];
+                    out << metric << "_bucket{" << lbl << ",le=\"" << (double)bound / 1e6 << "\"} " << cum << "\n";
+                }
+                out << metric << "_bucket{" << lbl << ",le=\"+Inf\"} " << h.count << "\n";
+                out << metric << "_sum{" << lbl << "} " << (double)h.sum_us / 1e6 << "\n";
+                out << metric << "_count{" << lbl << "} " << h.count << "\n";
+            }
+        };
+        auto counter = [&](const std::string& metric, const char* label, const std::map<std::string, CallsSnapshot>& cs,
+                           uint64_t CallsSnapshot::*field) {
+            if (cs.empty()) return;
+            out << "# TYPE " << metric << " counter\n";
+            for (const auto& kv : cs) out << metric << "{" << label << "=\"" << kv.first << "\"} " << kv.second.*field << "\n";
+        };
+        auto latencies = [](const std::map<std::string, CallsSnapshot>& cs) {
+            std::map<std::string, const LatencyHistogram::Snapshot*> hs;
+            for (const auto& kv : cs) hs[kv.first] = &kv.second.latency;
+            return hs;
+        };
+
+        std::map<std::string, const LatencyHistogram::Snapshot*> ops;
+        for (const auto& kv : s.ops) ops[kv.first] = &kv.second;
+        histogram(prefix + "_op_duration_seconds", "op", ops);
+        histogram(prefix + "_script_duration_seconds", "script", latencies(s.scripts));
+        counter(prefix + "_script_errors_total", "script", s.scripts, &CallsSnapshot::errors);
+        counter(prefix + "_script_reloads_total", "script", s.scripts, &CallsSnapshot::reloads);
+        histogram(prefix + "_redis_command_duration_seconds", "command", latencies(s.commands));
+        counter(prefix + "_redis_command_errors_total", "command", s.commands, &CallsSnapshot::errors);
+        return out.str();
+    }
+
+private:
+    using CallsMap = std::map<std::string, std::unique_ptr<Calls>>;
+
+    LatencyHistogram ops_[op_count];
+    std::atomic<uint64_t> counters_[counter_count];
+    mutable std::mutex mtx_;    /// Guards scripts_ and commands_ (the maps, not their entries)
+    CallsMap scripts_;
+    CallsMap commands_;
+
+    Calls& calls(CallsMap& m, const std::string& name) {
+        std::lock_guard<std::mutex> g(mtx_);
+        auto& c = m[name];
+        if (!c) c.reset(new Calls);
+        return *c;
+    }
+
+    static CallsSnapshot snapshot(const Calls& c) {
+        CallsSnapshot s;
+        s.latency = c.latency.snapshot();
+        s.errors = c.errors.load(std::memory_order_relaxed);
+        s.reloads = c.reloads.load(std::memory_order_relaxed);
+        for (int o = 0; o <= op_count; ++o) {
+            s.us_by_op.push_back(c.us_by_op[o].load(std::memory_order_relaxed));
+            s.calls_by_op.push_back(c.calls_by_op[o].load(std::memory_order_relaxed));
+        }
+        return s;
+    }
+};
+
+/**
+ * Records the time from construction to destruction in a histogram, or in the
+ * Calls of a Redis script or command; a null target records nothing.
+ */
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram* h) : h_(h), t0_(h ? clock::now() : clock::time_point{}) {}
+    explicit ScopedLatency(LatencyHistogram& h) : ScopedLatency(&h) {}
+    explicit ScopedLatency(CacheMetrics::Calls* c) : c_(c), t0_(c ? clock::now() : clock::time_point{}) {}
+    explicit ScopedLatency(CacheMetrics::Calls& c) : ScopedLatency(&c) {}
+    ~ScopedLatency() {
+        if (!h_ && !c_) return;
+        const auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - t0_).count();
+        if (h_) h_->record(us);
+        if (c_) c_->record(us);
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    using clock = std::chrono::steady_clock;
+    LatencyHistogram* h_ = nullptr;
+    CacheMetrics::Calls* c_ = nullptr;
+    clock::time_point t0_;
+};
+
+#endif //POC_CACHE_HIREDIS_CACHEMETRICS_H
@@ -0,0 +1,204 @@
+//
+// Span tracing of cache operations, written as Chrome trace-event JSON.
+//
+
+#ifndef POC_CACHE_HIREDIS_CACHETRACE_H
+#define POC_CACHE_HIREDIS_CACHETRACE_H
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+/**
+ * Writes complete ("ph":"X") trace events to a local file in the Chrome
+ * trace-event format, which chrome://tracing and https://ui.perfetto.dev
+ * load directly. Spans on one thread nest by time, so a read shows its lock
+ * acquisition, Redis calls, open and read loop as children.
+ *
+ * Timestamps are wall-clock microseconds, so files written by different
+ * processes and hosts line up (to within their clock skew) when merged; e.g.,
+ * 'jq -s add trace-*.json > all.json'. Durations come from steady_clock.
+ *
+ * Events are buffered and written in 64 KB blocks under a mutex; the file is
+ * a valid JSON array once this object is destroyed.
+ */
+class TraceWriter {
+public:
+    explicit TraceWriter(const std::string& path) : pid_((long)::getpid()) {
+        f_ = std::fopen(path.c_str(), "w");
+        if (!f_) throw std::system_error(errno, std::generic_category(), "trace file " + path);
+        buf_ = "[\n";
+    }
+
+    ~TraceWriter() {
+        std::lock_guard<std::mutex> g(mtx_);
+        buf_ += first_ ? "]\n" : "\n]\n";
+        write_buf();
+        std::fclose(f_);
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /// Wall-clock microseconds, the trace's time base.
+    static uint64_t now_us() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /// One complete event; 'args' is the body of a JSON object (e.g. "\"key\":\"k1\""), or empty.
+    void complete(const char* name, uint64_t ts_us, uint64_t dur_us, const std::string& args) {
+        std::string ev;
+        ev.reserve(128 + args.size());
+        ev += "{\"name\":\""; ev += name;
+        ev += "\",\"cat\":\"cache\",\"ph\":\"X\",\"ts\":"; ev += std::to_string(ts_us);
+        ev += ",\"dur\":"; ev += std::to_string(dur_us);
+        ev += ",\"pid\":"; ev += std::to_string(pid_);
+        ev += ",\"tid\":"; ev += std::to_string(tid());
+        if (!args.empty()) { ev += ",\"args\":{"; ev += args; ev += "}"; }
+        ev += "}";
+
+        std::lock_guard<std::mutex> g(mtx_);
+        if (!first_) buf_ += ",\n";
+        first_ = false;
+        buf_ += ev;
+        if (buf_.size() >= (1 << 16)) write_buf();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> g(mtx_);
+        write_buf();
+        std::fflush(f_);
+    }
+
+    /**
+     * 's' as the contents of a JSON string: quotes, backslashes and control
+     * characters escaped. Well-formed UTF-8 is kept; any other byte of 0x80
+     * or above (e.g. in a binary key) becomes \u00XX, since the viewers
+     * reject a file that is not valid UTF-8.
+     */
+    static std::string escape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); ++i) {
+            const unsigned char c = (unsigned char)s[i];
+            if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+            else if (c < 0x20) out += u_escape(c);
+            else if (c < 0x80) out += (char)c;
+            else if (const size_t n = utf8_length(s, i)) {
+                out.append(s, i, n);
+                i += n - 1;
+            }
+            else out += u_escape(c);
+        }
+        return out;
+    }
+
+private:
+    std::mutex mtx_;    /// Guards buf_, first_ and f_
+    std::FILE* f_ = nullptr;
+    std::string buf_;
+    bool first_ = true;
+    long pid_;
+
+    // Small, stable thread numbers read better in the viewer than pthread ids.
+    static int tid() {
+        static std::atomic<int> next{1};
+        static thread_local int id = next.fetch_add(1);
+        return id;
+    }
+
+    static std::string u_escape(unsigned char c) {
+        char u[8];
+        std::snprintf(u, sizeof(u), "\\u%04x", c);
+        return u;
+    }
+
+    // Length of the well-formed UTF-8 sequence at s[i] (a byte >= 0x80), or 0 if there is none.
+    static size_t utf8_length(const std::string& s, size_t i) {
+        const unsigned char c = (unsigned char)s[i];
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;     // the range of the second byte
+        if (c >= 0xC2 && c <= 0xDF) n = 2;
+        else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) lo = 0xA0;           // overlong
+            if (c == 0xED) hi = 0x9F;           // surrogates
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) lo = 0x90;           // overlong
+            if (c == 0xF4) hi = 0x8F;           // above U+10FFFF
+        }
+        else return 0;
+        if (i + n > s.size()) return 0;
+        for (size_t k = 1; k < n; ++k) {
+            const unsigned char b = (unsigned char)s[i + k];
+            if (k == 1 ? (b < lo || b > hi) : (b < 0x80 || b > 0xBF)) return 0;
+        }
+        return n;
+    }
+
+    void write_buf() {
+        if (!buf_.empty()) std::fwrite(buf_.data(), 1, buf_.size(), f_);
+        buf_.clear();
+    }
+};
+
+/**
+ * A span from construction to destruction. With a null writer (tracing off)
+ * it does nothing beyond a pointer test.
+ */
+class TraceSpan {
+public:
+    TraceSpan(TraceWriter* w, const char* name) : w_(w), name_(name) {
+        if (w_) start();
+    }
+    TraceSpan(TraceWriter* w, const char* name, const std::string& key) : w_(w), name_(name) {
+        if (w_) {
+            arg("key", key);
+            start();
+        }
+    }
+
+    ~TraceSpan() { end(); }
+
+    /// End the span now, before it goes out of scope.
+    void end() {
+        if (!w_) return;
+        const auto dur = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0_);
+        w_->complete(name_, ts_us_, (uint64_t)dur.count(), args_);
+        w_ = nullptr;
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /// Attach a string argument, shown in the viewer's details pane.
+    void arg(const char* k, const std::string& v) {
+        if (!w_) return;
+        if (!args_.empty()) args_ += ',';
+        args_ += '"'; args_ += k; args_ += "\":\""; args_ += TraceWriter::escape(v); args_ += '"';
+    }
+
+private:
+    TraceWriter* w_;
+    const char* name_;
+    std::string args_;
+    uint64_t ts_us_ = 0;
+    std::chrono::steady_clock::time_point t0_;
+
+    void start() {
+        ts_us_ = TraceWriter::now_us();
+        t0_ = std::chrono::steady_clock::now();
+    }
+};
+
+#endif //POC_CACHE_HIREDIS_CACHETRACE_H
@@ -0,0 +1,138 @@
+//
+// Small, dependency-free hashes used to derive names from cache keys.
+//
+
+#ifndef POC_CACHE_HIREDIS_KEYHASH_H
+#define POC_CACHE_HIREDIS_KEYHASH_H
+
+#include <cstdint>
+#include <string>
+
+/// 64-bit FNV-1a. Cheap and good enough for table slots and shared-memory names.
+inline uint64_t fnv1a_64(const std::string& s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/// 128-bit hash value; h1 is the high half when printed.
+struct Hash128 {
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+};
+
+namespace keyhash_detail {
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33; k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Little-endian 64-bit load from an unaligned address.
+inline uint64_t load64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+} // namespace keyhash_detail
+
+/**
+ * MurmurHash3 x64_128 (Austin Appleby, public domain). Fast, well mixed and
+ * dependency-free; used where names must be fixed width and collisions must
+ * be negligible, e.g. on-disk names for arbitrary keys.
+ */
+inline Hash128 murmur3_128(const void* key, size_t len, uint32_t seed = 0) {
+    using namespace keyhash_detail;
+    const auto* data = static_cast<const unsigned char*>(key);
+    const size_t nblocks = len / 16;
+    uint64_t h1 = seed, h2 = seed;
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+
+    for (size_t i = 0; i < nblocks; ++i) {
+        uint64_t k1 = load64(data + 16 * i);
+        uint64_t k2 = load64(data + 16 * i + 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const unsigned char* tail = data + 16 * nblocks;
+    uint64_t k1 = 0, k2 = 0;
+    switch (len & 15) {
+        case 15: k2 ^= uint64_t(tail[14]) << 48; // fall through
+        case 14: k2 ^= uint64_t(tail[13]) << 40; // fall through
+        case 13: k2 ^= uint64_t(tail[12]) << 32; // fall through
+        case 12: k2 ^= uint64_t(tail[11]) << 24; // fall through
+        case 11: k2 ^= uint64_t(tail[10]) << 16; // fall through
+        case 10: k2 ^= uint64_t(tail[9]) << 8;   // fall through
+        case 9:  k2 ^= uint64_t(tail[8]);
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                 // fall through
+        case 8:  k1 ^= uint64_t(tail[7]) << 56;  // fall through
+        case 7:  k1 ^= uint64_t(tail[6]) << 48;  // fall through
+        case 6:  k1 ^= uint64_t(tail[5]) << 40;  // fall through
+        case 5:  k1 ^= uint64_t(tail[4]) << 32;  // fall through
+        case 4:  k1 ^= uint64_t(tail[3]) << 24;  // fall through
+        case 3:  k1 ^= uint64_t(tail[2]) << 16;  // fall through
+        case 2:  k1 ^= uint64_t(tail[1]) << 8;   // fall through
+        case 1:  k1 ^= uint64_t(tail[0]);
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                 break;
+        default: break;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    return Hash128{h1, h2};
+}
+
+inline Hash128 murmur3_128(const std::string& s) { return murmur3_128(s.data(), s.size()); }
+
+/// Lowercase hex of the 'n' bytes at 'p'.
+inline std::string to_hex(const void* p, size_t n) {
+    static const char* hexd = "0123456789abcdef";
+    const auto* b = static_cast<const unsigned char*>(p);
+    std::string s; s.reserve(2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        s.push_back(hexd[b[i] >> 4]);
+        s.push_back(hexd[b[i] & 0x0f]);
+    }
+    return s;
+}
+
+/// Lowercase hex of a 64-bit value, most significant byte first.
+inline std::string to_hex(uint64_t v) {
+    unsigned char b[8];
+    for (int i = 7; i >= 0; --i) { b[i] = (unsigned char)(v & 0xff); v >>= 8; }
+    return to_hex(b, sizeof(b));
+}
+
+/// Lowercase hex of a 128-bit value: 32 digits, h1 first.
+inline std::string to_hex(const Hash128& h) {
+    return to_hex(h.h1) + to_hex(h.h2);
+}
+
+/// The bytes written as hex in 'hex' (an odd trailing digit is ignored).
+inline std::string from_hex(const std::string& hex) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    };
+    std::string out; out.reserve(hex.size() / 2);
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        out.push_back((char)((nibble(hex[i]) << 4) | nibble(hex[i + 1])));
+    return out;
+}
+
+#endif //POC_CACHE_HIREDIS_KEYHASH_H
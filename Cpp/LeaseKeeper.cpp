@@ -0,0 +1,143 @@
+//
+// Lease renewal (heartbeat) for the cache's Redis locks.
+//
+
+#include "LeaseKeeper.h"
+#include "RedisConnect.h"
+
+#include <hiredis/hiredis.h>
+
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+
+// Extend a write lock only if it still holds our token.
+static const char* LUA_RENEW_WRITE = R"(
+    local wl = KEYS[1]; local token = ARGV[1]; local ttl = tonumber(ARGV[2])
+    if redis.call('GET', wl) == token then redis.call('PEXPIRE', wl, ttl); return 1 end; return 0
+)";
+// Push a reader lease's expiry forward only if the lease is still there (it was not pruned).
+static const char* LUA_RENEW_READ = R"(
+    local rd = KEYS[1]; local token = ARGV[1]; local ttl = tonumber(ARGV[2])
+    if not redis.call('ZSCORE', rd, token) then return 0 end
+    local t = redis.call('TIME'); local now = t[1] * 1000 + math.floor(t[2] / 1000)
+    redis.call('ZADD', rd, 'XX', now + ttl, token)
+    if redis.call('PTTL', rd) < ttl then redis.call('PEXPIRE', rd, ttl) end; return 1
+)";
+
+static void rc_deleter(redisContext* c) {
+    if (c) redisFree(c);
+}
+
+LeaseKeeper::LeaseKeeper(const std::string& redis_host, int redis_port, int redis_db, long long ttl_ms)
+: ttl_ms_(ttl_ms),
+  interval_ms_(ttl_ms / 3 > 0 ? ttl_ms / 3 : 1),
+  rc_(nullptr, rc_deleter)
+{
+    redisContext* c = redis_connect(redis_host, redis_port);
+    if (!c || c->err) {
+        const std::string msg = c ? c->errstr : "redisConnect failed";
+        if (c) redisFree(c);
+        throw std::runtime_error("Redis connect error: " + msg);
+    }
+    rc_.reset(c);
+
+    if (redis_db != 0) {
+        auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), "SELECT %d", redis_db));
+        const bool ok = r && r->type == REDIS_REPLY_STATUS;
+        if (r) freeReplyObject(r);
+        if (!ok) throw std::runtime_error("Redis database connection error (db: " + std::to_string(redis_db) + ")");
+    }
+
+    scripts_ = std::make_unique<ScriptManager>(rc_.get());
+    scripts_->register_and_load("renew_write", LUA_RENEW_WRITE);
+    scripts_->register_and_load("renew_read", LUA_RENEW_READ);
+
+    thread_ = std::thread(&LeaseKeeper::run, this);
+}
+
+LeaseKeeper::~LeaseKeeper() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void LeaseKeeper::hold_write(const std::string& lock_key, const std::string& token) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    leases_[token] = Lease{Kind::write, lock_key};
+}
+
+void LeaseKeeper::hold_read(const std::string& readers_key, const std::string& token, SharedRead shared) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = leases_.find(token);
+    if (it != leases_.end()) {
+        ++it->second.holds;    // another local reader of a shared lease
+        if (shared.token) it->second.shared = std::move(shared);
+        return;
+    }
+    Lease lease{Kind::read, readers_key};
+    lease.shared = std::move(shared);
+    leases_.emplace(token, std::move(lease));
+}
+
+void LeaseKeeper::release(const std::string& token) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = leases_.find(token);
+    if (it != leases_.end() && --it->second.holds <= 0) leases_.erase(it);
+}
+
+bool LeaseKeeper::lost(const std::string& token) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = leases_.find(token);
+    return it != leases_.end() && it->second.lost;
+}
+
+long long LeaseKeeper::renewals() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return renewals_;
+}
+
+/**
+ * The heartbeat loop. Snapshot the live leases, renew each one without
+ * holding the mutex (so hold/release never wait on Redis), then record which
+ * ones were lost. A Redis error leaves the lease as-is; the next beat retries
+ * and the lease's TTL is the backstop. The expiry passed to a shared read
+ * lease's 'renewed' callback is measured from before the renewal was sent,
+ * so it is never later than the one Redis recorded.
+ */
+void LeaseKeeper::run() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+        cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this] { return stop_; });
+        if (stop_) break;
+
+        std::vector<std::pair<std::string, Lease>> todo;
+        for (const auto& kv : leases_) if (!kv.second.lost) todo.emplace_back(kv);
+        lock.unlock();
+
+        std::vector<std::string> gone;
+        const std::string ttl = std::to_string(ttl_ms_);
+        for (const auto& t : todo) {
+            try {
+                using namespace std::chrono;
+                const SharedRead& shared = t.second.shared;
+                std::string token = shared.token ? shared.token() : std::string();
+                if (token.empty()) token = t.first;
+                const long long sent = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+                const char* name = (t.second.kind == Kind::write) ? "renew_write" : "renew_read";
+                if (scripts_->evalsha_ll(name, 1, {t.second.key}, {token, ttl}) != 1) gone.push_back(t.first);
+                else if (shared.renewed) shared.renewed(token, sent + ttl_ms_);
+            } catch (...) {}
+        }
+
+        lock.lock();
+        renewals_ += (long long)todo.size();
+        for (const auto& token : gone) {
+            auto it = leases_.find(token);
+            if (it != leases_.end()) it->second.lost = true;
+        }
+    }
+}
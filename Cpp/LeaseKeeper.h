@@ -0,0 +1,96 @@
+//
+// Lease renewal (heartbeat) for the cache's Redis locks.
+//
+
+#ifndef POC_CACHE_HIREDIS_LEASEKEEPER_H
+#define POC_CACHE_HIREDIS_LEASEKEEPER_H
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "ScriptManager.h"
+
+struct redisContext;
+
+/**
+ * Keep short-TTL locks alive while the operation that holds them runs.
+ *
+ * Locks are acquired with a short TTL so a crashed process frees them in
+ * seconds. A background thread with its own Redis connection extends every
+ * held lease each ttl/3 ms until it is released. If a renewal finds the lease
+ * is no longer ours (it expired and someone else took the lock), the lease is
+ * marked lost; the holder must check lost() before doing anything that
+ * depends on still owning the lock, e.g. the publishing rename().
+ *
+ * A reader lease shared by several local readers (LocalLeaseTable) has one
+ * token; each reader holds it and releases it, and the renewals go on until
+ * the last one does. The table may move a slot's readers to a newer lease,
+ * so a shared reader renews whatever token its slot uses at each beat
+ * (SharedRead::token), not only the one it started with.
+ *
+ * @note Unlike RedisFileCache, this class is thread safe; that is the point.
+ */
+class LeaseKeeper {
+public:
+    /// How to renew a reader lease that is shared through a LocalLeaseTable slot.
+    struct SharedRead {
+        /// The token the slot uses now; "" if the slot has moved on (the reader's own token is renewed)
+        std::function<std::string()> token;
+        /// Called on the heartbeat thread after each renewal, with the new expiry (host steady_clock ms)
+        std::function<void(const std::string& token, long long expires_ms)> renewed;
+    };
+
+    LeaseKeeper(const std::string& redis_host, int redis_port, int redis_db, long long ttl_ms);
+    ~LeaseKeeper();
+
+    LeaseKeeper(const LeaseKeeper&) = delete;
+    LeaseKeeper& operator=(const LeaseKeeper&) = delete;
+
+    /// Renew the write lock 'lock_key' as long as it holds 'token'.
+    void hold_write(const std::string& lock_key, const std::string& token);
+    /**
+     * Renew the reader lease 'token' in the readers ZSET 'readers_key'.
+     * @param shared For a lease shared by local readers, which token to
+     * renew and who to tell; empty for a reader's own lease.
+     */
+    void hold_read(const std::string& readers_key, const std::string& token, SharedRead shared = SharedRead());
+    /// Stop renewing the lease 'token' (once each holder has released it).
+    void release(const std::string& token);
+    /// True if a renewal found that the lease 'token' was no longer held.
+    bool lost(const std::string& token) const;
+
+    long long ttl_ms() const { return ttl_ms_; }
+    long long renewals() const;
+
+private:
+    enum class Kind { write, read };
+    struct Lease {
+        Kind kind;
+        std::string key;
+        bool lost = false;
+        int holds = 1;
+        SharedRead shared = SharedRead();
+    };
+
+    long long ttl_ms_;
+    long long interval_ms_;
+
+    std::unique_ptr<redisContext, void(*)(redisContext*)> rc_;  /// Used only by the heartbeat thread
+    std::unique_ptr<ScriptManager> scripts_{nullptr};
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, Lease> leases_;    /// token -> lease
+    bool stop_ = false;
+    long long renewals_ = 0;
+    std::thread thread_;
+
+    void run();
+};
+
+#endif //POC_CACHE_HIREDIS_LEASEKEEPER_H
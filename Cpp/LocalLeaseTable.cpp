@@ -0,0 +1,253 @@
+//
+// Node-local sharing of Redis reader leases.
+//
+
+#include "LocalLeaseTable.h"
+#include "KeyHash.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <system_error>
+#include <stdexcept>
+
+static const uint32_t TABLE_MAGIC = 0x4c4c5432; // "LLT2"
+static const size_t TOKEN_MAX = 48;
+
+struct LocalLeaseTable::Header {
+    uint32_t magic;
+    uint32_t nslots;
+    std::atomic<uint32_t> ready;    /// Set by the creator once the mutex is initialized
+    uint64_t next_gen;
+    pthread_mutex_t mtx;
+};
+
+struct LocalLeaseTable::Slot {
+    uint64_t hash;          /// 0 == never used; otherwise kept when freed so probe chains stay intact
+    uint64_t check;         /// Second hash of the key; a slot is the key's only if both match
+    uint64_t gen;           /// Changes each time the slot starts a new lease from scratch
+    int32_t refs;           /// Local readers using the lease; 0 == free
+    int64_t expires_ms;     /// Host steady_clock ms when the Redis lease expires
+    char token[TOKEN_MAX];
+};
+
+std::string LocalLeaseTable::name_for(const std::string& ns, const std::string& host, int port, int db) {
+    return "/poc-cache-leases-" + to_hex(fnv1a_64(ns + "@" + host + ":" + std::to_string(port) + "/" + std::to_string(db)));
+}
+
+void LocalLeaseTable::remove(const std::string& name) {
+    ::shm_unlink(name.c_str());
+}
+
+LocalLeaseTable::LocalLeaseTable(const std::string& name, uint32_t nslots)
+: name_(name), nslots_(nslots)
+{
+    size_ = sizeof(Header) + nslots_ * sizeof(Slot);
+
+    int fd = ::shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    const bool creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST) throw std::system_error(errno, std::generic_category(), "shm_open");
+        fd = ::shm_open(name_.c_str(), O_RDWR, 0666);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+
+    if (creator) {
+        if (::ftruncate(fd, (off_t)size_) != 0) {
+            const int e = errno; ::close(fd); ::shm_unlink(name_.c_str());
+            throw std::system_error(e, std::generic_category(), "ftruncate");
+        }
+    }
+    else {
+        // The creator may not have sized the segment yet
+        struct stat st{};
+        for (int i = 0; i < 1000 && ::fstat(fd, &st) == 0 && (size_t)st.st_size < size_; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if ((size_t)st.st_size < size_) {
+            ::close(fd);
+            throw std::runtime_error("Local lease table " + name_ + " has the wrong size");
+        }
+    }
+
+    base_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int e = errno;
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        base_ = nullptr;
+        throw std::system_error(e, std::generic_category(), "mmap");
+    }
+
+    Header* h = header();
+    if (creator) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+        // A process that dies holding the mutex must not wedge every reader on the host
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        pthread_mutex_init(&h->mtx, &attr);
+        pthread_mutexattr_destroy(&attr);
+        h->magic = TABLE_MAGIC;
+        h->nslots = nslots_;
+        h->next_gen = 1;
+        h->ready.store(1, std::memory_order_release);
+    }
+    else {
+        for (int i = 0; i < 1000 && h->ready.load(std::memory_order_acquire) == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (h->ready.load(std::memory_order_acquire) == 0 || h->magic != TABLE_MAGIC || h->nslots != nslots_) {
+            ::munmap(base_, size_);
+            base_ = nullptr;
+            throw std::runtime_error("Local lease table " + name_ + " is not usable");
+        }
+    }
+}
+
+LocalLeaseTable::~LocalLeaseTable() {
+    if (base_) ::munmap(base_, size_);
+}
+
+LocalLeaseTable::Header* LocalLeaseTable::header() const {
+    return static_cast<Header*>(base_);
+}
+
+LocalLeaseTable::Slot* LocalLeaseTable::slots() const {
+    return reinterpret_cast<Slot*>(static_cast<char*>(base_) + sizeof(Header));
+}
+
+void LocalLeaseTable::lock() const {
+    const int rc = pthread_mutex_lock(&header()->mtx);
+#if defined(__linux__)
+    // The previous owner died; the table is only ever left in a consistent state between stores
+    if (rc == EOWNERDEAD) pthread_mutex_consistent(&header()->mtx);
+#else
+    (void)rc;
+#endif
+}
+
+void LocalLeaseTable::unlock() const {
+    pthread_mutex_unlock(&header()->mtx);
+}
+
+// The slot hash (never 0) and an independent check hash for 'key'.
+static void key_hashes(const std::string& key, uint64_t& hash, uint64_t& check) {
+    hash = fnv1a_64(key) | 1;
+    check = murmur3_128(key).h1;
+}
+
+/**
+ * Linear probe for 'hash' and 'check'. Returns the key's slot if present. Otherwise, when
+ * 'for_insert' is true, returns the first reusable slot on the probe path
+ * (never used, free, or holding an expired lease), or nullptr if the table
+ * is full.
+ */
+LocalLeaseTable::Slot* LocalLeaseTable::find(uint64_t hash, uint64_t check, bool for_insert, long long now_ms) const {
+    Slot* s = slots();
+    Slot* reusable = nullptr;
+    for (uint32_t i = 0; i < nslots_; ++i) {
+        Slot* c = &s[(hash + i) % nslots_];
+        if (c->hash == hash && c->check == check) return c;
+        if (for_insert && !reusable && (c->hash == 0 || c->refs <= 0 || c->expires_ms <= now_ms)) reusable = c;
+        if (c->hash == 0) break;
+    }
+    return for_insert ? reusable : nullptr;
+}
+
+bool LocalLeaseTable::join(const std::string& key, long long now_ms, long long min_life_ms,
+                           std::string& token, Handle& h) {
+    uint64_t hash, check;
+    key_hashes(key, hash, check);
+    lock();
+    Slot* s = find(hash, check, false, now_ms);
+    const bool ok = s && s->refs > 0 && s->expires_ms - now_ms >= min_life_ms;
+    if (ok) {
+        ++s->refs;
+        token.assign(s->token);
+        h = Handle{hash, check, s->gen, true};
+    }
+    unlock();
+    return ok;
+}
+
+void LocalLeaseTable::attach(const std::string& key, std::string& token, long long now_ms, long long expires_ms,
+                             long long min_life_ms, Handle& h, std::string& surplus) {
+    uint64_t hash, check;
+    key_hashes(key, hash, check);
+    surplus.clear();
+    h = Handle{hash, check, 0, false};
+    if (token.size() >= TOKEN_MAX) return;
+
+    lock();
+    Slot* s = find(hash, check, true, now_ms);
+    if (!s) {
+        // Table full: the caller keeps its lease to itself
+    }
+    else if (s->hash == hash && s->check == check && s->refs > 0 && s->expires_ms > now_ms) {
+        ++s->refs;
+        if (s->expires_ms - now_ms >= min_life_ms) {
+            // Lost the race with another local reader; use its lease
+            surplus = token;
+            token.assign(s->token);
+        }
+        else {
+            // The slot's lease is nearly done; its readers move to ours
+            surplus.assign(s->token);
+            std::strncpy(s->token, token.c_str(), TOKEN_MAX);
+            s->expires_ms = expires_ms;
+        }
+        h = Handle{hash, check, s->gen, true};
+    }
+    else {
+        s->hash = hash;
+        s->check = check;
+        s->gen = header()->next_gen++;
+        s->refs = 1;
+        s->expires_ms = expires_ms;
+        std::strncpy(s->token, token.c_str(), TOKEN_MAX);
+        h = Handle{hash, check, s->gen, true};
+    }
+    unlock();
+}
+
+std::string LocalLeaseTable::current_token(const Handle& h) const {
+    if (!h.shared) return {};
+
+    std::string token;
+    lock();
+    const Slot* s = find(h.hash, h.check, false, 0);
+    if (s && s->gen == h.gen && s->refs > 0) token.assign(s->token);
+    unlock();
+    return token;
+}
+
+void LocalLeaseTable::renew(const std::string& token, const Handle& h, long long expires_ms) {
+    if (!h.shared) return;
+
+    lock();
+    Slot* s = find(h.hash, h.check, false, 0);
+    if (s && s->gen == h.gen && s->refs > 0 && token == s->token && expires_ms > s->expires_ms)
+        s->expires_ms = expires_ms;
+    unlock();
+}
+
+std::string LocalLeaseTable::leave(const std::string& token, const Handle& h) {
+    if (!h.shared) return token;
+
+    std::string release;
+    lock();
+    Slot* s = find(h.hash, h.check, false, 0);
+    if (s && s->gen == h.gen && s->refs > 0) {
+        if (--s->refs == 0) release.assign(s->token);
+    }
+    unlock();
+    return release;
+}
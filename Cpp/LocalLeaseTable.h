@@ -0,0 +1,116 @@
+//
+// Node-local sharing of Redis reader leases.
+//
+
+#ifndef POC_CACHE_HIREDIS_LOCALLEASETABLE_H
+#define POC_CACHE_HIREDIS_LOCALLEASETABLE_H
+
+#include <string>
+#include <cstdint>
+
+/**
+ * A table in POSIX shared memory that lets every process on a host share one
+ * Redis reader lease per key.
+ *
+ * The first local reader of a key acquires a lease in Redis and attach()es it
+ * here; later local readers join() it and only bump a reference count. The
+ * reader that drops the count to zero releases the Redis lease. Redis
+ * traffic for reads then scales with the distinct keys being read on a node,
+ * not with the number of reads.
+ *
+ * Slots are found by a 64-bit hash of the key and confirmed with a second,
+ * independent one, so two keys share a slot only if both collide.
+ *
+ * Each slot records when its lease expires (host steady_clock), and renew()
+ * moves that forward when the lease heartbeat extends it in Redis. A lease
+ * closer than 'min_life_ms' to expiry is not joined; the next reader gets a
+ * fresh lease from Redis and the slot's readers move over to it. A slot
+ * that is past expiry starts a new generation. The lease heartbeat renews
+ * a slot's current token for as long as any of its readers holds the slot,
+ * so the readers moved to a new lease keep it alive after the reader that
+ * brought it leaves. Readers of an older
+ * generation then leave without touching the count, so references leaked by
+ * a crashed process cannot pin the slot.
+ *
+ * The table is protected by one process-shared (on Linux, robust) mutex that
+ * is never held across a Redis round trip.
+ */
+class LocalLeaseTable {
+public:
+    /// A reader's claim on a slot; needed to leave().
+    struct Handle {
+        uint64_t hash = 0;
+        uint64_t check = 0;
+        uint64_t gen = 0;
+        bool shared = false;    /// false == the table was full; the reader owns its lease alone
+    };
+
+    /// Open (creating if needed) the table named 'name'; 'name' must start with '/'.
+    explicit LocalLeaseTable(const std::string& name, uint32_t nslots = 4096);
+    ~LocalLeaseTable();
+
+    LocalLeaseTable(const LocalLeaseTable&) = delete;
+    LocalLeaseTable& operator=(const LocalLeaseTable&) = delete;
+
+    /**
+     * Join a live lease on 'key'.
+     * @return true and set 'token' and 'h' if there is one with at least
+     * 'min_life_ms' left; false if the caller must acquire one from Redis.
+     */
+    bool join(const std::string& key, long long now_ms, long long min_life_ms, std::string& token, Handle& h);
+
+    /**
+     * Record the lease 'token' that the caller just acquired from Redis.
+     * If another local reader attached a usable lease first, the caller
+     * joins that one instead: 'token' is replaced and 'surplus' is set to
+     * the caller's own lease, which the caller should release. If the slot
+     * held a lease about to expire, its readers move to the new lease and
+     * 'surplus' is set to the old one.
+     */
+    void attach(const std::string& key, std::string& token, long long now_ms, long long expires_ms,
+                long long min_life_ms, Handle& h, std::string& surplus);
+
+    /**
+     * The token of the lease that the readers of 'h''s slot use now: the
+     * reader's own, or a newer one they were moved to (see attach()). "" if
+     * the slot has moved on to another generation.
+     */
+    std::string current_token(const Handle& h) const;
+
+    /**
+     * Record that the lease 'token' held through 'h' was extended in Redis
+     * until 'expires_ms'. Does nothing if the slot has moved on to another
+     * lease or generation.
+     */
+    void renew(const std::string& token, const Handle& h, long long expires_ms);
+
+    /**
+     * Drop a reference.
+     * @return The token to release in Redis, or "" if other local readers
+     * still use it (or it belongs to a generation that already ended).
+     */
+    std::string leave(const std::string& token, const Handle& h);
+
+    /// Remove the shared memory segment 'name' (tests and cleanup).
+    static void remove(const std::string& name);
+
+    /// The table name used for a cache namespace on a given Redis server.
+    static std::string name_for(const std::string& ns, const std::string& host, int port, int db);
+
+private:
+    struct Header;
+    struct Slot;
+
+    std::string name_;
+    uint32_t nslots_;
+    size_t size_ = 0;
+    void* base_ = nullptr;
+
+    Header* header() const;
+    Slot* slots() const;
+    Slot* find(uint64_t hash, uint64_t check, bool for_insert, long long now_ms) const;
+    void lock() const;
+    void unlock() const;
+};
+
+#endif //POC_CACHE_HIREDIS_LOCALLEASETABLE_H
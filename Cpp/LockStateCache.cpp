@@ -0,0 +1,149 @@
+//
+// Client-side cache of per-key lock state, kept current by RESP3 invalidation pushes.
+//
+
+#include "LockStateCache.h"
+#include "RedisConnect.h"
+
+#include <hiredis/hiredis.h>
+
+#include <poll.h>
+
+#include <stdexcept>
+
+static void rc_deleter(redisContext* c) {
+    if (c) redisFree(c);
+}
+
+LockStateCache::LockStateCache(const std::string& redis_host, int redis_port, int redis_db, size_t max_keys)
+: rc_(nullptr, rc_deleter), max_keys_(max_keys)
+{
+#if !defined(REDIS_REPLY_PUSH)
+    (void)redis_host; (void)redis_port; (void)redis_db;
+    throw std::runtime_error("Lock state tracking needs hiredis 1.0 or later (RESP3)");
+#else
+    redisContext* c = redis_connect(redis_host, redis_port);
+    if (!c || c->err) {
+        const std::string msg = c ? c->errstr : "redisConnect failed";
+        if (c) redisFree(c);
+        throw std::runtime_error("Redis connect error: " + msg);
+    }
+    rc_.reset(c);
+
+    // Pushes that arrive while waiting for a command's reply are routed here.
+    c->privdata = this;
+    redisSetPushCallback(c, on_push);
+
+    auto ok = [this](const char* cmd) {
+        auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), cmd));
+        const bool good = r && r->type != REDIS_REPLY_ERROR;
+        if (r) freeReplyObject(r);
+        return good;
+    };
+    if (!ok("HELLO 3")) throw std::runtime_error("Lock state tracking needs a Redis server with RESP3 (6.0 or later)");
+    if (redis_db != 0) {
+        auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), "SELECT %d", redis_db));
+        const bool good = r && r->type != REDIS_REPLY_ERROR;
+        if (r) freeReplyObject(r);
+        if (!good) throw std::runtime_error("Redis database connection error (db: " + std::to_string(redis_db) + ")");
+    }
+    if (!ok("CLIENT TRACKING ON")) throw std::runtime_error("CLIENT TRACKING ON failed");
+#endif
+}
+
+LockStateCache::~LockStateCache() {
+    if (rc_) rc_->privdata = nullptr;
+}
+
+void LockStateCache::on_push(void* privdata, void* reply) {
+    auto* self = static_cast<LockStateCache*>(privdata);
+    if (self) self->invalidate(static_cast<redisReply*>(reply));
+    freeReplyObject(reply);
+}
+
+/**
+ * Apply one push. An invalidation is ["invalidate", [key, ...]], or
+ * ["invalidate", nil] when the server flushed its tracking table (e.g.,
+ * FLUSHALL); in that case nothing we know can be trusted.
+ */
+void LockStateCache::invalidate(const redisReply* push) {
+#if defined(REDIS_REPLY_PUSH)
+    if (!push || push->type != REDIS_REPLY_PUSH || push->elements < 2) return;
+    const auto* kind = push->element[0];
+    if (kind->type != REDIS_REPLY_STRING || std::string(kind->str, kind->len) != "invalidate") return;
+
+    ++invalidations_;
+    const auto* keys = push->element[1];
+    if (keys->type != REDIS_REPLY_ARRAY) {
+        absent_.clear();
+        return;
+    }
+    for (size_t i = 0; i < keys->elements; ++i) {
+        const auto* k = keys->element[i];
+        if (k->type == REDIS_REPLY_STRING) absent_.erase(std::string(k->str, k->len));
+    }
+#else
+    (void)push;
+#endif
+}
+
+void LockStateCache::fail() {
+    absent_.clear();
+    broken_ = true;
+}
+
+/**
+ * Apply every push the server has sent so far, without blocking: poll the
+ * socket, read what is there and parse complete replies out of the buffer.
+ * Nothing but pushes is expected here since no command is in flight.
+ */
+void LockStateCache::drain() {
+    struct pollfd pfd{rc_->fd, POLLIN, 0};
+    while (::poll(&pfd, 1, 0) > 0) {
+        if (!(pfd.revents & POLLIN) || redisBufferRead(rc_.get()) != REDIS_OK) {
+            fail();
+            return;
+        }
+        void* reply = nullptr;
+        while (redisGetReplyFromReader(rc_.get(), &reply) == REDIS_OK && reply) {
+            invalidate(static_cast<redisReply*>(reply));
+            freeReplyObject(reply);
+            reply = nullptr;
+        }
+        if (rc_->err) {
+            fail();
+            return;
+        }
+    }
+}
+
+bool LockStateCache::absent(const std::string& k1, const std::string& k2) {
+    if (broken_) return false;
+    ++lookups_;
+    drain();
+    if (broken_) return false;
+
+    if (absent_.count(k1) && absent_.count(k2)) {
+        ++hits_;
+        return true;
+    }
+
+    // MGET makes the server track both keys for this connection, whether or not they exist.
+    auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), "MGET %b %b",
+        k1.data(), k1.size(), k2.data(), k2.size()));
+    if (!r) {
+        fail();
+        return false;
+    }
+    std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+    if (r->type != REDIS_REPLY_ARRAY || r->elements != 2) return false;
+
+    const bool none = r->element[0]->type == REDIS_REPLY_NIL && r->element[1]->type == REDIS_REPLY_NIL;
+    if (none) {
+        // Bound the local table; the server-side table is bounded by tracking-table-max-keys.
+        if (absent_.size() + 2 > max_keys_) absent_.clear();
+        absent_.insert(k1);
+        absent_.insert(k2);
+    }
+    return none;
+}
@@ -0,0 +1,68 @@
+//
+// Client-side cache of per-key lock state, kept current by RESP3 invalidation pushes.
+//
+
+#ifndef POC_CACHE_HIREDIS_LOCKSTATECACHE_H
+#define POC_CACHE_HIREDIS_LOCKSTATECACHE_H
+
+#include <string>
+#include <memory>
+#include <unordered_set>
+
+struct redisContext;
+struct redisReply;
+
+/**
+ * Remember which Redis lock keys are known to be absent, using Redis
+ * server-assisted client-side caching (CLIENT TRACKING).
+ *
+ * The class has its own connection in RESP3 with tracking on. Looking up a
+ * pair of lock keys does one MGET the first time; from then on the server
+ * tracks the keys for this connection and sends an 'invalidate' push when
+ * either one is written, expires or is deleted. Pushes are drained, without
+ * blocking, at the start of every lookup. So while nothing happens to a
+ * key's locks, a lookup is answered locally.
+ *
+ * The answer can be late by the time it takes a push to arrive. Callers must
+ * only use it where acting on slightly stale lock state is safe.
+ *
+ * If the connection fails, everything known is forgotten and every later
+ * lookup reports the keys as not known absent, so the caller falls back to
+ * asking Redis itself.
+ */
+class LockStateCache {
+public:
+    /// Throws std::runtime_error if the server or hiredis does not support RESP3.
+    LockStateCache(const std::string& redis_host, int redis_port, int redis_db, size_t max_keys = 100000);
+    ~LockStateCache();
+
+    LockStateCache(const LockStateCache&) = delete;
+    LockStateCache& operator=(const LockStateCache&) = delete;
+
+    /**
+     * Are the Redis keys 'k1' and 'k2' both absent?
+     * @return true if both are known (or were just found) not to exist.
+     */
+    bool absent(const std::string& k1, const std::string& k2);
+
+    long long hits() const { return hits_; }
+    long long lookups() const { return lookups_; }
+    long long invalidations() const { return invalidations_; }
+
+private:
+    std::unique_ptr<redisContext, void(*)(redisContext*)> rc_;
+    size_t max_keys_;
+    std::unordered_set<std::string> absent_;   /// Keys Redis told us do not exist, not since invalidated
+    bool broken_ = false;
+
+    long long hits_ = 0;
+    long long lookups_ = 0;
+    long long invalidations_ = 0;
+
+    void drain();
+    void fail();
+    static void on_push(void* privdata, void* reply);
+    void invalidate(const redisReply* push);
+};
+
+#endif //POC_CACHE_HIREDIS_LOCKSTATECACHE_H
@@ -0,0 +1,24 @@
+//
+// Connecting to Redis over TCP or a Unix socket.
+//
+
+#ifndef POC_CACHE_HIREDIS_REDISCONNECT_H
+#define POC_CACHE_HIREDIS_REDISCONNECT_H
+
+#include <hiredis/hiredis.h>
+
+#include <string>
+
+/**
+ * Connect to Redis at 'host':'port' or, when 'host' is an absolute path
+ * (e.g. /run/redis/redis.sock), over that Unix socket; 'port' is then
+ * ignored. A socket skips the loopback TCP stack, which is a good share of a
+ * local round trip. Like redisConnect(), returns null or a context with err
+ * set on failure.
+ */
+inline redisContext* redis_connect(const std::string& host, int port) {
+    if (!host.empty() && host[0] == '/') return redisConnectUnix(host.c_str());
+    return redisConnect(host.c_str(), port);
+}
+
+#endif //POC_CACHE_HIREDIS_REDISCONNECT_H
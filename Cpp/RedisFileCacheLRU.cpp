@@ -4,6 +4,12 @@
 
 #include "RedisFileCacheLRU.h"
 #include "ScriptManager.h"
+#include "LeaseKeeper.h"
+#include "LockStateCache.h"
+#include "KeyHash.h"
+#include "CacheMetrics.h"
+#include "CacheTrace.h"
+#include "RedisConnect.h"
 
 #include <hiredis/hiredis.h>
 // #include <hiredis/async.h>
@@ -21,6 +27,10 @@
 #include <iomanip>
 #include <thread>
 #include <cerrno>
+#include <cstring>
+
+constexpr int RedisFileCache::index_schema_version;
+constexpr int RedisFileCache::meta_flag_key_header;
 
 static void rc_deleter(redisContext* c) {
     if (c) redisFree(c);
@@ -30,6 +40,11 @@ static void ensure_dir(const std::string& d) {
     ::mkdir(d.c_str(), 0777);
 }
 
+// The command a hiredis format string sends, e.g. "HSET" for "HSET %s %b %lld"
+static std::string command_name(const char* fmt) {
+    return {fmt, std::strcspn(fmt, " ")};
+}
+
 bool RedisFileCache::file_exists_(const std::string& p) {
     struct stat st{};
     return ::stat(p.c_str(), &st) == 0 && S_ISREG(st.st_mode);
@@ -42,14 +57,108 @@ void RedisFileCache::fsync_fd(int fd) {
     }
 }
 
-void RedisFileCache::validate_key(const std::string& key) {
-    if (key.empty() || key.front()=='.' || key.find('/') != std::string::npos) {
+void RedisFileCache::validate_key(const std::string& key) const {
+    if (key.empty()) throw std::invalid_argument("Key must not be empty");
+    if (uses_hashed_names()) return;  // any byte string
+    if (key.front()=='.' || key.find('/') != std::string::npos) {
         throw std::invalid_argument("Key must be simple filename");
     }
 }
 
+// 32 hex digits of the key's MurmurHash3 x64_128; the same width for every key
+std::string RedisFileCache::hashed_name(const std::string& key) {
+    return to_hex(murmur3_128(key));
+}
+
+std::string RedisFileCache::entry_name(const std::string& key) const {
+    switch (key_encoding_) {
+        case KeyEncoding::binary64:  return to_hex(murmur3_128(key).h1);
+        case KeyEncoding::binary128: return hashed_name(key);
+        default:                     return hashed_names_ ? hashed_name(key) : key;
+    }
+}
+
+// With a binary key encoding the on-disk name is hex, and Redis gets its raw 8 or 16 bytes.
+std::string RedisFileCache::redis_id(const std::string& name) const {
+    return key_encoding_ == KeyEncoding::text ? name : from_hex(name);
+}
+
+std::string RedisFileCache::name_for_id(const std::string& id) const {
+    return key_encoding_ == KeyEncoding::text ? id : to_hex(id.data(), id.size());
+}
+
+// Entry header used with hashed names: magic, key length (4 bytes, little endian), key.
+static const char KEY_HEADER_MAGIC[4] = {'R', 'F', 'K', '1'};
+
+std::string RedisFileCache::key_header(const std::string& key) {
+    std::string h(KEY_HEADER_MAGIC, sizeof(KEY_HEADER_MAGIC));
+    const auto n = (uint32_t)key.size();
+    for (int i = 0; i < 4; ++i) h.push_back((char)((n >> (8 * i)) & 0xff));
+    return h + key;
+}
+
+/**
+ * The length of the key header at the start of 'buf' (its first 'n' bytes
+ * of a file), or -1 if there is none.
+ */
+long long RedisFileCache::key_header_size(const char* buf, size_t n) {
+    const size_t fixed = sizeof(KEY_HEADER_MAGIC) + 4;
+    if (n < fixed || std::memcmp(buf, KEY_HEADER_MAGIC, sizeof(KEY_HEADER_MAGIC)) != 0) return -1;
+    uint32_t len = 0;
+    for (int i = 3; i >= 0; --i) len = (len << 8) | (unsigned char)buf[sizeof(KEY_HEADER_MAGIC) + i];
+    return (long long)(fixed + len);
+}
+
+/**
+ * Remove the key header from 'content' after checking that it names 'key'.
+ * A different key means two keys share a hash (or the file predates hashed
+ * names); either way the entry is not 'key's, so it is a miss.
+ */
+void RedisFileCache::strip_key_header(std::string& content, const std::string& key) {
+    const size_t fixed = sizeof(KEY_HEADER_MAGIC) + 4;
+    bool ok = content.size() >= fixed && content.compare(0, sizeof(KEY_HEADER_MAGIC), KEY_HEADER_MAGIC, sizeof(KEY_HEADER_MAGIC)) == 0;
+    uint32_t n = 0;
+    if (ok) {
+        for (int i = 3; i >= 0; --i) n = (n << 8) | (unsigned char)content[sizeof(KEY_HEADER_MAGIC) + i];
+        ok = content.size() >= fixed + n && n == key.size() && content.compare(fixed, n, key) == 0;
+    }
+    if (!ok) throw std::system_error(ENOENT, std::generic_category(), "FileNotFound (key mismatch)");
+    content.erase(0, fixed + n);
+}
+
+/**
+ * One level per byte of the key's FNV-1a hash, each named by two hex digits,
+ * so every level has at most 256 subdirectories. With two levels a cache of a
+ * million entries has about 15 per directory.
+ */
+std::string RedisFileCache::fanout_subdir(const std::string& key, int levels) {
+    const std::string h = to_hex(fnv1a_64(key));
+    std::string sub;
+    for (int i = 0; i < levels; ++i) {
+        if (i > 0) sub.push_back('/');
+        sub.append(h, 2 * i, 2);
+    }
+    return sub;
+}
+
+std::string RedisFileCache::dir_for(const std::string& key) const {
+    if (fanout_levels_ == 0) return cache_dir_;
+    return cache_dir_ + "/" + fanout_subdir(key, fanout_levels_);
+}
+
 std::string RedisFileCache::path_for(const std::string& key) const {
-    return cache_dir_ + "/" + key;
+    return dir_for(key) + "/" + key;
+}
+
+// Create the fan-out directories for 'key'; they are made on first write, not up front.
+void RedisFileCache::ensure_dir_for(const std::string& key) const {
+    const std::string sub = fanout_subdir(key, fanout_levels_);
+    std::string d = cache_dir_;
+    for (size_t pos = 0; pos < sub.size(); pos += 3) {
+        d += "/" + sub.substr(pos, 2);
+        if (::mkdir(d.c_str(), 0777) != 0 && errno != EEXIST)
+            throw std::system_error(errno, std::generic_category(), "mkdir " + d);
+    }
 }
 std::string RedisFileCache::k_write(const std::string& key) const {
     return ns_ + ":lock:write:" + key;
@@ -59,56 +168,371 @@ std::string RedisFileCache::k_readers(const std::string& key) const {
 }
 
 // ------- Lua sources -------
+// The readers key is a ZSET of per-reader leases: member = token, score = expiry in Redis server ms.
+// Every script that looks at it first prunes expired leases, so a crashed reader blocks writers and
+// eviction for at most one lock TTL. TIME inside a script that writes needs Redis 5 or later.
 static const char* LUA_READ_LOCK_ACQUIRE = R"(
-    local wl = KEYS[1]; local rd = KEYS[2]; local ttl = tonumber(ARGV[1])
+    local wl = KEYS[1]; local rd = KEYS[2]; local token = ARGV[1]; local ttl = tonumber(ARGV[2])
     if redis.call('EXISTS', wl) == 1 then return 0 end
-    local c = redis.call('INCR', rd); redis.call('PEXPIRE', rd, ttl); return 1
+    local t = redis.call('TIME'); local now = t[1] * 1000 + math.floor(t[2] / 1000)
+    redis.call('ZREMRANGEBYSCORE', rd, '-inf', now)
+    redis.call('ZADD', rd, now + ttl, token)
+    if redis.call('PTTL', rd) < ttl then redis.call('PEXPIRE', rd, ttl) end; return 1
 )";
 static const char* LUA_READ_LOCK_RELEASE = R"(
-    local rd = KEYS[1]; local c = redis.call('DECR', rd)
-    if c <= 0 then redis.call('DEL', rd) end; return 1
+    local rd = KEYS[1]; local token = ARGV[1]
+    redis.call('ZREM', rd, token)
+    if redis.call('ZCARD', rd) == 0 then redis.call('DEL', rd) end; return 1
 )";
+// On success, returns a fencing token: a namespace-wide counter that increases with every write lock granted.
 static const char* LUA_WRITE_LOCK_ACQUIRE = R"(
-    local wl = KEYS[1]; local rd = KEYS[2]; local token = ARGV[1]; local ttl = tonumber(ARGV[2])
+    local wl = KEYS[1]; local rd = KEYS[2]; local fc = KEYS[3]; local token = ARGV[1]; local ttl = tonumber(ARGV[2])
     if redis.call('EXISTS', wl) == 1 then return 0 end
-    local rc = tonumber(redis.call('GET', rd) or "0"); if rc > 0 then return -1 end
-    local ok = redis.call('SET', wl, token, 'NX', 'PX', ttl); if ok then return 1 else return 0 end
+    local t = redis.call('TIME'); local now = t[1] * 1000 + math.floor(t[2] / 1000)
+    redis.call('ZREMRANGEBYSCORE', rd, '-inf', now)
+    if redis.call('ZCARD', rd) > 0 then return -1 end
+    local ok = redis.call('SET', wl, token, 'NX', 'PX', ttl); if ok then return redis.call('INCR', fc) else return 0 end
 )";
 static const char* LUA_WRITE_LOCK_RELEASE = R"(
     local wl = KEYS[1]; local token = ARGV[1]; local cur = redis.call('GET', wl)
     if cur and cur == token then redis.call('DEL', wl); return 1 end; return 0
 )";
+// ARGV[2] == '1' skips the reader check (ReadMode::open_fd: readers hold open fds, not leases).
 static const char* LUA_CAN_EVICT = R"(
     local wl=KEYS[1]; local rd=KEYS[2]; local ev=KEYS[3]; local ttl=tonumber(ARGV[1])
     if redis.call('EXISTS', wl) == 1 then return 0 end
-    local rc = tonumber(redis.call('GET', rd) or "0"); if rc > 0 then return 0 end
+    if ARGV[2] ~= '1' then
+        local t = redis.call('TIME'); local now = t[1] * 1000 + math.floor(t[2] / 1000)
+        redis.call('ZREMRANGEBYSCORE', rd, '-inf', now)
+        if redis.call('ZCARD', rd) > 0 then return 0 end
+    end
     local ok = redis.call('SET', ev, '1', 'NX', 'PX', ttl); if ok then return 1 else return 0 end
 )";
 
+// Validate an optimistic (lock-free) read: no eviction in progress and the key is still
+// indexed with the size that was read.
+static const char* LUA_READ_VALIDATE = R"(
+    local ev = KEYS[1]; local meta = KEYS[2]; local key = ARGV[1]; local n = tonumber(ARGV[2])
+    if redis.call('EXISTS', ev) == 1 then return 0 end
+    local m = redis.call('HGET', meta, key)
+    if m and tonumber(string.match(m, '^(%d+)')) == n then return 1 end; return 0
+)";
+// The scripts that change the index also append an event to the ns:events stream, capped at
+// about MAXLEN entries; a MAXLEN of 0 turns events off.
+
+// Scripts that change the total in step with idx:meta also add the bytes they moved to 'churn' in
+// the audit pass hash (KEYS[6]), the error bound on that pass's drift (see audit_index()).
+
+// Index a published entry in one round trip: its packed meta field ("size:created_ms:flags"),
+// the total, and its LRU position. Re-indexing a key (e.g., after index drift) replaces its size.
+static const char* LUA_PUBLISH = R"(
+    local meta = KEYS[1]; local total = KEYS[2]; local lru = KEYS[3]; local atime = KEYS[4]
+    local key = ARGV[1]; local size = tonumber(ARGV[2]); local ts = ARGV[3]
+    local prev = redis.call('HGET', meta, key)
+    if prev then
+        local old = tonumber(string.match(prev, '^(%d+)'))
+        redis.call('INCRBY', total, -old); redis.call('HINCRBY', KEYS[6], 'churn', old)
+    end
+    redis.call('HSET', meta, key, ARGV[2] .. ':' .. ts .. ':' .. ARGV[5])
+    redis.call('INCRBY', total, size); redis.call('HINCRBY', KEYS[6], 'churn', size)
+    if ARGV[4] == 'sampled' then redis.call('HSET', atime, key, ts) else redis.call('ZADD', lru, ts, key) end
+    if tonumber(ARGV[6]) > 0 then
+        redis.call('XADD', KEYS[5], 'MAXLEN', '~', ARGV[6], '*', 'type', 'publish', 'key', key, 'size', ARGV[2])
+    end
+    return 1
+)";
+// Drop an entry from every index structure. Returns the size that was removed from the
+// total, or -1 if the entry was not indexed (so a racing evictor cannot subtract it twice).
+// ARGV[2] is the event type ('evict' or 'drift_fix').
+static const char* LUA_UNINDEX = R"(
+    local meta = KEYS[1]; local total = KEYS[2]; local lru = KEYS[3]; local atime = KEYS[4]; local key = ARGV[1]
+    redis.call('ZREM', lru, key); redis.call('HDEL', atime, key)
+    local m = redis.call('HGET', meta, key)
+    if not m then return -1 end
+    local size = tonumber(string.match(m, '^(%d+)'))
+    redis.call('HDEL', meta, key); redis.call('INCRBY', total, -size); redis.call('HINCRBY', KEYS[6], 'churn', size)
+    if tonumber(ARGV[3]) > 0 then
+        local ev = {'type', ARGV[2], 'key', key, 'size', size}
+        if ARGV[2] ~= 'evict' then ev[7] = 'fix'; ev[8] = 'drop' end
+        redis.call('XADD', KEYS[5], 'MAXLEN', '~', ARGV[3], '*', unpack(ev))
+    end
+    return size
+)";
+
+// Index audit fixes. Each applies only if the entry's meta field still holds the value the
+// auditor saw (ARGV[2]), so an entry re-published since is left alone.
+// Set an entry's size to what is on disk; returns the change made to the total.
+static const char* LUA_AUDIT_FIX = R"(
+    local meta = KEYS[1]; local total = KEYS[2]; local key = ARGV[1]; local seen = ARGV[2]; local size = tonumber(ARGV[3])
+    if redis.call('HGET', meta, key) ~= seen then return 0 end
+    local old = tonumber(string.match(seen, '^(%d+)'))
+    redis.call('HSET', meta, key, ARGV[3] .. string.sub(seen, #string.match(seen, '^(%d+)') + 1))
+    redis.call('INCRBY', total, size - old)
+    if tonumber(ARGV[4]) > 0 then
+        redis.call('XADD', KEYS[3], 'MAXLEN', '~', ARGV[4], '*', 'type', 'drift_fix', 'fix', 'size', 'key', key,
+                   'size', size, 'delta', size - old)
+    end
+    return size - old
+)";
+// Drop an entry whose file is gone; returns its size, or -1 if it changed or went first.
+static const char* LUA_AUDIT_DROP = R"(
+    local meta = KEYS[1]; local total = KEYS[2]; local lru = KEYS[3]; local atime = KEYS[4]
+    local key = ARGV[1]
+    if redis.call('HGET', meta, key) ~= ARGV[2] then return -1 end
+    local size = tonumber(string.match(ARGV[2], '^(%d+)'))
+    redis.call('ZREM', lru, key); redis.call('HDEL', atime, key); redis.call('HDEL', meta, key)
+    redis.call('INCRBY', total, -size)
+    if tonumber(ARGV[3]) > 0 then
+        redis.call('XADD', KEYS[5], 'MAXLEN', '~', ARGV[3], '*', 'type', 'drift_fix', 'fix', 'drop', 'key', key, 'size', size)
+    end
+    return size
+)";
+// A batch of coalesced sampled-mode touches (ARGV: key ts key ts ...). Each is set only if the key
+// is still indexed, so a batch flushed after an eviction cannot put the key back in idx:atime.
+static const char* LUA_TOUCH_ATIME = R"(
+    local meta = KEYS[1]; local atime = KEYS[2]; local n = 0
+    for i = 1, #ARGV, 2 do
+        if redis.call('HEXISTS', meta, ARGV[i]) == 1 then redis.call('HSET', atime, ARGV[i], ARGV[i + 1]); n = n + 1 end
+    end
+    return n
+)";
+// The audit pass hash (KEYS[1]) holds the pass's 'epoch', the total when it began ('base'), the sum
+// of the indexed sizes its steps saw ('sum') and 'churn'. Begin a pass; returns its epoch.
+static const char* LUA_AUDIT_BEGIN = R"(
+    local pass = KEYS[1]; local epoch = redis.call('HINCRBY', pass, 'epoch', 1)
+    redis.call('HSET', pass, 'base', redis.call('GET', KEYS[2]) or '0', 'sum', 0, 'churn', 0)
+    return epoch
+)";
+// Add one step's sizes to pass ARGV[1]; a no-op if another process has begun a new pass since.
+static const char* LUA_AUDIT_ADD = R"(
+    if redis.call('HGET', KEYS[1], 'epoch') ~= ARGV[1] then return 0 end
+    redis.call('HINCRBY', KEYS[1], 'sum', ARGV[2]); return 1
+)";
+// End pass ARGV[1]: the drift is base - sum. Each entry changed during the pass was counted at its
+// old or its new size, so the drift is known to within the churn; a larger drift is taken off the
+// total with INCRBY, so changes made since are kept. The epoch moves on, so a pass ends once.
+// Returns the drift, or 0 if the pass was not current.
+static const char* LUA_AUDIT_END = R"(
+    local pass = KEYS[1]; local total = KEYS[2]
+    if redis.call('HGET', pass, 'epoch') ~= ARGV[1] then return 0 end
+    redis.call('HINCRBY', pass, 'epoch', 1)
+    local drift = tonumber(redis.call('HGET', pass, 'base')) - tonumber(redis.call('HGET', pass, 'sum'))
+    if math.abs(drift) > tonumber(redis.call('HGET', pass, 'churn')) then
+        redis.call('INCRBY', total, -drift)
+        if tonumber(ARGV[2]) > 0 then
+            redis.call('XADD', KEYS[3], 'MAXLEN', '~', ARGV[2], '*', 'type', 'drift_fix', 'fix', 'total', 'delta', -drift)
+        end
+    end
+    return drift
+)";
+
 // ------------------ LRU -----------------
 
-long long RedisFileCache::now_ms() {
+long long RedisFileCache::steady_ms() {
     using namespace std::chrono;
     return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
+/**
+ * Measure the offset between this host's (possibly skewed) steady_clock and
+ * the Redis server's clock using TIME. The midpoint of the round trip is taken
+ * as the moment the server read its clock, so the error is at most RTT/2.
+ * On failure the previous offset is kept.
+ */
+void RedisFileCache::sync_lru_clock() const {
+    const long long t0 = steady_ms() + clock_skew_ms_;
+    redisReply* r;
+    {
+        ScopedLatency timer(metrics_->command("TIME"));
+        TraceSpan span(tracer_.get(), "TIME");
+        r = static_cast<redisReply *>(redisCommand(rc_.get(), "TIME"));
+    }
+    const long long t1 = steady_ms() + clock_skew_ms_;
+    clock_synced_at_ms_ = t1;
+    if (!r) return;
+    std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+    if (r->type != REDIS_REPLY_ARRAY || r->elements != 2
+        || r->element[0]->type != REDIS_REPLY_STRING || r->element[1]->type != REDIS_REPLY_STRING) return;
+
+    try {
+        const long long sec = std::stoll(std::string(r->element[0]->str, r->element[0]->len));
+        const long long usec = std::stoll(std::string(r->element[1]->str, r->element[1]->len));
+        redis_clock_offset_ms_ = (sec * 1000 + usec / 1000) - (t0 + t1) / 2;
+    } catch (...) {}
+}
+
+/**
+ * The LRU clock. With LruClock::redis this is the Redis server time in ms
+ * since the epoch, the same on every host; with LruClock::steady it is the
+ * local steady_clock, which is not comparable across hosts.
+ */
+long long RedisFileCache::now_ms() const {
+    const long long local = steady_ms() + clock_skew_ms_;
+    if (lru_clock_ == LruClock::steady) return local;
+
+    if (local - clock_synced_at_ms_ >= clock_resync_ms_) sync_lru_clock();
+    return local + redis_clock_offset_ms_;
+}
+
+/**
+ * Send one LRU touch. Like a coalesced batch (see flush_lru_touches()), it
+ * only updates a key that is still indexed: a read that raced an eviction
+ * must not put the evicted key back in idx:lru or idx:atime.
+ */
+void RedisFileCache::touch_lru_now(const std::string& key, long long ts_ms) const {
+    if (lru_mode_ == LruMode::sampled) {
+        // HSET idx:atime key ts, if the key is in idx:meta; no global ordering is maintained
+        scripts_->evalsha_ll("touch_atime", 2, {h_meta_, h_atime_}, {key, std::to_string(ts_ms)});
+    }
+    else {
+        // ZADD idx:lru XX GT ts key
+        cmd_ll("ZADD %s XX GT %lld %b", z_lru_.c_str(), ts_ms, key.data(), (size_t)key.size());
+    }
+    if (touch_granularity_ms_ > 0) {
+        touch_sent_[key] = ts_ms;
+        touch_pending_.erase(key);
+    }
+}
+
+/**
+ * Record an access to 'key' for LRU purposes. Without touch coalescing this is
+ * a single ZADD XX GT (or the touch_atime script in sampled mode). With coalescing, the access is kept
+ * locally and sent later in a batch; an access to a key whose last sent touch
+ * is within touch_granularity_ms_ is dropped since it would barely change the
+ * eviction order.
+ *
+ * @note The class is not thread safe, so there is no flush thread; the flush
+ * interval is checked here, on each write and on destruction.
+ */
 void RedisFileCache::touch_lru(const std::string& key, long long ts_ms) const {
-    // ZADD idx:lru ts key
-    cmd_ll("ZADD %s %lld %b", z_lru_.c_str(), ts_ms, key.data(), (size_t)key.size());
+    if (touch_granularity_ms_ <= 0) {
+        touch_lru_now(key, ts_ms);
+        return;
+    }
+
+    const auto sent = touch_sent_.find(key);
+    if (sent == touch_sent_.end() || ts_ms - sent->second >= touch_granularity_ms_) {
+        touch_pending_[key] = ts_ms;
+    }
+
+    if (touch_pending_.size() >= touch_batch_max_ || ts_ms - touch_last_flush_ms_ >= touch_flush_ms_) {
+        flush_lru_touches();
+    }
+}
+
+/**
+ * Send all pending coalesced LRU touches in one command. In LruMode::exact
+ * this is 'ZADD idx:lru XX GT ts key ...': XX keeps a touch from resurrecting
+ * a key evicted since the access and GT keeps an older, late-arriving touch
+ * from moving another host's newer one backwards. In sampled mode it is the
+ * touch_atime script, which sets the access times of the keys that are still
+ * in idx:meta, for the same reason as XX.
+ *
+ * Errors are swallowed; losing a batch of touches only degrades LRU order.
+ */
+void RedisFileCache::flush_lru_touches() const {
+    const long long now = now_ms();
+    touch_last_flush_ms_ = now;
+
+    // Forget keys whose last touch is outside the window; they will be sent again on next access.
+    for (auto it = touch_sent_.begin(); it != touch_sent_.end(); ) {
+        if (now - it->second >= touch_granularity_ms_) it = touch_sent_.erase(it);
+        else ++it;
+    }
+
+    if (touch_pending_.empty() || !rc_) return;
+
+    if (lru_mode_ == LruMode::sampled) {
+        std::vector<std::string> argv;
+        argv.reserve(2 * touch_pending_.size());
+        for (const auto& kv : touch_pending_) {
+            argv.push_back(kv.first);
+            argv.push_back(std::to_string(kv.second));
+        }
+        TraceSpan span(tracer_.get(), "flush_lru_touches");
+        try { scripts_->evalsha_ll("touch_atime", 2, {h_meta_, h_atime_}, argv); }
+        catch (const std::exception&) {}
+    }
+    else {
+        std::vector<std::string> args;
+        args.reserve(4 + 2 * touch_pending_.size());
+        args.emplace_back("ZADD");
+        args.push_back(z_lru_);
+        args.emplace_back("XX");
+        args.emplace_back("GT");
+        for (const auto& kv : touch_pending_) {
+            args.push_back(std::to_string(kv.second));
+            args.push_back(kv.first);
+        }
+
+        TraceSpan span(tracer_.get(), "flush_lru_touches");
+        try { cmd_argv(args); }
+        catch (const std::exception&) {}
+    }
+
+    for (const auto& kv : touch_pending_) touch_sent_[kv.first] = kv.second;
+    touch_pending_.clear();
 }
 
 void RedisFileCache::index_add_on_publish(const std::string& key, long long size, long long ts_ms) const {
-    cmd_ll("HSET %s %b %lld", h_sizes_.c_str(), key.data(), (size_t)key.size(), size);
-    cmd_ll("INCRBY %s %lld", k_total_.c_str(), size);
-    cmd_ll("SADD %s %b", s_keys_.c_str(), key.data(), (size_t)key.size());
-    touch_lru(key, ts_ms);
+    const std::vector<std::string> KEYS{ h_meta_, k_total_, z_lru_, h_atime_, k_events_, k_audit_pass_ };
+    const std::vector<std::string> ARGV{ key, std::to_string(size), std::to_string(ts_ms),
+                                         lru_mode_ == LruMode::sampled ? "sampled" : "exact",
+                                         std::to_string(uses_hashed_names() ? meta_flag_key_header : 0),
+                                         std::to_string(events_maxlen_) };
+    scripts_->evalsha_ll("publish", 6, KEYS, ARGV);
+    if (touch_granularity_ms_ > 0) {
+        touch_sent_[key] = ts_ms;
+        touch_pending_.erase(key);
+    }
+}
+
+// 'event' is the type of the event logged if an entry is removed: "evict" or "drift_fix".
+long long RedisFileCache::index_remove_on_delete(const std::string& key, const char* event) {
+    const std::vector<std::string> KEYS{ h_meta_, k_total_, z_lru_, h_atime_, k_events_, k_audit_pass_ };
+    const std::vector<std::string> ARGV{ key, event, std::to_string(events_maxlen_) };
+    return scripts_->evalsha_ll("unindex", 6, KEYS, ARGV);
 }
 
-void RedisFileCache::index_remove_on_delete(const std::string& key, long long size) {
-    cmd_ll("HDEL %s %b", h_sizes_.c_str(), key.data(), (size_t)key.size());
-    cmd_ll("INCRBY %s %lld", k_total_.c_str(), -size);
-    cmd_ll("ZREM %s %b", z_lru_.c_str(), key.data(), (size_t)key.size());
-    cmd_ll("SREM %s %b", s_keys_.c_str(), key.data(), (size_t)key.size());
+/**
+ * Append an event, as field/value pairs, to the ns:events stream. Events
+ * written by the index scripts are atomic with the change they describe;
+ * these (the purge's start and stop) are best-effort and errors are ignored.
+ */
+void RedisFileCache::log_event(const std::vector<std::string>& fields) const noexcept {
+    if (events_maxlen_ <= 0) return;
+    try {
+        const std::string maxlen = std::to_string(events_maxlen_);
+        std::vector<const char*> av{"XADD", k_events_.c_str(), "MAXLEN", "~", maxlen.c_str(), "*"};
+        std::vector<size_t> ln{4, k_events_.size(), 6, 1, maxlen.size(), 1};
+        for (const auto& f : fields) { av.push_back(f.data()); ln.push_back(f.size()); }
+
+        ScopedLatency timer(metrics_->command("XADD"));
+        TraceSpan span(tracer_.get(), "XADD");
+        if (auto* r = static_cast<redisReply *>(redisCommandArgv(rc_.get(), (int)av.size(), av.data(), ln.data())))
+            freeReplyObject(r);
+    } catch (...) {}
+}
+
+/**
+ * Check the index schema version. A namespace with no version is new, unless
+ * it holds a version 1 index (idx:size and keys:set), which must be migrated
+ * first with 'RedisFileCacheLRU_Admin migrate-schema'. A new namespace in
+ * front of a cache directory that already has files means Redis lost its
+ * data; the one process that starts the index sees index_created() and
+ * should call reconcile().
+ */
+void RedisFileCache::check_index_schema() {
+    const std::string want = std::to_string(index_schema_version);
+    const std::string have = cmd_s("GET %s", k_schema_.c_str());
+    if (have.empty()) {
+        if (cmd_ll("EXISTS %s:idx:size", ns_.c_str()) == 1)
+            throw std::runtime_error("Namespace " + ns_ + " has a version 1 index; run 'RedisFileCacheLRU_Admin migrate-schema'");
+        index_created_ = cmd_s("SET %s %s NX", k_schema_.c_str(), want.c_str()) == "OK";
+    }
+    else if (have != want) {
+        throw std::runtime_error("Namespace " + ns_ + " has index schema version " + have + "; this code uses " + want);
+    }
 }
 
 long long RedisFileCache::get_total_bytes() const {
@@ -132,13 +556,18 @@ RedisFileCache::RedisFileCache(std::string cache_dir,
 : cache_dir_(std::move(cache_dir)),
   ns_(std::move(ns)),
   ttl_ms_(lock_ttl_ms),
+  base_ttl_ms_(lock_ttl_ms),
+  redis_host_(redis_host),
+  redis_port_(redis_port),
+  redis_db_(redis_db),
   max_bytes_(max_bytes),
-  rc_(nullptr, rc_deleter)
+  rc_(nullptr, rc_deleter),
+  metrics_(new CacheMetrics)
 {
     ensure_dir(cache_dir_);
 
     // connect
-    redisContext* c = redisConnect(redis_host.c_str(), redis_port);
+    redisContext* c = redis_connect(redis_host, redis_port);
     if (!c || c->err) {
         const std::string msg = c ? c->errstr : "redisConnect failed";
         if (c) redisFree(c);
@@ -153,21 +582,112 @@ RedisFileCache::RedisFileCache(std::string cache_dir,
         }
     }
 
+    if (lru_clock_ == LruClock::redis) sync_lru_clock();
+
     // load scripts
     scripts_ = std::make_unique<ScriptManager>(rc_.get());
+    scripts_->set_metrics(metrics_.get());
 
     scripts_->register_and_load("read_acq",  LUA_READ_LOCK_ACQUIRE);
     scripts_->register_and_load("read_rel",  LUA_READ_LOCK_RELEASE);
     scripts_->register_and_load("write_acq", LUA_WRITE_LOCK_ACQUIRE);
     scripts_->register_and_load("write_rel", LUA_WRITE_LOCK_RELEASE);
     scripts_->register_and_load("can_evict", LUA_CAN_EVICT);
+    scripts_->register_and_load("read_validate", LUA_READ_VALIDATE);
+    scripts_->register_and_load("publish", LUA_PUBLISH);
+    scripts_->register_and_load("unindex", LUA_UNINDEX);
+    scripts_->register_and_load("touch_atime", LUA_TOUCH_ATIME);
+    scripts_->register_and_load("audit_fix", LUA_AUDIT_FIX);
+    scripts_->register_and_load("audit_drop", LUA_AUDIT_DROP);
+    scripts_->register_and_load("audit_begin", LUA_AUDIT_BEGIN);
+    scripts_->register_and_load("audit_add", LUA_AUDIT_ADD);
+    scripts_->register_and_load("audit_end", LUA_AUDIT_END);
+
+    check_index_schema();
+}
+
+RedisFileCache::~RedisFileCache() {
+    try { flush_lru_touches(); } catch (...) {}
+}
+
+/**
+ * Acquire locks with a short TTL and have a background thread (with its own
+ * Redis connection) extend them every lease_ttl_ms/3 while the read or write
+ * that holds them is in progress. A crashed process's locks then clear in
+ * lease_ttl_ms instead of the constructor's lock TTL, while multi-GB writes
+ * keep their lock as long as they are alive. If a write's lease is lost
+ * anyway, the write is abandoned before the rename that would publish it.
+ *
+ * @param lease_ttl_ms TTL of locks acquired from now on
+ */
+void RedisFileCache::enable_lease_heartbeat(long long lease_ttl_ms) {
+    if (lease_ttl_ms <= 0) return;
+    keeper_ = std::make_unique<LeaseKeeper>(redis_host_, redis_port_, redis_db_, lease_ttl_ms);
+    ttl_ms_ = lease_ttl_ms;
+}
+
+/**
+ * Share reader leases among all the processes on this host that use the same
+ * namespace and Redis server. See LocalLeaseTable. Writers and the evictor
+ * are unaffected: they still see (at least) one lease while any local reader
+ * is active.
+ */
+void RedisFileCache::set_local_lease_sharing(bool on) {
+    if (!on) { local_leases_.reset(); return; }
+    if (!local_leases_)
+        local_leases_ = std::make_shared<LocalLeaseTable>(LocalLeaseTable::name_for(ns_, redis_host_, redis_port_, redis_db_));
+}
+
+/**
+ * Cache the state of each key's write lock and eviction fence locally using
+ * RESP3 client-side caching (see LockStateCache). In ReadMode::optimistic and
+ * ReadMode::open_fd, a read of a key that has neither then skips the Redis
+ * round trip after the first read. Entries are create-only and published by
+ * rename(), so such a read sees either the whole file or no file.
+ *
+ * This gives up the reader-lease guarantee for those reads: the evictor does
+ * not see them and may unlink a file while one is being read. That is safe on
+ * a local POSIX filesystem, where the open descriptor keeps the data, but on
+ * NFS the read may fail with ESTALE. An optimistic read checks the cached
+ * state again afterwards and falls back to its usual validated read if a
+ * fence appeared. ReadMode::locked reads, which exist to prevent exactly this,
+ * always take the reader lease, so tracking does not change them.
+ *
+ * @throws std::runtime_error if the Redis server or hiredis lacks RESP3.
+ */
+void RedisFileCache::set_lock_state_tracking(bool on) {
+    if (!on) { lock_state_.reset(); return; }
+    if (!lock_state_)
+        lock_state_ = std::make_unique<LockStateCache>(redis_host_, redis_port_, redis_db_);
+}
+
+void RedisFileCache::disable_lease_heartbeat() {
+    keeper_.reset();
+    ttl_ms_ = base_ttl_ms_;
+}
+
+void RedisFileCache::set_trace_file(const std::string& path) {
+    scripts_->set_tracer(nullptr);
+    tracer_.reset();    // completes the previous file
+    if (path.empty()) return;
+    tracer_ = std::make_unique<TraceWriter>(path);
+    scripts_->set_tracer(tracer_.get());
 }
 
 // ------- hiredis helpers -------
+// The helpers count and time each command by name (see CacheMetrics::command()).
 long long RedisFileCache::cmd_ll(const char* fmt, ...) const {
-    va_list ap; va_start(ap, fmt);
-    const auto r = static_cast<redisReply *>(redisvCommand(rc_.get(), fmt, ap));
-    va_end(ap);
+    const std::string cmd = command_name(fmt);
+    auto& calls = metrics_->command(cmd);
+    redisReply* r;
+    {
+        ScopedLatency timer(calls);
+        TraceSpan span(tracer_.get(), cmd.c_str());
+        va_list ap; va_start(ap, fmt);
+        r = static_cast<redisReply *>(redisvCommand(rc_.get(), fmt, ap));
+        va_end(ap);
+    }
+    if (!r || r->type == REDIS_REPLY_ERROR) calls.errors.fetch_add(1, std::memory_order_relaxed);
     if (!r) throw std::runtime_error("Redis command failed (NULL reply)");
     std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
     if (r->type == REDIS_REPLY_INTEGER) return r->integer;
@@ -183,10 +703,38 @@ long long RedisFileCache::cmd_ll(const char* fmt, ...) const {
     throw std::runtime_error("Unexpected reply type (int expected)");
 }
 
+// Like cmd_ll(), for a command built as a list of arguments (e.g., a variadic ZADD).
+long long RedisFileCache::cmd_argv(const std::vector<std::string>& args) const {
+    auto& calls = metrics_->command(args.at(0));
+    std::vector<const char*> av; av.reserve(args.size());
+    std::vector<size_t> ln; ln.reserve(args.size());
+    for (const auto& a : args) { av.push_back(a.data()); ln.push_back(a.size()); }
+    redisReply* r;
+    {
+        ScopedLatency timer(calls);
+        TraceSpan span(tracer_.get(), args[0].c_str());
+        r = static_cast<redisReply *>(redisCommandArgv(rc_.get(), (int)av.size(), av.data(), ln.data()));
+    }
+    if (!r || r->type == REDIS_REPLY_ERROR) calls.errors.fetch_add(1, std::memory_order_relaxed);
+    if (!r) throw std::runtime_error("Redis command failed (NULL reply)");
+    std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+    if (r->type == REDIS_REPLY_ERROR) throw std::runtime_error("Redis error: " + std::string(r->str, r->len));
+    if (r->type == REDIS_REPLY_INTEGER) return r->integer;
+    return 0;
+}
+
 std::string RedisFileCache::cmd_s(const char* fmt, ...) const {
-    va_list ap; va_start(ap, fmt);
-    const auto r = static_cast<redisReply *>(redisvCommand(rc_.get(), fmt, ap));
-    va_end(ap);
+    const std::string cmd = command_name(fmt);
+    auto& calls = metrics_->command(cmd);
+    redisReply* r;
+    {
+        ScopedLatency timer(calls);
+        TraceSpan span(tracer_.get(), cmd.c_str());
+        va_list ap; va_start(ap, fmt);
+        r = static_cast<redisReply *>(redisvCommand(rc_.get(), fmt, ap));
+        va_end(ap);
+    }
+    if (!r || r->type == REDIS_REPLY_ERROR) calls.errors.fetch_add(1, std::memory_order_relaxed);
     if (!r) throw std::runtime_error("Redis command failed (NULL reply)");
     std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
     if (r->type == REDIS_REPLY_STRING || r->type == REDIS_REPLY_STATUS) {
@@ -197,42 +745,100 @@ std::string RedisFileCache::cmd_s(const char* fmt, ...) const {
 }
 
 // ------- locking -------
-// read acquire
-void RedisFileCache::acquire_read(const std::string& key) const {
+// random token identifying one lock holder (a writer or a single reader lease)
+std::string RedisFileCache::make_token() {
+    std::random_device rd; std::mt19937_64 g(rd());
+    uint64_t a=g(), b=g();
+    std::ostringstream oss;
+    oss<<std::hex<<std::setw(16)<<std::setfill('0')<<a
+       <<std::setw(16)<<std::setfill('0')<<b;
+    return oss.str();
+}
+
+/**
+ * Acquire a reader lease on 'key'. With node-local lease sharing, a live
+ * lease already held by another reader on this host is joined without a
+ * Redis round trip; otherwise a new lease is taken from Redis and offered
+ * to the other local readers. With the heartbeat, a shared reader renews
+ * its slot's current lease, which may be a newer one its readers moved to,
+ * and each renewal moves the expiry forward in the table, so a lease kept
+ * alive past its TTL is still joined rather than replaced.
+ */
+RedisFileCache::ReadLease RedisFileCache::acquire_read(const std::string& key) const {
+    ScopedLatency timer(metrics_->op(CacheMetrics::read_lock));
+    TraceSpan span(tracer_.get(), "acquire_read");
+    ReadLease lease;
+    const long long now = steady_ms();
+    auto hold = [this, &key, &lease]() {
+        if (!keeper_) return;
+        LeaseKeeper::SharedRead shared;
+        if (lease.local.shared) {
+            std::shared_ptr<LocalLeaseTable> table = local_leases_;
+            const LocalLeaseTable::Handle h = lease.local;
+            shared.token = [table, h]() { return table->current_token(h); };
+            shared.renewed = [table, h](const std::string& token, long long expires_ms) { table->renew(token, h, expires_ms); };
+        }
+        keeper_->hold_read(k_readers(key), lease.token, std::move(shared));
+    };
+    if (local_leases_ && local_leases_->join(key, now, ttl_ms_ / 2, lease.token, lease.local)) {
+        hold();
+        return lease;
+    }
+
+    lease.token = make_token();
     std::vector<std::string> KEYS{ k_write(key), k_readers(key) };
-    std::vector<std::string> ARGV{ std::to_string(ttl_ms_) };
+    std::vector<std::string> ARGV{ lease.token, std::to_string(ttl_ms_) };
     auto res = scripts_->evalsha_ll("read_acq", 2, KEYS, ARGV);
     if (res != 1) throw CacheBusyError("read lock blocked by writer");
+
+    if (local_leases_) {
+        std::string surplus;
+        local_leases_->attach(key, lease.token, now, now + ttl_ms_, ttl_ms_ / 2, lease.local, surplus);
+        if (!surplus.empty()) release_read_lease(key, surplus);
+    }
+    hold();
+    return lease;
 }
 
-void RedisFileCache::release_read(const std::string& key) const noexcept {
+// Remove one lease from the readers ZSET
+void RedisFileCache::release_read_lease(const std::string& key, const std::string& token) const noexcept {
     try {
         std::vector<std::string> KEYS{ k_readers(key) };
-        std::vector<std::string> ARGV;
+        std::vector<std::string> ARGV{ token };
         scripts_->evalsha_ll("read_rel", 1, KEYS, ARGV);
     } catch (...) {}
 }
 
-// write acquire
-std::string RedisFileCache::acquire_write(const std::string& key) const {
-    // random token
-    std::random_device rd; std::mt19937_64 g(rd());
-    uint64_t a=g(), b=g();
-    std::ostringstream oss;
-    oss<<std::hex<<std::setw(16)<<std::setfill('0')<<a
-       <<std::setw(16)<<std::setfill('0')<<b;
-    std::string token = oss.str();
+void RedisFileCache::release_read(const std::string& key, const ReadLease& lease) const noexcept {
+    try {
+        TraceSpan span(tracer_.get(), "release_read");
+        if (keeper_) keeper_->release(lease.token);
+        // A shared lease is released by the last local reader to leave
+        const std::string token = local_leases_ ? local_leases_->leave(lease.token, lease.local) : lease.token;
+        if (!token.empty()) release_read_lease(key, token);
+    } catch (...) {}
+}
 
-    std::vector<std::string> KEYS{ k_write(key), k_readers(key) };
+// write acquire; 'fence' is set to the lock's fencing token
+std::string RedisFileCache::acquire_write(const std::string& key, long long& fence) const {
+    ScopedLatency timer(metrics_->op(CacheMetrics::write_lock));
+    TraceSpan span(tracer_.get(), "acquire_write");
+    std::string token = make_token();
+
+    std::vector<std::string> KEYS{ k_write(key), k_readers(key), k_fence_ };
     std::vector<std::string> ARGV{ token, std::to_string(ttl_ms_) };
-    auto res = scripts_->evalsha_ll("write_acq", 2, KEYS, ARGV);
+    auto res = scripts_->evalsha_ll("write_acq", 3, KEYS, ARGV);
     if (res == 0)  throw CacheBusyError("writer lock held");
     if (res == -1) throw CacheBusyError("readers present");
+    fence = res;
+    if (keeper_) keeper_->hold_write(KEYS[0], token);
     return token;
 }
 
 void RedisFileCache::release_write(const std::string& key, const std::string& token) const noexcept {
     try {
+        TraceSpan span(tracer_.get(), "release_write");
+        if (keeper_) keeper_->release(token);
         std::vector<std::string> KEYS{ k_write(key) };
         std::vector<std::string> ARGV{ token };
         scripts_->evalsha_ll("write_rel", 1, KEYS, ARGV);
@@ -241,105 +847,271 @@ void RedisFileCache::release_write(const std::string& key, const std::string& to
 
 bool RedisFileCache::can_evict_now(const std::string& key) const {
     const std::vector<std::string> KEYS{ k_write(key), k_readers(key), k_evict_fence(key) };
-    const std::vector<std::string> ARGV{ "1500" };
+    const std::vector<std::string> ARGV{ "1500", read_mode_ == ReadMode::open_fd ? "1" : "0" };
     auto res = scripts_->evalsha_ll("can_evict", 3, KEYS, ARGV);
     return res == 1;
 }
 
+bool RedisFileCache::validate_read(const std::string& key, long long nbytes) const {
+    TraceSpan span(tracer_.get(), "validate_read");
+    const std::vector<std::string> KEYS{ k_evict_fence(key), h_meta_ };
+    const std::vector<std::string> ARGV{ key, std::to_string(nbytes) };
+    return scripts_->evalsha_ll("read_validate", 2, KEYS, ARGV) == 1;
+}
+
 // ------- public API -------
 bool RedisFileCache::exists(const std::string& key) const {
     validate_key(key);
-    return file_exists_(path_for(key));
+    return file_exists_(path_for(entry_name(key)));
 }
 
-std::string RedisFileCache::read_bytes(const std::string& key) const {
-    validate_key(key);
-    auto p = path_for(key);
-    acquire_read(key);
-    int fd = -1;
-    try {
+/**
+ * Read a whole file. A missing file is system_error(ENOENT, "FileNotFound").
+ * So is ESTALE: on NFS the file was removed on the server (evicted by
+ * another host) after it was looked up or while it was being read.
+ */
+std::string RedisFileCache::read_file(const std::string& p, TraceWriter* trace) {
+    int fd;
+    {
+        TraceSpan span(trace, "open");
         fd = ::open(p.c_str(), O_RDONLY);
-        if (fd < 0) {
-            int e = errno;
-            release_read(key);
-            if (e == ENOENT) throw std::system_error(e, std::generic_category(), "FileNotFound");
-            throw std::system_error(e, std::generic_category(), "open read");
-        }
-        std::string out;
-        const size_t CH=1<<16;
-        char buf[CH];
-        ssize_t n;
+    }
+    if (fd < 0) {
+        int e = errno;
+        if (e == ENOENT || e == ESTALE) throw std::system_error(ENOENT, std::generic_category(), "FileNotFound");
+        throw std::system_error(e, std::generic_category(), "open read");
+    }
+    std::string out;
+    const size_t CH=1<<16;
+    char buf[CH];
+    ssize_t n;
+    {
+        TraceSpan span(trace, "read_loop");
         while ((n = ::read(fd, buf, CH)) > 0) out.append(buf, buf+n);
-        if (n < 0) {
-            int e = errno;
-            ::close(fd); release_read(key);
-            throw std::system_error(e, std::generic_category(), "read");
+    }
+    if (n < 0) {
+        int e = errno;
+        ::close(fd);
+        if (e == ESTALE) throw std::system_error(ENOENT, std::generic_category(), "FileNotFound");
+        throw std::system_error(e, std::generic_category(), "read");
+    }
+    ::close(fd);
+    return out;
+}
+
+// Read the entry at 'p' and, with hashed names, check and strip its key header.
+std::string RedisFileCache::read_entry(const std::string& p, const std::string& key) const {
+    auto out = read_file(p, tracer_.get());
+    if (uses_hashed_names()) strip_key_header(out, key);
+    return out;
+}
+
+// Count and time every read by outcome: a hit, a miss (ENOENT) or busy (a writer holds the key).
+std::string RedisFileCache::read_bytes(const std::string& key) const {
+    CacheMetrics::OpContext ctx(CacheMetrics::read);
+    ScopedLatency timer(metrics_->op(CacheMetrics::read));
+    TraceSpan span(tracer_.get(), "read_bytes", key);
+    try {
+        auto out = read_bytes_(key);
+        metrics_->add(CacheMetrics::reads_ok);
+        metrics_->add(CacheMetrics::bytes_read, out.size());
+        return out;
+    }
+    catch (const CacheBusyError&) {
+        metrics_->add(CacheMetrics::read_busy);
+        span.arg("result", "busy");
+        throw;
+    }
+    catch (const std::system_error& e) {
+        if (e.code().value() == ENOENT) metrics_->add(CacheMetrics::read_misses);
+        span.arg("result", e.code().value() == ENOENT ? "miss" : e.what());
+        throw;
+    }
+}
+
+std::string RedisFileCache::read_bytes_(const std::string& key) const {
+    validate_key(key);
+    const std::string name = entry_name(key);    // the key's identity on disk
+    const std::string id = redis_id(name);       // ... and in Redis
+    auto p = path_for(name);
+
+    // With lock state tracking, a key with no writer and no eviction fence is read
+    // without talking to Redis, usually. Not in locked mode: the evictor cannot see
+    // such a read, and might unlink the file under it (ESTALE on NFS).
+    auto stable = [&]() {
+        TraceSpan span(tracer_.get(), "lock_state");
+        return lock_state_->absent(k_write(id), k_evict_fence(id));
+    };
+    if (lock_state_ && read_mode_ != ReadMode::locked && stable()) {
+        auto out = read_entry(p, key);
+        // An eviction fenced during the read shows up as an invalidation; the open fd needs no check
+        if (read_mode_ == ReadMode::open_fd || stable()) {
+            touch_lru(id, now_ms());
+            return out;
         }
-        ::close(fd); release_read(key);
-        touch_lru(key, now_ms());
+    }
+
+    // The open fd is the only protection needed; the evictor may unlink the file mid-read.
+    if (read_mode_ == ReadMode::open_fd) {
+        auto out = read_entry(p, key);
+        touch_lru(id, now_ms());
         return out;
+    }
+
+    // Read first, validate after. A missing file is a miss, as with a locked read. A file
+    // that keeps failing validation (e.g., it was just published and is not indexed yet)
+    // is read again under a lock.
+    if (read_mode_ == ReadMode::optimistic) {
+        for (int attempt = 0; attempt < optimistic_attempts_; ++attempt) {
+            auto out = read_entry(p, key);
+            if (validate_read(id, (long long)out.size())) {
+                touch_lru(id, now_ms());
+                return out;
+            }
+            ++optimistic_retries_;
+        }
+    }
+
+    const auto lease = acquire_read(id);
+    std::string out;
+    try {
+        out = read_entry(p, key);
     } catch (...) {
-        if (fd >= 0) ::close(fd);
-        release_read(key);
+        release_read(id, lease);   // exactly once; shared leases are reference counted
+        throw;
+    }
+    release_read(id, lease);
+    touch_lru(id, now_ms());
+    return out;
+}
+
+/**
+ * Create a new cache entry. Fails if the entry exists.
+ *
+ * @return The write lock's fencing token. Tokens increase with every write lock
+ * granted in the namespace, so a downstream consumer can reject work tagged
+ * with a token older than one it has already seen.
+ */
+long long RedisFileCache::write_bytes_create(const std::string& key, const std::string& data) {
+    CacheMetrics::OpContext ctx(CacheMetrics::write);
+    ScopedLatency timer(metrics_->op(CacheMetrics::write));
+    TraceSpan span(tracer_.get(), "write_bytes_create", key);
+    try {
+        const long long fence = write_bytes_create_(key, data);
+        metrics_->add(CacheMetrics::writes_ok);
+        metrics_->add(CacheMetrics::bytes_written, data.size());
+        return fence;
+    }
+    catch (const CacheBusyError&) {
+        metrics_->add(CacheMetrics::write_busy);
+        span.arg("result", "busy");
+        throw;
+    }
+    catch (const std::system_error& e) {
+        if (e.code().value() == EEXIST) metrics_->add(CacheMetrics::write_exists);
+        span.arg("result", e.code().value() == EEXIST ? "exists" : e.what());
         throw;
     }
 }
 
-void RedisFileCache::write_bytes_create(const std::string& key, const std::string& data) {
+long long RedisFileCache::write_bytes_create_(const std::string& key, const std::string& data) {
     validate_key(key);
-    auto p = path_for(key);
+    const std::string name = entry_name(key);    // the key's identity on disk
+    const std::string id = redis_id(name);       // ... and in Redis
+    auto p = path_for(name);
     if (file_exists_(p)) throw std::system_error(EEXIST, std::generic_category(), "exists");
 
-    const auto token = acquire_write(key); // throws cache busy
+    long long fence = 0;
+    const auto token = acquire_write(id, fence); // throws cache busy
 
-    // tmp file
+    // tmp file, in the entry's own directory so the rename stays within it
+    TraceSpan write_span(tracer_.get(), "write_tmp");
     char tmpl[4096];
-    std::snprintf(tmpl, sizeof(tmpl), "%s/.%s.XXXXXX", cache_dir_.c_str(), key.c_str());
-    const int tfd = ::mkstemp(tmpl);
+    std::snprintf(tmpl, sizeof(tmpl), "%s/.%s.XXXXXX", dir_for(name).c_str(), name.c_str());
+    int tfd = ::mkstemp(tmpl);
+    if (tfd < 0 && errno == ENOENT && fanout_levels_ > 0) {
+        try { ensure_dir_for(name); }
+        catch (...) { release_write(id, token); throw; }
+        std::snprintf(tmpl, sizeof(tmpl), "%s/.%s.XXXXXX", dir_for(name).c_str(), name.c_str());
+        tfd = ::mkstemp(tmpl);
+    }
     if (tfd < 0) {
-        int e = errno; release_write(key, token);
+        int e = errno; release_write(id, token);
         throw std::system_error(e, std::generic_category(), "mkstemp");
     }
 
-    // write data
-    auto left = (ssize_t)data.size();
-    const char* ptr = data.data();
-    ssize_t wrote = 0;
-    while (left > 0) {
-        const ssize_t n = ::write(tfd, ptr + wrote, left);
-        if (n < 0) {
-            const int e = errno; ::close(tfd); ::unlink(tmpl); release_write(key, token);
-            throw std::system_error(e, std::generic_category(), "write");
+    // write data; with hashed names, the key header goes first
+    auto write_all = [&](const std::string& buf) {
+        auto left = (ssize_t)buf.size();
+        const char* ptr = buf.data();
+        ssize_t wrote = 0;
+        while (left > 0) {
+            const ssize_t n = ::write(tfd, ptr + wrote, left);
+            if (n < 0) {
+                const int e = errno; ::close(tfd); ::unlink(tmpl); release_write(id, token);
+                throw std::system_error(e, std::generic_category(), "write");
+            }
+            wrote += n; left -= n;
         }
-        wrote += n; left -= n;
+    };
+    if (uses_hashed_names()) write_all(key_header(key));
+    write_all(data);
+    write_span.end();
+    try {
+        ScopedLatency t(metrics_->op(CacheMetrics::fsync));
+        TraceSpan span(tracer_.get(), "fsync");
+        fsync_fd(tfd);  // throws system_error on error.
     }
-    try { fsync_fd(tfd); } // throws system_error on error.
     catch (...) {
-        ::close(tfd); ::unlink(tmpl); release_write(key, token); throw;
+        ::close(tfd); ::unlink(tmpl); release_write(id, token); throw;
     }
     ::close(tfd);
 
     // final create-only check
     if (file_exists_(p)) {
-        ::unlink(tmpl); release_write(key, token);
+        ::unlink(tmpl); release_write(id, token);
         throw std::system_error(EEXIST, std::generic_category(), "concurrent create");
     }
 
-    if (::rename(tmpl, p.c_str()) != 0) {
-        int e = errno; ::unlink(tmpl); release_write(key, token);
+    // A lost lease means another writer may own the key now; do not publish.
+    if (keeper_ && keeper_->lost(token)) {
+        ::unlink(tmpl); release_write(id, token);
+        throw CacheBusyError("write lease lost");
+    }
+
+    int renamed;
+    {
+        ScopedLatency t(metrics_->op(CacheMetrics::rename));
+        TraceSpan span(tracer_.get(), "rename");
+        renamed = ::rename(tmpl, p.c_str());
+    }
+    if (renamed != 0) {
+        int e = errno; ::unlink(tmpl); release_write(id, token);
         throw std::system_error(e, std::generic_category(), "rename");
     }
 
-    release_write(key, token);
+    release_write(id, token);
 
     // record size + touch LRU + enforce capacity
     const auto sz = (long long)data.size();
     const long long ts = now_ms();
-    index_add_on_publish(key, sz, ts);
+    {
+        TraceSpan span(tracer_.get(), "index_publish");
+        index_add_on_publish(id, sz, ts);
+    }
+
+    if (touch_granularity_ms_ > 0 && ts - touch_last_flush_ms_ >= touch_flush_ms_) {
+        flush_lru_touches();
+    }
 
     if (max_bytes_ > 0) {
         ensure_capacity(); // purge loop
     }
+
+    maybe_sweep();
+    maybe_audit();
+
+    return fence;
 }
 
 /**
@@ -351,95 +1123,156 @@ void RedisFileCache::write_bytes_create(const std::string& key, const std::strin
  */
 void RedisFileCache::ensure_capacity() {
     if (max_bytes_ <= 0) return;
+    TraceSpan span(tracer_.get(), "ensure_capacity");
 
     if (get_total_bytes() < max_bytes_) return;
 
+    // Pending touches from this process should count before choosing victims
+    flush_lru_touches();
+
     // best-effort single purger: SET NX PX 2s (default, configurable)
     // if this fails, another process is purging; return
     auto ok = cmd_s("SET %s 1 NX PX %d", k_purge_mtx_.c_str(), purge_mtx_ttl_ms_);
     if (ok != "OK") return;
 
+    const auto purge_level = max_bytes_ - (long long)(max_bytes_ * purge_factor_);
+    log_event({"type", "purge_start", "total", std::to_string(get_total_bytes()), "target", std::to_string(purge_level)});
+    long long evicted = 0, freed_total = 0;
     try {
-        const auto purge_level = max_bytes_ - (long long)(max_bytes_ * purge_factor_);
         while (get_total_bytes() > purge_level) {
             std::string victim;
             long long freed = 0;
             if (!try_evict_one(victim, freed)) break;
+            ++evicted;
+            freed_total += freed;
             // ensure the purge mutex remains if this loop take longer than purge_mtx_ttl_ms_
             // to reduce the chance that the mutex auto-expires before the purge is complete.
             // NB: 'XX' means set only if the key exists. jhrg 10/4/25
             ok = cmd_s("SET %s 1 XX PX %d", k_purge_mtx_.c_str(), purge_mtx_ttl_ms_);
-            if (ok != "OK") return; // exit if the mutex TTL cannot be updated
+            if (ok != "OK") break; // exit if the mutex TTL cannot be updated
         }
     } catch (...) {
         // swallow; purger is best-effort
     }
+    log_event({"type", "purge_stop", "evicted", std::to_string(evicted), "freed", std::to_string(freed_total)});
     // mutex auto-expires, but if this is called more frequently than purge_mtx_ttl_ms_
     // those calls won't try to purge. jhrg 10/4/25
 }
 
+/**
+ * Choose the next eviction victim.
+ *
+ * In LruMode::exact this is the lowest-scored member of the LRU ZSET. In
+ * LruMode::sampled, HRANDFIELD pulls lru_samples_ random keys (with their
+ * last access times) from the atime hash and the oldest of those is chosen.
+ * Larger samples approach true LRU at the cost of a bigger reply.
+ *
+ * @param key Value-result parameter; the victim's key
+ * @return true if a victim was found, false if the index is empty
+ */
+bool RedisFileCache::pick_victim(std::string& key) const {
+    if (lru_mode_ == LruMode::sampled) {
+        redisReply* r;
+        {
+            ScopedLatency timer(metrics_->command("HRANDFIELD"));
+            TraceSpan span(tracer_.get(), "HRANDFIELD");
+            r = static_cast<redisReply *>(redisCommand(rc_.get(), "HRANDFIELD %s %d WITHVALUES",
+                h_atime_.c_str(), lru_samples_));
+        }
+        if (!r) return false;
+        std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+        if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) return false;
+
+        long long oldest = 0;
+        bool found = false;
+        for (size_t i = 0; i + 1 < r->elements; i += 2) {
+            const auto* f = r->element[i];
+            const auto* v = r->element[i+1];
+            if (f->type != REDIS_REPLY_STRING || v->type != REDIS_REPLY_STRING) continue;
+            long long ts = 0;
+            try { ts = std::stoll(std::string(v->str, v->len)); } catch (...) { continue; }
+            if (!found || ts < oldest) {
+                key.assign(f->str, f->len);
+                oldest = ts;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Oldest (lowest score) by LRU
+    redisReply* r;
+    {
+        ScopedLatency timer(metrics_->command("ZRANGE"));
+        TraceSpan span(tracer_.get(), "ZRANGE");
+        r = static_cast<redisReply *>(redisCommand(rc_.get(), "ZRANGE %s 0 0 WITHSCORES", z_lru_.c_str()));
+    }
+    if (!r) return false;
+    std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+
+    if (r->type != REDIS_REPLY_ARRAY || r->elements < 1) return false;
+
+    key.assign(r->element[0]->str, r->element[0]->len);
+    return true;
+}
+
 /**
  * Try to evict one file from the cache. This method chooses the victim based
  * on the LRU data stored in the Redis server. If successful, it will return
  * the name and size of the 'victim' using the two value-result parameters.
  *
- * @note To see recent evictions, use the redis cli and:
- *      LRANGE poc-cache:evict:log 0 10
- * jhrg 10/2/25
+ * @note To see recent evictions (and the other index events), use the redis cli and:
+ *      XREVRANGE poc-cache:events + - COUNT 10
  *
  * @param victim Name of the file removed
  * @param freed number of bytes removed from teh cache
  * @return true if a file was removed, false otherwise.
  */
 bool RedisFileCache::try_evict_one(std::string& victim, long long& freed) {
+    CacheMetrics::OpContext ctx(CacheMetrics::evict);
+    ScopedLatency timer(metrics_->op(CacheMetrics::evict));
+    TraceSpan span(tracer_.get(), "try_evict_one");
     victim.clear(); freed = 0;
 
-    // Oldest (lowest score) by LRU
-    const auto r = static_cast<redisReply *>(redisCommand(rc_.get(), "ZRANGE %s 0 0 WITHSCORES", z_lru_.c_str()));
-    if (!r) return false;
-    std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
-
-    if (r->type != REDIS_REPLY_ARRAY || r->elements < 1) return false;
-
-    // This is the key of the file to be removed (i.e., with the lowest LRU score)
-    const std::string key(r->element[0]->str, r->element[0]->len);
+    // This is the key of the file to be removed (i.e., the least recently used one)
+    std::string key;
+    if (!pick_victim(key)) return false;
 
-    // size lookup; see 'sz' below
-    const auto rs = static_cast<redisReply *>(redisCommand(rc_.get(), "HGET %s %b", h_sizes_.c_str(),
-        key.data(), (size_t) key.size()));
-    if (!rs) return false;
-    std::unique_ptr<redisReply, void(*)(void*)> guards(rs, freeReplyObject);
-
-    if (rs->type == REDIS_REPLY_NIL) {
-        // index drift; clean LRU entry and continue
-        cmd_ll("ZREM %s %b", z_lru_.c_str(), key.data(), (size_t)key.size());
-        cmd_ll("SREM %s %b", s_keys_.c_str(), key.data(), (size_t)key.size());
+    // Not indexed (index drift)? Drop its LRU entry and let the caller pick again.
+    if (cmd_ll("HEXISTS %s %b", h_meta_.c_str(), key.data(), (size_t)key.size()) == 0) {
+        index_remove_on_delete(key);
         return false;
     }
-    // This is the size of the file to remove.
-    const auto sz = std::stoll(std::string(rs->str, rs->len));
 
     // Fence & verify evictable (no readers/writers)
     if (!can_evict_now(key)) {
         // Nudge LRU to avoid hammering
-        touch_lru(key, now_ms());
+        touch_lru_now(key, now_ms());
         return false;
     }
 
-    // Remove from FS
-    const auto p = path_for(key);
-    if (::unlink(p.c_str()) != 0) {
+    // Remove from FS. On NFS, if this client still has the file open, the client renames it
+    // to '.nfsXXXX' and removes it on last close. Keys never start with '.', so such files
+    // are never mistaken for entries.
+    const auto p = path_for(name_for_id(key));
+    int unlinked;
+    {
+        TraceSpan unlink_span(tracer_.get(), "unlink");
+        unlinked = ::unlink(p.c_str());
+    }
+    if (unlinked != 0) {
         // file already gone? clean indexes
-        index_remove_on_delete(key, sz);
+        index_remove_on_delete(key);
         return false;
     }
 
-    // Clean indexes
-    index_remove_on_delete(key, sz);
+    // Clean indexes and log the eviction; -1 means another evictor unindexed it first
+    const long long sz = index_remove_on_delete(key, "evict");
+    span.arg("victim", name_for_id(key));   // hex, not the raw bytes of a binary id
     victim = key;
-    freed = sz;
-
-    cmd_ll("LPUSH %s:evict:log %b", ns_.c_str(), key.data(), (size_t)key.size());
+    freed = sz > 0 ? sz : 0;
+    metrics_->add(CacheMetrics::evictions);
+    metrics_->add(CacheMetrics::evicted_bytes, (uint64_t)freed);
 
     return true;
 }
@@ -493,6 +1326,7 @@ bool RedisFileCache::read_bytes_blocking(const std::string& key,
             }
         }
         if (std::chrono::steady_clock::now() >= deadline) return false;
+        TraceSpan span(tracer_.get(), "backoff");
         std::this_thread::sleep_for(backoff);
     }
 }
@@ -530,6 +1364,7 @@ bool RedisFileCache::write_bytes_create_blocking(const std::string& key,
             throw; // other error
         }
         if (std::chrono::steady_clock::now() >= deadline) return false;
+        TraceSpan span(tracer_.get(), "backoff");
         std::this_thread::sleep_for(backoff);
     }
 }
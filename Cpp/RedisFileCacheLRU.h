@@ -9,11 +9,18 @@
 #include <stdexcept>
 #include <memory>
 #include <chrono>
+#include <unordered_map>
+#include <vector>
 
 #include "ScriptManager.h"
+#include "LocalLeaseTable.h"
 
 struct redisContext;
 struct redisReply;
+class LeaseKeeper;
+class LockStateCache;
+class CacheMetrics;
+class TraceWriter;
 
 /**
  * Exception thrown when a non-blocking read or write operation fails
@@ -25,6 +32,65 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+/**
+ * How recency is recorded for LRU eviction.
+ *
+ * exact: every access does a ZADD on a global sorted set and the purger
+ * evicts its lowest-scored member.
+ * sampled: every access writes one field of a hash (key -> last access ms);
+ * the purger samples a few random keys and evicts the oldest of those. This
+ * is the approximation Redis itself uses for maxmemory-policy allkeys-lru.
+ *
+ * @note All processes sharing a namespace must use the same mode.
+ */
+enum class LruMode { exact, sampled };
+
+/**
+ * Where LRU timestamps come from.
+ *
+ * steady: this host's std::chrono::steady_clock. Its epoch is the host's boot
+ * time, so scores written by different hosts are not comparable.
+ * redis: the Redis server's TIME, in ms since the Unix epoch. The offset
+ * between the local steady_clock and the server clock is measured at startup
+ * and refreshed periodically, so reading the clock costs no round trip.
+ */
+enum class LruClock { steady, redis };
+
+/**
+ * How read_bytes() protects a read from concurrent eviction.
+ *
+ * locked: take a reader lease in Redis before opening the file and release
+ * it after; eviction waits for the lease. Two round trips per read.
+ * optimistic: open and read the file with no lock, then check in one round
+ * trip that no eviction fence is set for the key and that the index still
+ * holds the key with the size that was read. If not, an eviction or publish
+ * raced the read and it is retried. Entries are create-only and published by
+ * rename(), so an indexed key's size identifies its content. Readers never
+ * block writers or the evictor.
+ * open_fd: no lock and no validation. The read works from an open file
+ * descriptor, which keeps an unlinked file's data readable on a local POSIX
+ * filesystem (and on NFS via the client's silly-rename). This process's
+ * evictions then ignore reader leases entirely.
+ *
+ * @note Do not mix open_fd with locked readers in one namespace: an open_fd
+ * process's evictions do not wait for their leases.
+ */
+enum class ReadMode { locked, optimistic, open_fd };
+
+/**
+ * How entries are identified in Redis (lock key suffixes and the members of
+ * every index structure).
+ *
+ * text: the key itself, or its hashed_name() with hashed names on.
+ * binary64, binary128: the raw 8 or 16 bytes of the key's MurmurHash3. The
+ * on-disk name is the same hash in hex, and files carry the key header
+ * used with hashed names, so any byte string is a valid key and a collision
+ * reads as a miss.
+ *
+ * @note All processes sharing a namespace must use the same encoding.
+ */
+enum class KeyEncoding { text, binary64, binary128 };
+
 /**
  * A disk file cache designed to be multiprocess and multi-host safe.
  * The cache uses a Redis server as a cache lock manager. The cache
@@ -44,12 +110,19 @@ public:
                    std::string ns = "poc-cache",
                    long long max_bytes = 0);
 
+    ~RedisFileCache();
+
+    /// Version of the Redis index layout. 1: idx:size + keys:set; 2: packed idx:meta.
+    static constexpr int index_schema_version = 2;
+    /// idx:meta flag: the file starts with a key header (hashed names).
+    static constexpr int meta_flag_key_header = 1;
+
     // Non-copyable
     RedisFileCache(const RedisFileCache&) = delete;
     RedisFileCache& operator=(const RedisFileCache&) = delete;
 
     std::string read_bytes(const std::string& key) const;
-    void write_bytes_create(const std::string& key, const std::string& data);
+    long long write_bytes_create(const std::string& key, const std::string& data);
     bool exists(const std::string& key) const;
 
 
@@ -65,11 +138,97 @@ public:
 
     const std::string& namespace_prefix() const { return ns_; }
 
+    /// The fixed-width name used on disk and in Redis for 'key' when hashed names are on.
+    static std::string hashed_name(const std::string& key);
+
+    /// The fan-out subdirectory of 'key' for a layout with 'levels' levels, e.g. "3f/a0"; "" if flat.
+    static std::string fanout_subdir(const std::string& key, int levels);
+
+    void set_local_lease_sharing(bool on);
+    bool local_lease_sharing() const { return local_leases_ != nullptr; }
+
+    void set_lock_state_tracking(bool on);
+    bool lock_state_tracking() const { return lock_state_ != nullptr; }
+    const LockStateCache* lock_state() const { return lock_state_.get(); }
+
+    void enable_lease_heartbeat(long long lease_ttl_ms = 5000);
+    void disable_lease_heartbeat();
+    bool lease_heartbeat_enabled() const { return keeper_ != nullptr; }
+
+    void flush_lru_touches() const;
+
+    /// This cache's counters and latency histograms; safe to read from another thread.
+    CacheMetrics& metrics() const { return *metrics_; }
+
+    /**
+     * Write a span for each phase of every read, write and eviction (lock
+     * acquisition, each Redis call, open, read loop, fsync, rename, backoff
+     * sleeps) to 'path' as Chrome trace-event JSON. An empty path stops
+     * tracing and completes the file. Throws std::system_error if the file
+     * cannot be created.
+     */
+    void set_trace_file(const std::string& path);
+    bool tracing() const { return tracer_ != nullptr; }
+
+    /// What reconcile() found and changed.
+    struct ReconcileStats {
+        long long files = 0;            /// Entries found on disk
+        long long added = 0;            /// ... of those, entries that were not indexed
+        long long bytes_added = 0;      /// Their sizes, added to the total
+        long long temp_removed = 0;     /// Orphaned temp files removed
+        long long stale_dropped = 0;    /// Index entries whose file was missing
+    };
+
+    ReconcileStats reconcile(int threads = 0, long long temp_grace_ms = 3600000);
+
+    /// What sweep_temp_files() found and removed.
+    struct SweepStats {
+        long long examined = 0;     /// Temp files seen
+        long long removed = 0;      /// ... of those, orphans removed
+        long long bytes = 0;        /// Space reclaimed
+    };
+
+    SweepStats sweep_temp_files(int subtree = -1);
+
+    /// What one audit_index() step checked and fixed.
+    struct AuditStats {
+        long long checked = 0;          /// Entries compared with their files
+        long long dropped = 0;          /// ... whose file was gone
+        long long size_fixed = 0;       /// ... whose indexed size was wrong
+        long long bytes_corrected = 0;  /// Net change those fixes made to the total
+        bool pass_complete = false;     /// This step finished a pass over the whole index
+        long long drift = 0;            /// At the end of a pass: total minus the sum of sizes, as of the pass's start
+        long long churn = 0;            /// ... and the bytes indexed and unindexed during it; a drift no larger is left
+    };
+
+    AuditStats audit_index(size_t count = 1000, int threads = 8);
+
+    /// What migrate_index_schema() converted.
+    struct SchemaMigrationStats {
+        std::string had_version;        /// The namespace's schema version if it had one; nothing was changed then
+        long long entries = 0;          /// Entries moved from idx:size to idx:meta
+        long long total_bytes = 0;      /// Their sizes: the new total
+    };
+
+    static SchemaMigrationStats migrate_index_schema(const std::string& redis_host, int redis_port, int redis_db,
+                                                     const std::string& ns, bool key_headers);
+
+    /// True if this process created the namespace's index (it was empty, e.g. Redis restarted).
+    bool index_created() const { return index_created_; }
+
 private:
     std::string cache_dir_; /// Where the files are stored
     std::string ns_;    /// Redis key Namespace
     long long ttl_ms_;  /// File lock max lifetime; prevent stale locks
+    long long base_ttl_ms_; /// ttl_ms_ as given to the constructor (used without the heartbeat)
+
+    std::string redis_host_;    /// Kept for helper connections (e.g., the lease heartbeat)
+    int redis_port_;
+    int redis_db_;
     long long max_bytes_ = 0; /// How big a cache? 0 == unbounded.
+    int fanout_levels_ = 0;     /// Levels of 256 hashed subdirectories under cache_dir_; 0 == flat
+    bool hashed_names_ = false; /// Store entries under hashed_name(key); keys may be any byte string
+    KeyEncoding key_encoding_ = KeyEncoding::text;  /// How entries are named in Redis
 
     // This controls how often the cache purge actually happens, regardless of how often
     // new files are added. Make this small for certain tests, etc. (see TestRedisFileCacheLRU.cpp)
@@ -77,43 +236,123 @@ private:
     long long purge_mtx_ttl_ms_ = 2000; /// Minimum purge frequency
     double purge_factor_ = 0.2; /// Purge below max_bytes_ by this factor; between 0.0 and 1.0
 
+    LruMode lru_mode_ = LruMode::exact; /// How access recency is tracked
+    int lru_samples_ = 5;   /// Keys sampled per eviction in LruMode::sampled
+
+    // LRU touch coalescing. When touch_granularity_ms_ > 0, reads record their access time
+    // locally and the pending touches are sent as one batched command. A key already sent
+    // within the granularity window is not sent again.
+    long long touch_granularity_ms_ = 0;   /// 0 == every read sends its own touch
+    long long touch_flush_ms_ = 1000;      /// Flush pending touches at least this often
+    size_t touch_batch_max_ = 256;         /// ... or when this many keys are pending
+    mutable std::unordered_map<std::string, long long> touch_pending_;  /// key -> access ms, not yet sent
+    mutable std::unordered_map<std::string, long long> touch_sent_;     /// key -> access ms last sent
+    mutable long long touch_last_flush_ms_ = 0;
+
+    ReadMode read_mode_ = ReadMode::locked;     /// How reads are protected from eviction
+    int optimistic_attempts_ = 3;               /// Optimistic tries before falling back to a locked read
+    mutable long long optimistic_retries_ = 0;  /// Optimistic reads that failed validation
+
+    bool index_created_ = false;    /// The constructor found no index and started one
+
+    long long sweep_interval_ms_ = 0;           /// Sweep for orphaned temp files this often; 0 == never
+    mutable long long sweep_next_ms_ = 0;       /// Local steady_clock ms before which this process does not try
+
+    long long audit_interval_ms_ = 0;           /// Run an index audit step this often; 0 == never
+    size_t audit_count_ = 1000;                 /// Entries per audit step
+    mutable long long audit_next_ms_ = 0;
+
+    long long events_maxlen_ = 100000;          /// Approximate cap on the ns:events stream; 0 == no events
+
+    LruClock lru_clock_ = LruClock::redis;      /// Source of LRU timestamps
+    long long clock_resync_ms_ = 60000;         /// How often to re-measure the Redis clock offset
+    long long clock_skew_ms_ = 0;               /// Added to the local clock; simulates host skew
+    mutable long long redis_clock_offset_ms_ = 0;   /// Redis TIME minus local steady_clock
+    mutable long long clock_synced_at_ms_ = 0;      /// Local steady_clock ms of the last sync
+
     std::unique_ptr<redisContext, void(*)(redisContext*)> rc_;  /// The Redis connection
     std::unique_ptr<ScriptManager> scripts_{nullptr};   /// Manages the LUA scripts
+    std::unique_ptr<LeaseKeeper> keeper_{nullptr};      /// Renews held locks; null == no heartbeat
+    std::shared_ptr<LocalLeaseTable> local_leases_{nullptr};   /// Node-wide reader lease sharing; may be null; keeper_'s callbacks hold it too
+    std::unique_ptr<LockStateCache> lock_state_{nullptr};      /// RESP3 tracked lock state; null == off
+    std::unique_ptr<CacheMetrics> metrics_;                     /// Always present; recording is a few atomic adds
+    std::unique_ptr<TraceWriter> tracer_{nullptr};              /// Span tracing; null == off
 
     // index keys
 
     std::string z_lru_ = ns_ + ":idx:lru";    // ZSET: key -> last access ms
-    std::string h_sizes_ = ns_ + ":idx:size";  // HASH: key -> size
-    std::string s_keys_ = ns_ + ":keys:set";   // SET: all keys (kept for tests / discovery)
+    std::string h_atime_ = ns_ + ":idx:atime"; // HASH: key -> last access ms (LruMode::sampled)
+    std::string h_meta_ = ns_ + ":idx:meta";  // HASH: key -> "size:created_ms:flags"
+    std::string k_schema_ = ns_ + ":idx:schema";   // STRING: index_schema_version
     std::string k_total_ = ns_ + ":idx:total";  // STRING: total bytes
     std::string k_purge_mtx_ = ns_ + ":purge:mutex"; // STRING: purger mutex
     std::string k_evict_fence_ = ns_ + ":lock:evict:";  // STRING: eviction fence prefix
+    std::string k_fence_ = ns_ + ":lock:fence";  // STRING: fencing token counter for writers
+    std::string k_sweep_mtx_ = ns_ + ":sweep:mutex";    // STRING: one temp file sweep per interval
+    std::string k_sweep_cursor_ = ns_ + ":sweep:cursor";  // STRING: next fan-out subtree to sweep
+    std::string k_stats_ = ns_ + ":stats";      // HASH: namespace-wide counters (e.g., temp_swept_bytes)
+    std::string k_audit_mtx_ = ns_ + ":audit:mutex";    // STRING: one audit step per interval
+    std::string k_audit_cursor_ = ns_ + ":audit:cursor";  // STRING: HSCAN cursor of the audit pass
+    std::string k_audit_pass_ = ns_ + ":audit:pass";      // HASH: the audit pass's epoch, base, sum and churn
+    std::string k_events_ = ns_ + ":events";    // STREAM: publish, evict, drift_fix, purge_start/stop events
 
     // hiredis helpers
     long long cmd_ll(const char* fmt, ...) const;
     std::string cmd_s(const char* fmt, ...) const;
+    long long cmd_argv(const std::vector<std::string>& args) const;
+
+    // A reader's lease: its token in the readers ZSET, and its slot if the lease is shared node-wide
+    struct ReadLease {
+        std::string token;
+        LocalLeaseTable::Handle local;
+    };
 
-    void acquire_read(const std::string& key) const;
-    void release_read(const std::string& key) const noexcept;
-    std::string acquire_write(const std::string& key) const;
+    static std::string make_token();
+    ReadLease acquire_read(const std::string& key) const;
+    void release_read(const std::string& key, const ReadLease& lease) const noexcept;
+    void release_read_lease(const std::string& key, const std::string& token) const noexcept;
+    std::string acquire_write(const std::string& key, long long& fence) const;
     void release_write(const std::string& key, const std::string& token) const noexcept;
     bool can_evict_now(const std::string& key) const;
+    bool validate_read(const std::string& key, long long nbytes) const;
+    std::string read_bytes_(const std::string& key) const;
+    long long write_bytes_create_(const std::string& key, const std::string& data);
 
     std::string k_evict_fence(const std::string& key) const { return k_evict_fence_ + key; };
 
-    static long long now_ms();
+    static long long steady_ms();
+    void sync_lru_clock() const;
+    long long now_ms() const;
     void touch_lru(const std::string& key, long long ts_ms) const;
+    void touch_lru_now(const std::string& key, long long ts_ms) const;
     void index_add_on_publish(const std::string& key, long long size, long long ts_ms) const;
-    void index_remove_on_delete(const std::string& key, long long size);
+    long long index_remove_on_delete(const std::string& key, const char* event = "drift_fix");
+    void log_event(const std::vector<std::string>& fields) const noexcept;
+    void check_index_schema();
     long long get_total_bytes() const;
     static long long file_size_bytes(const std::string& path) ;
+    static std::string read_file(const std::string& path, TraceWriter* trace = nullptr);
 
+    bool pick_victim(std::string& key) const;
     void ensure_capacity();                       // loop until total<=max
+    void maybe_sweep();                           // rate-limited sweep_temp_files()
+    void maybe_audit();                           // rate-limited audit_index()
     bool try_evict_one(std::string& victim, long long& freed);
 
     // file helpers
-    static void validate_key(const std::string& key);
+    void validate_key(const std::string& key) const;
+    std::string entry_name(const std::string& key) const;
+    std::string redis_id(const std::string& name) const;
+    std::string name_for_id(const std::string& id) const;
+    bool uses_hashed_names() const { return hashed_names_ || key_encoding_ != KeyEncoding::text; }
+    static std::string key_header(const std::string& key);
+    static void strip_key_header(std::string& content, const std::string& key);
+    static long long key_header_size(const char* buf, size_t n);
+    long long stat_entry(int dfd, const std::string& name, long long& mtime) const;
+    std::string read_entry(const std::string& path, const std::string& key) const;
     std::string path_for(const std::string& key) const;
+    std::string dir_for(const std::string& key) const;
+    void ensure_dir_for(const std::string& key) const;
     std::string k_write(const std::string& key) const;
     std::string k_readers(const std::string& key) const;
     static bool file_exists_(const std::string& p);
@@ -123,11 +362,87 @@ private:
 
 public:
     // setters/getters
+    /**
+     * With hashed names on, a key can be any non-empty byte string (e.g. a URL
+     * path with a constraint expression). Files, locks and index entries use
+     * its 32-character hashed_name() instead, and each file starts with a
+     * header holding the key so a hash collision reads as a miss. All
+     * processes sharing a namespace must agree.
+     */
+    bool get_hashed_names() const { return hashed_names_; }
+    void set_hashed_names(const bool on) { hashed_names_ = on; }
+
+    KeyEncoding get_key_encoding() const { return key_encoding_; }
+    void set_key_encoding(const KeyEncoding e) { key_encoding_ = e; }
+
+    int get_fanout_levels() const { return fanout_levels_; }
+    /// 0 (flat) to 3. All processes sharing a cache_dir must agree; see RedisFileCacheLRU_Admin migrate-fanout.
+    void set_fanout_levels(const int n) { if (n < 0 || n > 3) return; fanout_levels_ = n; }
+
+    long long get_temp_sweep_interval() const { return sweep_interval_ms_; }
+    /**
+     * Every 'ms', one writer in the namespace sweeps one fan-out subtree (the
+     * whole directory when flat) for temp files left by crashed writers; see
+     * sweep_temp_files(). 0 turns the sweep off.
+     */
+    void set_temp_sweep_interval(const long long ms) { if (ms < 0) return; sweep_interval_ms_ = ms; }
+
+    long long get_index_audit_interval() const { return audit_interval_ms_; }
+    /**
+     * Every 'ms', one writer in the namespace runs an audit_index() step of
+     * 'count' entries. 0 turns the audit off.
+     */
+    void set_index_audit_interval(const long long ms, const size_t count = 1000) {
+        if (ms < 0 || count < 1) return;
+        audit_interval_ms_ = ms;
+        audit_count_ = count;
+    }
+
+    long long get_event_stream_maxlen() const { return events_maxlen_; }
+    /**
+     * Keep about 'n' of the latest index events in the ns:events stream
+     * (XADD MAXLEN ~ n). 0 stops logging events; the stream is left as is.
+     */
+    void set_event_stream_maxlen(const long long n) { if (n < 0) return; events_maxlen_ = n; }
+
     long long get_purge_mtx_ttl() const { return purge_mtx_ttl_ms_; }
     void set_purge_mtx_ttl(const long long ttl) { purge_mtx_ttl_ms_ = ttl; }
 
     double get_purge_factor() const { return purge_factor_; }
     void set_purge_factor(const double pf) { if (pf < 0.0 || pf > 1.0) return; purge_factor_ = pf; }
+
+    LruMode get_lru_mode() const { return lru_mode_; }
+    void set_lru_mode(const LruMode m) { lru_mode_ = m; }
+
+    int get_lru_samples() const { return lru_samples_; }
+    void set_lru_samples(const int n) { if (n < 1) return; lru_samples_ = n; }
+
+    ReadMode get_read_mode() const { return read_mode_; }
+    void set_read_mode(const ReadMode m) { read_mode_ = m; }
+
+    int get_optimistic_attempts() const { return optimistic_attempts_; }
+    void set_optimistic_attempts(const int n) { if (n < 1) return; optimistic_attempts_ = n; }
+    long long get_optimistic_retries() const { return optimistic_retries_; }
+
+    long long get_touch_granularity_ms() const { return touch_granularity_ms_; }
+    LruClock get_lru_clock() const { return lru_clock_; }
+    void set_lru_clock(const LruClock c) { lru_clock_ = c; if (c == LruClock::redis) sync_lru_clock(); }
+
+    /// For simulations/tests: pretend this host's clock is off by 'skew_ms'.
+    long long get_clock_skew_ms() const { return clock_skew_ms_; }
+    void set_clock_skew_ms(const long long skew_ms) {
+        clock_skew_ms_ = skew_ms;
+        if (lru_clock_ == LruClock::redis) sync_lru_clock();
+    }
+
+    void set_touch_coalescing(const long long granularity_ms, const long long flush_ms = 1000,
+                              const size_t batch_max = 256) {
+        if (granularity_ms < 0 || flush_ms < 0 || batch_max < 1) return;
+        flush_lru_touches();
+        touch_granularity_ms_ = granularity_ms;
+        touch_flush_ms_ = flush_ms;
+        touch_batch_max_ = batch_max;
+    }
 };
 
 #endif //POC_REDIS_CACHE_REDIS_POC_CACHE_HIREDIS_H
\ No newline at end of file
@@ -0,0 +1,250 @@
+//
+// Maintenance commands for a RedisFileCache directory and its Redis state.
+//
+// Usage: RedisFileCacheLRU_Admin <command> [options]
+//
+//   migrate-fanout --cache-dir <path> --levels <n> [--dry-run]
+//       Move every entry to its place in an n-level fan-out layout (0 == flat).
+//       Works from any existing layout. Stop the cache's writers first; readers
+//       only see misses for entries that have not been moved yet.
+//
+//   migrate-schema [--hashed-names] [--key-encoding <text|binary64|binary128>]
+//                  [--redis-host <h>] [--redis-port <p>] [--redis-db <n>] [--namespace <ns>]
+//       Convert a version 1 index (idx:size + keys:set) to the current packed
+//       idx:meta layout. Stop every cache process using the namespace first.
+//       The naming options must match the cache's writers.
+//
+//   reconcile --cache-dir <path> [--levels <n>] [--hashed-names] [--key-encoding <text|binary64|binary128>]
+//             [--lru-mode <exact|sampled>] [--threads <n>] [--temp-grace-ms <ms>] [redis options]
+//       Rebuild the index from the cache directory: index files Redis does not
+//       know about (e.g. after a Redis restart), remove orphaned temp files and
+//       drop entries whose files are gone. Safe while the cache is in use. The
+//       layout options must match the cache's writers.
+//
+//   audit --cache-dir <path> [--count <n>] [--threads <n>] [layout and redis options as for reconcile]
+//       Run one full audit pass over the index: fix entries whose file is gone
+//       or whose size is wrong, and correct the total by the drift found over
+//       the pass. Prints the drift and the bytes published or removed meanwhile.
+//
+
+#include "RedisFileCacheLRU.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Entry {
+    std::string path;   // where it is now
+    std::string name;   // the key
+};
+
+// Collect the entries under 'dir' up to 'depth' levels of subdirectories down. Names
+// starting with '.' are temp files and NFS silly-renames, never entries.
+void collect(const std::string& dir, int depth, std::vector<Entry>& out, std::vector<std::string>& dirs) {
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) {
+        std::cerr << "Cannot open " << dir << ": " << std::strerror(errno) << "\n";
+        return;
+    }
+    while (const dirent* de = ::readdir(d)) {
+        if (de->d_name[0] == '.') continue;
+        const std::string p = dir + "/" + de->d_name;
+        struct stat st{};
+        if (::lstat(p.c_str(), &st) != 0) continue;
+        if (S_ISREG(st.st_mode)) out.push_back({p, de->d_name});
+        else if (S_ISDIR(st.st_mode) && depth > 0) {
+            collect(p, depth - 1, out, dirs);
+            dirs.push_back(p);
+        }
+    }
+    ::closedir(d);
+}
+
+bool make_dirs(const std::string& root, const std::string& sub) {
+    std::string d = root;
+    for (size_t pos = 0; pos < sub.size(); pos += 3) {
+        d += "/" + sub.substr(pos, 2);
+        if (::mkdir(d.c_str(), 0777) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+int migrate_fanout(const std::string& cache_dir, int levels, bool dry_run) {
+    if (levels < 0 || levels > 3) {
+        std::cerr << "--levels must be between 0 and 3\n";
+        return 2;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<std::string> dirs;     // deepest first
+    collect(cache_dir, 3, entries, dirs);
+
+    long long moved = 0, in_place = 0, failed = 0;
+    for (const auto& e : entries) {
+        const std::string sub = RedisFileCache::fanout_subdir(e.name, levels);
+        const std::string target = cache_dir + (sub.empty() ? "" : "/" + sub) + "/" + e.name;
+        if (target == e.path) { ++in_place; continue; }
+        if (dry_run) {
+            std::cout << e.path << " -> " << target << "\n";
+            ++moved;
+            continue;
+        }
+        struct stat st{};
+        if (::stat(target.c_str(), &st) == 0) {
+            // Written under the new layout already; the old copy is redundant
+            ::unlink(e.path.c_str());
+            ++moved;
+            continue;
+        }
+        if (!make_dirs(cache_dir, sub) || ::rename(e.path.c_str(), target.c_str()) != 0) {
+            std::cerr << "Cannot move " << e.path << ": " << std::strerror(errno) << "\n";
+            ++failed;
+            continue;
+        }
+        ++moved;
+    }
+
+    // Drop directories the new layout no longer uses; rmdir() leaves non-empty ones alone.
+    if (!dry_run)
+        for (const auto& d : dirs) ::rmdir(d.c_str());
+
+    std::cout << "entries=" << entries.size() << " moved=" << moved << " in_place=" << in_place
+              << " failed=" << failed << (dry_run ? " (dry run)" : "") << "\n";
+    return failed == 0 ? 0 : 1;
+}
+
+int migrate_schema(const std::string& host, int port, int db, const std::string& ns, bool key_headers) {
+    const auto st = RedisFileCache::migrate_index_schema(host, port, db, ns, key_headers);
+    const std::string want = std::to_string(RedisFileCache::index_schema_version);
+    if (!st.had_version.empty()) {
+        std::cout << "Namespace " << ns << " already has schema version " << st.had_version << "\n";
+        return st.had_version == want ? 0 : 1;
+    }
+    std::cout << "entries=" << st.entries << " total_bytes=" << st.total_bytes << " schema=" << want << "\n";
+    return 0;
+}
+
+int reconcile(RedisFileCache& cache, int threads, long long temp_grace_ms) {
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto st = cache.reconcile(threads, temp_grace_ms);
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "files=" << st.files << " added=" << st.added << " bytes_added=" << st.bytes_added
+              << " temp_removed=" << st.temp_removed << " stale_dropped=" << st.stale_dropped
+              << " seconds=" << secs << "\n";
+    return 0;
+}
+
+int audit(RedisFileCache& cache, size_t count, int threads) {
+    RedisFileCache::AuditStats sum;
+    long long steps = 0;
+    do {
+        const auto st = cache.audit_index(count, threads > 0 ? threads : 8);
+        sum.checked += st.checked;
+        sum.dropped += st.dropped;
+        sum.size_fixed += st.size_fixed;
+        sum.bytes_corrected += st.bytes_corrected;
+        sum.pass_complete = st.pass_complete;
+        sum.drift = st.drift;
+        sum.churn = st.churn;
+        ++steps;
+    } while (!sum.pass_complete);
+    std::cout << "steps=" << steps << " checked=" << sum.checked << " dropped=" << sum.dropped
+              << " size_fixed=" << sum.size_fixed << " bytes_corrected=" << sum.bytes_corrected
+              << " drift=" << sum.drift << " churn=" << sum.churn << "\n";
+    return 0;
+}
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <command> [options]\n"
+              << "  migrate-fanout --cache-dir <path> --levels <n> [--dry-run]\n"
+              << "  migrate-schema [--hashed-names] [--key-encoding <text|binary64|binary128>]\n"
+              << "                 [--redis-host <h>] [--redis-port <p>] [--redis-db <n>] [--namespace <ns>]\n"
+              << "  reconcile --cache-dir <path> [--levels <n>] [--hashed-names] [--key-encoding <text|binary64|binary128>]\n"
+              << "            [--lru-mode <exact|sampled>] [--threads <n>] [--temp-grace-ms <ms>] [redis options]\n"
+              << "  audit --cache-dir <path> [--count <n>] [--threads <n>] [layout and redis options as for reconcile]\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) { usage(argv[0]); return 2; }
+    const std::string cmd = argv[1];
+
+    std::string cache_dir = "/tmp/poc-cache";
+    int levels = -1;
+    bool dry_run = false;
+    std::string redis_host = "127.0.0.1";
+    int redis_port = 6379;
+    int redis_db = 0;
+    std::string ns = "poc-cache";
+    bool hashed_names = false;
+    KeyEncoding key_encoding = KeyEncoding::text;
+    LruMode lru_mode = LruMode::exact;
+    int threads = 0;
+    long long temp_grace_ms = 3600000;
+    size_t count = 1000;
+    for (int i = 2; i < argc; ++i) {
+        if (!strcmp(argv[i], "--cache-dir") && i+1<argc) cache_dir = argv[++i];
+        else if (!strcmp(argv[i], "--redis-host") && i+1<argc) redis_host = argv[++i];
+        else if (!strcmp(argv[i], "--redis-port") && i+1<argc) redis_port = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--redis-db") && i+1<argc) redis_db = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--namespace") && i+1<argc) ns = argv[++i];
+        else if (!strcmp(argv[i], "--levels") && i+1<argc) levels = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--dry-run")) dry_run = true;
+        else if (!strcmp(argv[i], "--hashed-names")) hashed_names = true;
+        else if (!strcmp(argv[i], "--key-encoding") && i+1<argc) {
+            const std::string e = argv[++i];
+            key_encoding = e == "binary64" ? KeyEncoding::binary64 : e == "binary128" ? KeyEncoding::binary128 : KeyEncoding::text;
+        }
+        else if (!strcmp(argv[i], "--lru-mode") && i+1<argc) lru_mode = !strcmp(argv[++i], "sampled") ? LruMode::sampled : LruMode::exact;
+        else if (!strcmp(argv[i], "--threads") && i+1<argc) threads = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--temp-grace-ms") && i+1<argc) temp_grace_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--count") && i+1<argc) count = (size_t)std::atoll(argv[++i]);
+        else { usage(argv[0]); return 2; }
+    }
+
+    if (cmd == "migrate-fanout") {
+        if (levels < 0) { usage(argv[0]); return 2; }
+        return migrate_fanout(cache_dir, levels, dry_run);
+    }
+
+    if (cmd == "reconcile" || cmd == "audit") {
+        try {
+            RedisFileCache cache(cache_dir, redis_host, redis_port, redis_db, 60000, ns);
+            cache.set_fanout_levels(levels < 0 ? 0 : levels);
+            cache.set_hashed_names(hashed_names);
+            cache.set_key_encoding(key_encoding);
+            cache.set_lru_mode(lru_mode);
+            if (cmd == "audit") return audit(cache, count, threads);
+            return reconcile(cache, threads, temp_grace_ms);
+        }
+        catch (const std::exception& e) {
+            std::cerr << cmd << ": " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (cmd == "migrate-schema") {
+        try {
+            return migrate_schema(redis_host, redis_port, redis_db, ns, hashed_names || key_encoding != KeyEncoding::text);
+        }
+        catch (const std::exception& e) {
+            std::cerr << cmd << ": " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,560 @@
+//
+// Maintenance passes over the cache directory: rebuilding the Redis index from
+// the files, sweeping up temp files left by crashed writers, and auditing the
+// index against the files.
+//
+
+#include "RedisFileCacheLRU.h"
+#include "KeyHash.h"
+#include "DirScan.h"
+#include "RedisConnect.h"
+
+#include <hiredis/hiredis.h>
+
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdlib>
+
+namespace {
+
+bool is_hex_of_size(const std::string& n, size_t len) {
+    return n.size() == len && std::all_of(n.begin(), n.end(), [](char c) { return std::isxdigit((unsigned char)c); });
+}
+
+long long wall_ms() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+std::unique_ptr<redisContext, void(*)(redisContext*)> connect(const std::string& host, int port, int db) {
+    redisContext* c = redis_connect(host, port);
+    if (!c || c->err) {
+        const std::string msg = c ? c->errstr : "redisConnect failed";
+        if (c) redisFree(c);
+        throw std::runtime_error("Redis connect error: " + msg);
+    }
+    std::unique_ptr<redisContext, void(*)(redisContext*)> rc(c, redisFree);
+    if (db != 0) {
+        auto* r = static_cast<redisReply *>(redisCommand(c, "SELECT %d", db));
+        const bool ok = r && r->type != REDIS_REPLY_ERROR;
+        if (r) freeReplyObject(r);
+        if (!ok) throw std::runtime_error("Redis database connection error (db: " + std::to_string(db) + ")");
+    }
+    return rc;
+}
+
+using ReplyPtr = std::unique_ptr<redisReply, void(*)(void*)>;
+
+// Run one command; throws on a connection error or an error reply.
+ReplyPtr command(redisContext* rc, const char* fmt, ...) {
+    va_list ap; va_start(ap, fmt);
+    ReplyPtr r(static_cast<redisReply *>(redisvCommand(rc, fmt, ap)), freeReplyObject);
+    va_end(ap);
+    if (!r) throw std::runtime_error(std::string("Redis error: ") + rc->errstr);
+    if (r->type == REDIS_REPLY_ERROR) throw std::runtime_error("Redis error: " + std::string(r->str, r->len));
+    return r;
+}
+
+// Read the replies to 'n' pipelined commands into 'out'; LLONG_MIN for one that is not an integer.
+void read_replies(redisContext* rc, size_t n, std::vector<long long>& out) {
+    out.clear();
+    for (size_t i = 0; i < n; ++i) {
+        void* v = nullptr;
+        if (redisGetReply(rc, &v) != REDIS_OK) throw std::runtime_error(std::string("Redis error: ") + rc->errstr);
+        const auto* r = static_cast<redisReply *>(v);
+        out.push_back(r->type == REDIS_REPLY_INTEGER ? r->integer : LLONG_MIN);
+        freeReplyObject(v);
+    }
+}
+
+} // namespace
+
+/**
+ * The payload size of the entry file 'name' in the directory open on 'dfd'
+ * (AT_FDCWD for a path): the file size, less the key header with hashed
+ * names. -1 if there is no such file; -2 if it is not an entry.
+ */
+long long RedisFileCache::stat_entry(int dfd, const std::string& name, long long& mtime) const {
+    struct stat st{};
+    if (::fstatat(dfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return errno == ENOENT || errno == ESTALE ? -1 : -2;
+    if (!S_ISREG(st.st_mode)) return -2;
+    mtime = mtime_ms(st);
+    long long size = st.st_size;
+    if (uses_hashed_names()) {
+        char hdr[8];
+        const int fd = ::openat(dfd, name.c_str(), O_RDONLY);
+        if (fd < 0) return errno == ENOENT || errno == ESTALE ? -1 : -2;
+        const ssize_t n = ::pread(fd, hdr, sizeof(hdr), 0);
+        ::close(fd);
+        const long long h = n > 0 ? key_header_size(hdr, (size_t)n) : -1;
+        if (h < 0 || h > size) return -2;
+        size -= h;
+    }
+    return size;
+}
+
+/**
+ * Make the index agree with the cache directory. Use it after Redis lost the
+ * namespace's keys (a restart without persistence, FLUSHALL): the files are
+ * still there, but without index entries their bytes are invisible to
+ * ensure_capacity() and they are never evicted.
+ *
+ * 1. The cache directory (every fan-out leaf) is listed in parallel with
+ *    getdents64. Writer temp files older than 'temp_grace_ms' are removed;
+ *    they belong to writers that died before publishing.
+ * 2. The entries are split among 'threads' workers, each with its own Redis
+ *    connection. A worker stats its files and pipelines, per batch, an HSETNX
+ *    of the entry's meta field and an 'NX' LRU record, then one INCRBY of the
+ *    total for the entries that were new. NX makes this safe while the cache
+ *    is in use: an entry a writer publishes meanwhile keeps the writer's
+ *    record, and the publish script corrects the total for one that the
+ *    reconciler indexed first. A rebuilt entry's LRU time is its file's
+ *    mtime, so it is among the first to go.
+ * 3. idx:meta is scanned and every entry whose file is gone is dropped with
+ *    the 'unindex' script, which also takes its size off the total.
+ *
+ * With hashed names each file's key header is read to find the entry's size.
+ * The cache must be configured (fan-out, names, encoding, LRU mode) the way
+ * its writers are.
+ *
+ * @param threads Worker threads; 0 == one per CPU
+ * @param temp_grace_ms Only remove temp files last modified longer ago than this
+ */
+RedisFileCache::ReconcileStats RedisFileCache::reconcile(int threads, long long temp_grace_ms) {
+    if (threads <= 0) threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    ReconcileStats stats;
+    const long long now_wall = wall_ms();
+    const long long now_lru = now_ms();   // not thread safe; read it once here
+    const bool mtime_is_lru_time = lru_clock_ == LruClock::redis && clock_skew_ms_ == 0;
+    const std::string flags = std::to_string(uses_hashed_names() ? meta_flag_key_header : 0);
+    const size_t binary_name_len = key_encoding_ == KeyEncoding::binary64 ? 16
+                                 : key_encoding_ == KeyEncoding::binary128 ? 32 : 0;
+
+    const std::vector<std::string> leaves = fanout_leaves(cache_dir_, fanout_levels_);
+
+    std::vector<int> leaf_fds(leaves.size(), -1);
+    for (size_t i = 0; i < leaves.size(); ++i) leaf_fds[i] = ::open(leaves[i].c_str(), O_RDONLY | O_DIRECTORY);
+    struct CloseAll {
+        std::vector<int>& fds;
+        ~CloseAll() { for (int fd : fds) if (fd >= 0) ::close(fd); }
+    } close_all{leaf_fds};
+
+    // Phase 1: list the leaves in parallel; remove old temp files on the way
+    struct Found { uint32_t leaf; std::string name; };
+    std::vector<std::vector<Found>> found(threads);
+    std::atomic<size_t> next_leaf{0};
+    std::atomic<long long> temp_removed{0};
+    std::exception_ptr failure;
+    std::mutex failure_mtx;
+
+    auto run = [&](const std::function<void(int)>& work) {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back([&, t] {
+                try { work(t); }
+                catch (...) {
+                    std::lock_guard<std::mutex> g(failure_mtx);
+                    if (!failure) failure = std::current_exception();
+                }
+            });
+        }
+        for (auto& th : pool) th.join();
+        if (failure) std::rethrow_exception(failure);
+    };
+
+    run([&](int t) {
+        std::vector<DirEntry> ents;
+        for (size_t i = next_leaf++; i < leaves.size(); i = next_leaf++) {
+            if (leaf_fds[i] < 0) continue;
+            ents.clear();
+            list_dir(leaf_fds[i], ents);
+            for (auto& e : ents) {
+                if (e.name[0] != '.') {
+                    if (e.type == DT_REG || e.type == DT_UNKNOWN) found[t].push_back({(uint32_t)i, std::move(e.name)});
+                    continue;
+                }
+                if (!is_temp_name(e.name)) continue;
+                struct stat st{};
+                if (::fstatat(leaf_fds[i], e.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)
+                    && now_wall - mtime_ms(st) > temp_grace_ms
+                    && ::unlinkat(leaf_fds[i], e.name.c_str(), 0) == 0)
+                    ++temp_removed;
+            }
+        }
+    });
+    stats.temp_removed = temp_removed;
+
+    std::vector<Found> entries;
+    for (auto& f : found) {
+        std::move(f.begin(), f.end(), std::back_inserter(entries));
+        std::vector<Found>().swap(f);
+    }
+
+    // Phase 2: index what is on disk, each worker on its own slice and connection
+    std::vector<std::vector<uint64_t>> seen(threads);
+    std::atomic<long long> files{0}, added{0}, bytes_added{0};
+    const size_t slice = (entries.size() + threads - 1) / threads;
+    const size_t batch_max = 512;
+
+    run([&](int t) {
+        const size_t begin = std::min(entries.size(), t * slice);
+        const size_t end = std::min(entries.size(), begin + slice);
+        if (begin == end) return;
+        auto rc = connect(redis_host_, redis_port_, redis_db_);
+
+        std::vector<long long> sizes, replies;
+        auto flush = [&]() {
+            if (sizes.empty()) return;
+            read_replies(rc.get(), 2 * sizes.size(), replies);
+            long long bytes = 0, n = 0;
+            for (size_t i = 0; i < sizes.size(); ++i)
+                if (replies[2 * i] == 1) { bytes += sizes[i]; ++n; }
+            if (n > 0) {
+                auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "INCRBY %s %lld", k_total_.c_str(), bytes));
+                if (!r) throw std::runtime_error(std::string("Redis error: ") + rc->errstr);
+                freeReplyObject(r);
+                // Counted as churn by a running audit pass, like a publish
+                if ((r = static_cast<redisReply *>(redisCommand(rc.get(), "HINCRBY %s churn %lld", k_audit_pass_.c_str(), bytes))))
+                    freeReplyObject(r);
+            }
+            added += n;
+            bytes_added += bytes;
+            sizes.clear();
+        };
+
+        for (size_t i = begin; i < end; ++i) {
+            const int dfd = leaf_fds[entries[i].leaf];
+            const std::string& name = entries[i].name;
+            if (binary_name_len && !is_hex_of_size(name, binary_name_len)) continue;   // not an entry
+
+            long long mtime = 0;
+            const long long size = stat_entry(dfd, name, mtime);
+            if (size < 0) continue;
+
+            const std::string id = redis_id(name);
+            const long long ts = mtime_is_lru_time ? std::min(mtime, now_lru) : now_lru;
+            const std::string packed = std::to_string(size) + ":" + std::to_string(ts) + ":" + flags;
+            redisAppendCommand(rc.get(), "HSETNX %s %b %b", h_meta_.c_str(), id.data(), id.size(), packed.data(), packed.size());
+            if (lru_mode_ == LruMode::sampled)
+                redisAppendCommand(rc.get(), "HSETNX %s %b %lld", h_atime_.c_str(), id.data(), id.size(), ts);
+            else
+                redisAppendCommand(rc.get(), "ZADD %s NX %lld %b", z_lru_.c_str(), ts, id.data(), id.size());
+            sizes.push_back(size);
+            seen[t].push_back(fnv1a_64(id));
+            ++files;
+            if (sizes.size() >= batch_max) flush();
+        }
+        flush();
+    });
+    stats.files = files;
+    stats.added = added;
+    stats.bytes_added = bytes_added;
+    std::vector<Found>().swap(entries);
+
+    std::unordered_set<uint64_t> on_disk;
+    on_disk.reserve((size_t)stats.files);
+    for (auto& s : seen) {
+        on_disk.insert(s.begin(), s.end());
+        std::vector<uint64_t>().swap(s);
+    }
+
+    // Phase 3: drop entries whose file is gone. An entry missing from the listing may have been
+    // published since; only one whose file still does not exist is dropped.
+    const std::string& unindex_sha = scripts_->sha("unindex");
+    std::string cursor = "0";
+    do {
+        auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), "HSCAN %s %s COUNT 1000", h_meta_.c_str(), cursor.c_str()));
+        if (!r) throw std::runtime_error(std::string("Redis error: ") + rc_->errstr);
+        std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+        if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) break;
+        cursor.assign(r->element[0]->str, r->element[0]->len);
+
+        std::vector<std::string> gone;
+        const auto* kv = r->element[1];
+        for (size_t i = 0; i + 1 < kv->elements; i += 2) {
+            const std::string id(kv->element[i]->str, kv->element[i]->len);
+            if (on_disk.count(fnv1a_64(id))) continue;
+            if (!file_exists_(path_for(name_for_id(id)))) gone.push_back(id);
+        }
+        for (const auto& id : gone)
+            redisAppendCommand(rc_.get(), "EVALSHA %s 6 %s %s %s %s %s %s %b drift_fix %lld", unindex_sha.c_str(),
+                               h_meta_.c_str(), k_total_.c_str(), z_lru_.c_str(), h_atime_.c_str(), k_events_.c_str(),
+                               k_audit_pass_.c_str(), id.data(), id.size(), events_maxlen_);
+        std::vector<long long> sizes;
+        read_replies(rc_.get(), gone.size(), sizes);
+        for (size_t i = 0; i < gone.size(); ++i) {
+            // An error (e.g. NOSCRIPT after SCRIPT FLUSH) is retried through the script manager
+            const long long sz = sizes[i] != LLONG_MIN ? sizes[i] : index_remove_on_delete(gone[i]);
+            if (sz >= 0) ++stats.stale_dropped;
+        }
+    } while (cursor != "0");
+
+    return stats;
+}
+
+/**
+ * Remove temp files whose writers are gone. A writer that dies between
+ * mkstemp() and rename() leaves a '.<name>.XXXXXX' file that the index never
+ * counted, so eviction never reclaims it. A temp file is an orphan when it
+ * has not been modified for a lock TTL and no write lock is held on its
+ * entry; a live writer either holds the lock (renewed by the heartbeat for a
+ * long write) or is still writing the file.
+ *
+ * Each call sweeps one fan-out subtree, so a sweep costs about 1/256 of the
+ * directory; the namespace's 'sweep:cursor' moves every process's sweeps
+ * around the subtrees in turn. With a flat layout the whole directory is
+ * swept. The space reclaimed is added to the temp_swept_files and
+ * temp_swept_bytes counters in the namespace's 'stats' hash.
+ *
+ * @param subtree The first-level fan-out directory to sweep (0-255); -1 == the next in turn
+ */
+RedisFileCache::SweepStats RedisFileCache::sweep_temp_files(int subtree) {
+    SweepStats stats;
+    if (fanout_levels_ > 0 && subtree < 0) subtree = (int)((cmd_ll("INCR %s", k_sweep_cursor_.c_str()) - 1) % 256);
+
+    const unsigned char top = (unsigned char)subtree;
+    const std::vector<std::string> leaves = fanout_levels_ == 0 ? std::vector<std::string>{cache_dir_}
+        : fanout_leaves(cache_dir_ + "/" + to_hex(&top, 1), fanout_levels_ - 1);
+
+    const long long now = wall_ms();
+    const long long min_age_ms = std::max(base_ttl_ms_, ttl_ms_);
+    std::vector<DirEntry> ents;
+    for (const auto& leaf : leaves) {
+        const int dfd = ::open(leaf.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dfd < 0) continue;
+        ents.clear();
+        list_dir(dfd, ents);
+        for (const auto& e : ents) {
+            if (!is_temp_name(e.name)) continue;
+            ++stats.examined;
+            struct stat st{};
+            if (::fstatat(dfd, e.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (now - mtime_ms(st) < min_age_ms) continue;
+            const std::string id = redis_id(temp_entry_name(e.name));
+            if (cmd_ll("EXISTS %b", k_write(id).data(), k_write(id).size()) != 0) continue;
+            if (::unlinkat(dfd, e.name.c_str(), 0) != 0) continue;
+            ++stats.removed;
+            stats.bytes += st.st_size;
+        }
+        ::close(dfd);
+    }
+
+    if (stats.removed > 0) {
+        cmd_ll("HINCRBY %s temp_swept_files %lld", k_stats_.c_str(), stats.removed);
+        cmd_ll("HINCRBY %s temp_swept_bytes %lld", k_stats_.c_str(), stats.bytes);
+    }
+    return stats;
+}
+
+/**
+ * Run sweep_temp_files() at most once per sweep interval across the whole
+ * namespace. The local deadline keeps most writes from asking Redis at all;
+ * the 'sweep:mutex' (left to expire, not released) picks one process per
+ * interval. Like purging, sweeping is best-effort.
+ */
+void RedisFileCache::maybe_sweep() {
+    if (sweep_interval_ms_ <= 0) return;
+    const long long now = steady_ms();
+    if (now < sweep_next_ms_) return;
+    sweep_next_ms_ = now + sweep_interval_ms_;
+
+    try {
+        if (cmd_s("SET %s 1 NX PX %lld", k_sweep_mtx_.c_str(), sweep_interval_ms_) != "OK") return;
+        sweep_temp_files();
+    } catch (...) {
+        // swallow; the next interval tries again
+    }
+}
+
+/**
+ * One step of a continuous audit of the index against the cache directory.
+ * 'try_evict_one()' notices an entry missing from the index; this finds the
+ * opposite kinds of drift, which inflate the total and so make
+ * ensure_capacity() evict too much: entries whose file is gone and entries
+ * indexed with the wrong size.
+ *
+ * A step HSCANs 'count' entries of idx:meta from the namespace's persisted
+ * cursor (so successive steps, by any process, walk the whole index) and
+ * stats their files with 'threads' threads. Each mismatch is fixed by a
+ * script that applies only if the entry is unchanged since it was read, and
+ * that moves the total by the same amount.
+ *
+ * Drift no entry accounts for (e.g. a double INCRBY) is found over the pass,
+ * without blocking Redis for a recount: the first step records the total
+ * ('base') in the namespace's audit:pass hash, each step adds the indexed
+ * sizes it saw ('sum'), and the step that completes the pass takes the
+ * difference off the total with one INCRBY. An entry published or removed
+ * during the pass may be counted at its old or new size, so the scripts that
+ * do that add the bytes they move to 'churn', and a drift no larger than the
+ * churn is measured but not corrected. A pass epoch makes each step's sum and
+ * the correction apply only to the pass they belong to.
+ *
+ * Counters go to the namespace's 'stats' hash: audit_checked, audit_dropped,
+ * audit_size_fixed, audit_passes, and audit_drift_bytes (the last pass's
+ * drift).
+ */
+RedisFileCache::AuditStats RedisFileCache::audit_index(size_t count, int threads) {
+    AuditStats stats;
+    if (threads < 1) threads = 1;
+
+    std::string cursor = cmd_s("GET %s", k_audit_cursor_.c_str());
+    if (cursor.empty()) cursor = "0";
+    const std::string epoch = cursor == "0"
+        ? std::to_string(scripts_->evalsha_ll("audit_begin", 2, {k_audit_pass_, k_total_}, {}))
+        : cmd_s("HGET %s epoch", k_audit_pass_.c_str());
+
+    struct Item { std::string id; std::string seen; long long size = -2; };
+    std::vector<Item> items;
+    {
+        auto* r = static_cast<redisReply *>(redisCommand(rc_.get(), "HSCAN %s %s COUNT %zu", h_meta_.c_str(), cursor.c_str(), count));
+        if (!r) throw std::runtime_error(std::string("Redis error: ") + rc_->errstr);
+        std::unique_ptr<redisReply, void(*)(void*)> guard(r, freeReplyObject);
+        if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) return stats;
+        cursor.assign(r->element[0]->str, r->element[0]->len);
+        const auto* kv = r->element[1];
+        for (size_t i = 0; i + 1 < kv->elements; i += 2)
+            items.push_back({std::string(kv->element[i]->str, kv->element[i]->len),
+                             std::string(kv->element[i+1]->str, kv->element[i+1]->len)});
+    }
+
+    // Stat the files in parallel; the fixes below go through this object's one connection
+    std::atomic<size_t> next{0};
+    auto stat_some = [&] {
+        for (size_t i = next++; i < items.size(); i = next++) {
+            long long mtime = 0;
+            items[i].size = stat_entry(AT_FDCWD, path_for(name_for_id(items[i].id)), mtime);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads && (size_t)t < items.size(); ++t) pool.emplace_back(stat_some);
+    stat_some();
+    for (auto& th : pool) th.join();
+
+    const std::vector<std::string> keys3{h_meta_, k_total_, k_events_};
+    const std::vector<std::string> keys5{h_meta_, k_total_, z_lru_, h_atime_, k_events_};
+    const std::string maxlen = std::to_string(events_maxlen_);
+    long long sum = 0;  // the sizes as indexed when scanned; the fixes below move the total with them
+    for (const auto& it : items) {
+        sum += std::atoll(it.seen.c_str());
+        ++stats.checked;
+        if (it.size == -2) continue;    // unreadable or not an entry; leave it to eviction
+        if (it.size == -1) {
+            if (scripts_->evalsha_ll("audit_drop", 5, keys5, {it.id, it.seen, maxlen}) >= 0) ++stats.dropped;
+            continue;
+        }
+        if (std::to_string(it.size) == it.seen.substr(0, it.seen.find(':'))) continue;
+        const long long delta = scripts_->evalsha_ll("audit_fix", 3, keys3, {it.id, it.seen, std::to_string(it.size), maxlen});
+        if (delta != 0) {
+            ++stats.size_fixed;
+            stats.bytes_corrected += delta;
+        }
+    }
+
+    const std::vector<std::string> pass_keys{k_audit_pass_, k_total_, k_events_};
+    if (sum != 0) scripts_->evalsha_ll("audit_add", 1, {k_audit_pass_}, {epoch, std::to_string(sum)});
+    cmd_s("SET %s %s", k_audit_cursor_.c_str(), cursor.c_str());
+    if (cursor == "0") {
+        stats.pass_complete = true;
+        stats.churn = cmd_ll("HGET %s churn", k_audit_pass_.c_str());
+        stats.drift = scripts_->evalsha_ll("audit_end", 3, pass_keys, {epoch, maxlen});
+        cmd_ll("HINCRBY %s audit_passes 1", k_stats_.c_str());
+        cmd_ll("HSET %s audit_drift_bytes %lld", k_stats_.c_str(), stats.drift);
+    }
+
+    cmd_ll("HINCRBY %s audit_checked %lld", k_stats_.c_str(), stats.checked);
+    if (stats.dropped) cmd_ll("HINCRBY %s audit_dropped %lld", k_stats_.c_str(), stats.dropped);
+    if (stats.size_fixed) cmd_ll("HINCRBY %s audit_size_fixed %lld", k_stats_.c_str(), stats.size_fixed);
+    return stats;
+}
+
+// Like maybe_sweep(), for audit_index().
+void RedisFileCache::maybe_audit() {
+    if (audit_interval_ms_ <= 0) return;
+    const long long now = steady_ms();
+    if (now < audit_next_ms_) return;
+    audit_next_ms_ = now + audit_interval_ms_;
+
+    try {
+        if (cmd_s("SET %s 1 NX PX %lld", k_audit_mtx_.c_str(), audit_interval_ms_) != "OK") return;
+        audit_index(audit_count_);
+    } catch (...) {
+        // swallow; the next interval tries again
+    }
+}
+
+/**
+ * Convert the version 1 index of namespace 'ns' to the current layout.
+ * Version 1 kept a key's size in idx:size and its name in keys:set; version 2
+ * packs "size:created_ms:flags" into one idx:meta field. The creation time is
+ * unknown for old entries, so the migration time is used. Every entry gets
+ * meta_flag_key_header when 'key_headers' is true, i.e. when the namespace's
+ * writers use hashed names or a binary key encoding; reconcile() sets the
+ * flag the same way. The LRU structures are unchanged. The total is
+ * recomputed from the sizes, which also repairs any drift.
+ *
+ * A static member because no cache can be constructed on a version 1
+ * namespace. Stop every cache process using the namespace first. A namespace
+ * that already has a schema version is left alone; its version is returned
+ * in 'had_version'.
+ */
+RedisFileCache::SchemaMigrationStats
+RedisFileCache::migrate_index_schema(const std::string& redis_host, int redis_port, int redis_db,
+                                     const std::string& ns, bool key_headers) {
+    const std::string h_sizes = ns + ":idx:size", h_meta = ns + ":idx:meta";
+    const std::string k_schema = ns + ":idx:schema", k_total = ns + ":idx:total";
+    const std::string want = std::to_string(index_schema_version);
+    const std::string flags = std::to_string(key_headers ? meta_flag_key_header : 0);
+
+    auto rc = connect(redis_host, redis_port, redis_db);
+
+    SchemaMigrationStats stats;
+    auto v = command(rc.get(), "GET %s", k_schema.c_str());
+    if (v->type == REDIS_REPLY_STRING) {
+        stats.had_version.assign(v->str, v->len);
+        return stats;
+    }
+
+    long long now_ms = 0;
+    auto t = command(rc.get(), "TIME");
+    if (t->type == REDIS_REPLY_ARRAY && t->elements == 2)
+        now_ms = std::atoll(t->element[0]->str) * 1000 + std::atoll(t->element[1]->str) / 1000;
+    const std::string created = std::to_string(now_ms);
+
+    std::string cursor = "0";
+    std::vector<long long> replies;
+    do {
+        auto r = command(rc.get(), "HSCAN %s %s COUNT 1000", h_sizes.c_str(), cursor.c_str());
+        if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) throw std::runtime_error("HSCAN " + h_sizes + " failed");
+        cursor.assign(r->element[0]->str, r->element[0]->len);
+        const auto* kv = r->element[1];
+
+        // Pipeline one page of HSETNX commands
+        size_t sent = 0;
+        for (size_t i = 0; i + 1 < kv->elements; i += 2) {
+            const std::string size(kv->element[i+1]->str, kv->element[i+1]->len);
+            const std::string packed = size + ":" + created + ":" + flags;
+            redisAppendCommand(rc.get(), "HSETNX %s %b %b", h_meta.c_str(), kv->element[i]->str, kv->element[i]->len,
+                               packed.data(), packed.size());
+            stats.total_bytes += std::atoll(size.c_str());
+            ++sent;
+        }
+        read_replies(rc.get(), sent, replies);
+        stats.entries += (long long)sent;
+    } while (cursor != "0");
+
+    command(rc.get(), "SET %s %lld", k_total.c_str(), stats.total_bytes);
+    command(rc.get(), "DEL %s %s:keys:set", h_sizes.c_str(), ns.c_str());
+    command(rc.get(), "SET %s %s", k_schema.c_str(), want.c_str());
+    return stats;
+}
@@ -1,6 +1,11 @@
 // test_poc_cache_mproc_hiredis_lru.cpp
 
 #include "RedisFileCacheLRU.h"
+#include "CacheMetrics.h"
+#include "RedisConnect.h"
+#include "SimWorkload.h"
+#include "SimStats.h"
+#include "SimDelayProxy.h"
 #include <hiredis/hiredis.h>
 
 #include <sys/stat.h>
@@ -12,12 +17,20 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <chrono>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <thread>
 
 // ------------------ small hiredis helpers ------------------
 static redisContext* rc_connect(const std::string& host, int port, int db) {
-    redisContext* rc = redisConnect(host.c_str(), port);
+    redisContext* rc = redis_connect(host, port);
     if (!rc || rc->err) {
         std::cerr << "redis connect error: " << (rc ? rc->errstr : "NULL") << "\n";
         if (rc) redisFree(rc);
@@ -72,7 +85,7 @@ static void del_matching(redisContext* rc, const std::string& pattern) {
         for (size_t i = 0; i < arr->elements; ++i) {
             if (arr->element[i]->type != REDIS_REPLY_STRING) continue;
             std::string key(arr->element[i]->str, arr->element[i]->len);
-            if (auto* r2 = (redisReply*)redisCommand(rc, "DEL %b", key.data(), (size_t)key.size()))
+            if (auto* r2 = (redisReply*)redisCommand(rc, "UNLINK %b", key.data(), (size_t)key.size()))
                 freeReplyObject(r2);
         }
 
@@ -97,127 +110,537 @@ static std::string short_hex(std::mt19937_64& gen, int n) {
     return s;
 }
 
+// ------------------ SIMULATOR OPTIONS ------------------
+// Everything main() parses from the command line; workers get a const ref.
+struct SimOptions {
+    int processes = 4;
+    int duration = 20;
+    std::string cache_dir = "/tmp/poc-cache";
+    int fanout_levels = 0;          // levels of hashed subdirectories under cache_dir
+    long long temp_sweep_ms = 0;    // > 0 => sweep for orphaned temp files this often
+    long long audit_ms = 0;         // > 0 => run an index audit step this often
+    std::string redis_host = "127.0.0.1";
+    int redis_port = 6379;
+    int redis_db = 0;
+    std::string ns = "poc-cache";
+    double write_prob = 0.15;
+    int read_sleep_ms = 5;
+    int write_sleep_ms = 20;
+    int key_suffix_chars = 4;
+    bool blocking = false;
+    long long max_bytes = 0;        // 0 => unbounded
+    LruMode lru_mode = LruMode::exact;
+    int lru_samples = 5;
+    long long touch_granularity_ms = 0;  // 0 => every read sends its own LRU touch
+    LruClock lru_clock = LruClock::redis;
+    long long clock_skew_ms = 0;    // worker i runs with its clock i * clock_skew_ms behind
+    long long lease_ttl_ms = 0;     // > 0 => short lock TTL renewed by a heartbeat thread
+    bool share_read_leases = false; // one Redis reader lease per key for all workers on this host
+    ReadMode read_mode = ReadMode::locked;
+    bool track_lock_state = false;  // RESP3 client-side caching of lock state; lock-free reads of stable keys
+    int monitor_every_ms = 1000;    // parent monitor tick
+    bool debug = false;
+    int  debug_every_ms = 2000;     // how often to print debug info
+    int  debug_top = 10;            // how many items to show for LRU/sizes
+    bool clean_start = false;       // clear the Redis namespace before starting
+    bool metrics = false;           // print each worker's per-operation latency percentiles at exit
+    std::string trace_dir;          // non-empty => each worker writes trace-<pid>.json here
+    Workload::Kind workload = Workload::uniform;
+    size_t keys = 10000;            // objects in the zipf and scan workloads
+    double zipf_skew = 0.99;
+    double scan_prob = 0.0;         // zipf: chance that a request starts a scan
+    size_t scan_length = 1000;
+    std::vector<TraceRecord> trace; // the trace workload's requests, loaded by main()
+    SizeDistribution sizes;         // object sizes (when a trace does not give them)
+    uint64_t seed = 1;              // object sizes are a function of the key and this
+    long run_id = 0;                // the parent's pid; names the ns:sim:stats:<run_id> hash of run totals
+    double rate = 0;                // > 0 => open loop: Poisson arrivals at this many requests/s per worker thread
+    std::string csv;                // non-empty => append the run's latency percentiles to this CSV file
+    int threads = 1;                // request threads per worker process
+    bool share_cache = false;       // the threads of a worker share one RedisFileCache (else one each)
+    std::vector<int> thread_sweep;  // non-empty => one run per thread count, then a scaling table
+    int nodes = 0;                  // > 0 => emulate this many hosts, each with 'processes' workers
+    double node_delay_ms = 0;       // one-way delay each node's proxy adds to its Redis traffic
+    double node_jitter_ms = 0;      // +/- uniform jitter on that delay
+};
+
+// One line per operation, script and Redis command that ran: count, mean, p50/p99/p999 and max, in
+// microseconds; then the Redis calls that dominate each operation.
+static void print_metrics(const std::string& who, const CacheMetrics& m) {
+    const auto s = m.snapshot();
+    auto line = [&who](const std::string& what, const LatencyHistogram::Snapshot& h) {
+        if (h.count == 0) return;
+        std::cout << who << " " << what
+                  << " n=" << h.count
+                  << " mean_us=" << (long long)h.mean_us()
+                  << " p50=" << h.percentile(0.5)
+                  << " p99=" << h.percentile(0.99)
+                  << " p999=" << h.percentile(0.999)
+                  << " max=" << h.max_us
+                  << "\n";
+    };
+    for (const auto& kv : s.ops) line("op:" + kv.first, kv.second);
+    for (const auto& kv : s.scripts) line("script:" + kv.first, kv.second.latency);
+    for (const auto& kv : s.commands) line("cmd:" + kv.first, kv.second.latency);
+    std::cout << who << " Redis time by operation:\n" << m.redis_report(5);
+    std::cout.flush();
+}
+
+// Sum the workers' hit counts for the run, then drop them.
+static HitStats print_hit_ratios(redisContext* rc, const SimOptions& o) {
+    const std::string run_stats = o.ns + ":sim:stats:" + std::to_string(o.run_id);
+    HitStats h;
+    h.hits = get_ll(rc, "HGET %s hits", run_stats);
+    h.misses = get_ll(rc, "HGET %s misses", run_stats);
+    h.hit_bytes = get_ll(rc, "HGET %s hit_bytes", run_stats);
+    h.miss_bytes = get_ll(rc, "HGET %s miss_bytes", run_stats);
+    del(rc, run_stats);
+
+    static const char* names[] = {"uniform", "zipf", "scan", "trace"};
+    std::cout << "workload=" << names[o.workload]
+              << " requests=" << h.hits + h.misses
+              << " hit_ratio=" << h.hit_ratio()
+              << " byte_hit_ratio=" << h.byte_hit_ratio()
+              << std::endl;
+    return h;
+}
+
+// ------------------ REQUEST LATENCY ------------------
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+static void print_percentiles(const std::string& what, const LatencyHistogram::Snapshot& h) {
+    std::cout << what
+              << " n=" << h.count
+              << " mean_us=" << (long long)h.mean_us()
+              << " p50=" << h.percentile(0.5)
+              << " p90=" << h.percentile(0.9)
+              << " p99=" << h.percentile(0.99)
+              << " p999=" << h.percentile(0.999)
+              << " max=" << h.max_us
+              << "\n";
+}
+
+// "count sum_us max_us bucket:n bucket:n ..." (non-empty buckets only)
+static std::string encode_histogram(const LatencyHistogram::Snapshot& h) {
+    std::string out = std::to_string(h.count) + " " + std::to_string(h.sum_us) + " " + std::to_string(h.max_us);
+    for (size_t i = 0; i < h.buckets.size(); ++i)
+        if (h.buckets[i]) out += " " + std::to_string(i) + ":" + std::to_string(h.buckets[i]);
+    return out;
+}
+
+static LatencyHistogram::Snapshot decode_histogram(const std::string& s) {
+    LatencyHistogram::Snapshot h;
+    h.buckets.resize(LatencyHistogram::bucket_count);
+    std::istringstream in(s);
+    in >> h.count >> h.sum_us >> h.max_us;
+    std::string b;
+    while (in >> b) {
+        const auto colon = b.find(':');
+        const auto i = std::stoul(b.substr(0, colon));
+        if (colon != std::string::npos && i < h.buckets.size()) h.buckets[i] = std::stoull(b.substr(colon + 1));
+    }
+    return h;
+}
+
+/**
+ * A worker's request latencies, in microseconds, by request type. 'latency'
+ * runs from the request's arrival (open loop) or start (closed loop) to its
+ * end; 'service' from when the worker started it. In an open-loop run the
+ * difference is the time a request waited behind earlier ones.
+ */
+struct SimLatency {
+    enum Op { read, write, op_count };
+    static const char* op_name(int op) { return op == read ? "read" : "write"; }
+
+    LatencyHistogram latency[op_count];
+    LatencyHistogram service[op_count];
+
+    void print(const std::string& prefix) const {
+        for (int op = 0; op < op_count; ++op) {
+            const auto l = latency[op].snapshot();
+            if (l.count == 0) continue;
+            print_percentiles(prefix + op_name(op) + " latency", l);
+            print_percentiles(prefix + op_name(op) + " service", service[op].snapshot());
+        }
+        std::cout.flush();
+    }
+
+    /// HSET 'key' <id>:<op>:<kind> for each histogram, for the parent to merge.
+    void save(redisContext* rc, const std::string& key, const std::string& id) const {
+        for (int op = 0; op < op_count; ++op) {
+            for (const char* kind : {"latency", "service"}) {
+                const auto h = (kind[0] == 'l' ? latency : service)[op].snapshot();
+                if (h.count == 0) continue;
+                const std::string field = id + ":" + op_name(op) + ":" + kind;
+                const std::string value = encode_histogram(h);
+                if (auto* r = (redisReply*)redisCommand(rc, "HSET %s %b %b", key.c_str(),
+                                                        field.data(), field.size(), value.data(), value.size()))
+                    freeReplyObject(r);
+            }
+        }
+    }
+};
+
+// Merge the workers' latency histograms for the run, print them, append them to --csv, then drop them.
+static LatencyMap print_latencies(redisContext* rc, const SimOptions& o) {
+    const std::string key = o.ns + ":sim:lat:" + std::to_string(o.run_id);
+    LatencyMap merged;
+    if (auto* r = (redisReply*)redisCommand(rc, "HGETALL %s", key.c_str())) {
+        std::unique_ptr<redisReply, void(*)(void*)> G(r, freeReplyObject);
+        if (r->type == REDIS_REPLY_ARRAY) {
+            for (size_t i = 0; i + 1 < r->elements; i += 2) {
+                std::string field(r->element[i]->str, r->element[i]->len);   // <pid>:<op>:<kind>
+                const auto c1 = field.find(':'), c2 = field.rfind(':');
+                if (c1 == c2) continue;
+                field = field.substr(c1 + 1, c2 - c1 - 1) + " " + field.substr(c2 + 1);
+                merged[field].add(decode_histogram(std::string(r->element[i+1]->str, r->element[i+1]->len)));
+            }
+        }
+    }
+    del(rc, key);
+    if (merged.empty()) return merged;
+
+    for (const auto& kv : merged) print_percentiles(kv.first, kv.second);
+    if (o.csv.empty()) return merged;
+
+    // Append, so that runs at several rates collect in one file
+    struct stat st;
+    const bool header = ::stat(o.csv.c_str(), &st) != 0 || st.st_size == 0;
+    std::ofstream out(o.csv, std::ios::app);
+    if (!out) { std::cerr << "Could not write " << o.csv << "\n"; return merged; }
+    if (header) out << "rate,processes,threads,shared_cache,op,kind,n,ops_s,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n";
+    for (const auto& kv : merged) {
+        const auto& h = kv.second;
+        const auto sp = kv.first.find(' ');
+        out << o.rate << "," << o.processes << "," << o.threads << "," << (o.share_cache ? 1 : 0)
+            << "," << kv.first.substr(0, sp) << "," << kv.first.substr(sp + 1)
+            << "," << h.count << "," << (double)h.count / std::max(o.duration, 1)
+            << "," << (long long)h.mean_us() << "," << h.percentile(0.5) << "," << h.percentile(0.9)
+            << "," << h.percentile(0.99) << "," << h.percentile(0.999) << "," << h.max_us << "\n";
+    }
+    return merged;
+}
+
 // ------------------ UPDATED WORKER ------------------
-int worker(const std::string& cache_dir,
-           const std::string& ns,
-           const std::string& redis_host,
-           int redis_port,
-           int redis_db,
-           double write_prob,
-           int duration_sec,
-           int read_sleep_ms,
-           int write_sleep_ms,
-           int key_suffix_chars,
-           bool use_blocking,
-           long long max_bytes)
+// A cache set up from the options; 'trace_name' names its trace file in o.trace_dir.
+static std::unique_ptr<RedisFileCache> make_cache(const SimOptions& o, int index, const std::string& trace_name) {
+    // cache instance (bounded if max_bytes > 0)
+    std::unique_ptr<RedisFileCache> cache(
+        new RedisFileCache(o.cache_dir, o.redis_host, o.redis_port, o.redis_db, 60000, o.ns, o.max_bytes));
+    cache->set_fanout_levels(o.fanout_levels);
+    cache->set_temp_sweep_interval(o.temp_sweep_ms);
+    cache->set_index_audit_interval(o.audit_ms);
+    cache->set_lru_mode(o.lru_mode);
+    cache->set_lru_samples(o.lru_samples);
+    cache->set_touch_coalescing(o.touch_granularity_ms);
+    cache->set_lru_clock(o.lru_clock);
+    if (o.lease_ttl_ms > 0) cache->enable_lease_heartbeat(o.lease_ttl_ms);
+    cache->set_local_lease_sharing(o.share_read_leases);
+    cache->set_lock_state_tracking(o.track_lock_state);
+    cache->set_read_mode(o.read_mode);
+    if (!o.trace_dir.empty()) cache->set_trace_file(o.trace_dir + "/" + trace_name + ".json");
+    // A host that booted later has a smaller steady_clock; its entries look older than they are.
+    if (o.clock_skew_ms != 0) cache->set_clock_skew_ms(-index * o.clock_skew_ms);
+    return cache;
+}
+
+/**
+ * The request loop of thread 'thread' of worker 'index', for o.duration
+ * seconds. 'cache_mtx' is non-null when the worker's threads share 'cache'
+ * (and so its one Redis connection); RedisFileCache is not thread-safe, so
+ * its calls are then serialized, and time spent waiting for the mutex is
+ * part of each request's service time.
+ */
+static void run_requests(const SimOptions& o, int index, int thread, RedisFileCache& cache, std::mutex* cache_mtx,
+                         SimLatency& lat, WorkerCounts& c)
 {
     pid_t pid = getpid();
     // hiredis control for discovery set ops
-    redisContext* rc = rc_connect(redis_host, redis_port, redis_db);
-    if (!rc) return 1;
+    redisContext* rc = rc_connect(o.redis_host, o.redis_port, o.redis_db);
+    if (!rc) return;
 
-    // cache instance (bounded if max_bytes > 0)
-    RedisFileCache cache(cache_dir, redis_host, redis_port, redis_db, 60000, ns, max_bytes);
-    const std::string keyset = ns + ":keys:set";
+    // Key discovery for readers; the simulator keeps this set itself (the cache indexes entries in idx:meta)
+    const std::string keyset = o.ns + ":keys:set";
 
-    std::mt19937_64 gen((uint64_t)pid ^ (uint64_t)time(nullptr));
+    std::mt19937_64 gen(((uint64_t)pid ^ (uint64_t)time(nullptr)) + 0x9e3779b97f4a7c15ULL * (uint64_t)thread);
     std::uniform_real_distribution<double> u01(0.0,1.0);
-    std::uniform_int_distribution<int> payload_len(200, 4000);
 
-    auto ms_sleep = [](int ms){ if (ms>0) usleep(ms*1000); };
+    // The zipf, scan and trace workloads are read-through: a miss writes the object
+    const int threads = std::max(o.threads, 1);
+    std::unique_ptr<Workload> wl;
+    if (o.workload != Workload::uniform)
+        wl.reset(new Workload(o.workload, o.keys, o.zipf_skew, o.scan_prob, o.scan_length, o.sizes, o.seed,
+                              o.trace, index * threads + thread, std::max(o.processes, 1) * std::max(o.nodes, 1) * threads));
+
+    // Open loop: requests arrive as a Poisson process at o.rate/s whatever the cache's latency, and each
+    // is timed from its arrival, so a stall counts against every request it delayed (no coordinated
+    // omission). Closed loop: each request starts when the last one and its sleep are done.
+    const bool open_loop = o.rate > 0;
+    std::exponential_distribution<double> gap(open_loop ? o.rate : 1.0);
+    auto arrival = std::chrono::steady_clock::now();
+    auto record = [&](int op, std::chrono::steady_clock::time_point started) {
+        const auto done = std::chrono::steady_clock::now();
+        lat.latency[op].record(elapsed_us(open_loop ? arrival : started, done));
+        lat.service[op].record(elapsed_us(started, done));
+    };
+
+    auto ms_sleep = [open_loop](int ms){ if (ms>0 && !open_loop) usleep(ms*1000); };
     auto now = [](){ return time(nullptr); };
     time_t t0 = now();
 
-    long it=0, ro=0, rb=0, rm=0, rbytes=0;
-    long wo=0, wb=0, we=0, wbytes=0, other=0;
-
     auto new_key = [&](){
-        return std::to_string(pid) + "-" + short_hex(gen, key_suffix_chars) + ".bin";
+        return std::to_string(pid) + "-" + short_hex(gen, o.key_suffix_chars) + ".bin";
     };
 
-    while (now() - t0 < duration_sec) {
-        ++it;
-        bool do_write = (u01(gen) < write_prob);
-        if (do_write) {
-            auto key = new_key();
-            int n = payload_len(gen);
-            std::string hdr = "pid=" + std::to_string(pid) + ";key=" + key + ";rand=" + short_hex(gen, 8) + "\n";
-            std::string data = hdr;
-            data.resize(hdr.size() + n);
-            for (size_t i=hdr.size(); i<data.size(); ++i) data[i] = char(gen() & 0xFF);
-
-            try {
-                if (use_blocking) {
-                    if (cache.write_bytes_create_blocking(key, data, std::chrono::milliseconds(1500))) {
-                        sadd(rc, keyset, key);
-                        ++wo; wbytes += (long)data.size();
-                    } else {
-                        ++wb; // timed out waiting for lock
-                    }
-                } else {
-                    cache.write_bytes_create(key, data);
-                    sadd(rc, keyset, key);
-                    ++wo; wbytes += (long)data.size();
+    // 'size' bytes, starting with a header that names the writer and the key
+    auto payload = [&](const std::string& key, size_t size) {
+        std::string data = "pid=" + std::to_string(pid) + ";key=" + key + ";rand=" + short_hex(gen, 8) + "\n";
+        const size_t hdr = std::min(data.size(), size);
+        data.resize(size);
+        for (size_t i=hdr; i<data.size(); ++i) data[i] = char(gen() & 0xFF);
+        return data;
+    };
+
+    auto lock_cache = [cache_mtx]() {
+        return cache_mtx ? std::unique_lock<std::mutex>(*cache_mtx) : std::unique_lock<std::mutex>();
+    };
+
+    // True if the entry was written
+    auto write_one = [&](const std::string& key, const std::string& data) {
+        try {
+            auto lk = lock_cache();
+            if (o.blocking) {
+                if (cache.write_bytes_create_blocking(key, data, std::chrono::milliseconds(1500))) {
+                    ++c.wo; c.wbytes += (long)data.size();
+                    return true;
                 }
-            } catch (const CacheBusyError&) {
-                ++wb;
-            } catch (const std::system_error& se) {
-                if (se.code().value() == EEXIST) ++we;
-                else {
-                    ++other;
-                    std::cerr << "Work write_bytes_create error: " << se.code().value() << '\n';
+                ++c.wb; // timed out waiting for lock
+            } else {
+                cache.write_bytes_create(key, data);
+                ++c.wo; c.wbytes += (long)data.size();
+                return true;
+            }
+        } catch (const CacheBusyError&) {
+            ++c.wb;
+        } catch (const std::system_error& se) {
+            if (se.code().value() == EEXIST) ++c.we;
+            else {
+                ++c.other;
+                std::cerr << "Work write_bytes_create error: " << se.code().value() << '\n';
+            }
+        } catch (const std::runtime_error& re) {
+            ++c.other;
+            std::cerr << "Work write_bytes_create runtime error: " << re.what() << '\n';
+        } catch (const std::exception& e) {
+            ++c.other;
+            std::cerr << "Work write_bytes_create exception: " << e.what() << '\n';
+        } catch (...) {
+            ++c.other;
+            std::cerr << "Work write_bytes_create error but who knows why...\n";
+        }
+        return false;
+    };
+
+    enum ReadResult { read_ok, read_busy, read_miss, read_error };
+    auto read_one = [&](const std::string& key, std::string& s) {
+        try {
+            auto lk = lock_cache();
+            if (o.blocking) {
+                if (!cache.read_bytes_blocking(key, s, std::chrono::milliseconds(1000))) {
+                    ++c.rb; // timed out due to writer/evict fence
+                    return read_busy;
                 }
-            } catch (const std::runtime_error& re) {
-                ++other;
-                std::cerr << "Work write_bytes_create runtime error: " << re.what() << '\n';
-            } catch (const std::exception& e) {
-                ++other;
-                std::cerr << "Work write_bytes_create exception: " << e.what() << '\n';
-            } catch (...) {
-                ++other;
-                std::cerr << "Work write_bytes_create error but who knows why...\n";
+            } else {
+                s = cache.read_bytes(key);
             }
-            ms_sleep(write_sleep_ms);
+            ++c.ro; c.rbytes += (long)s.size();
+            return read_ok;
+        } catch (const CacheBusyError&) {
+            ++c.rb;
+            return read_busy;
+        } catch (const std::system_error& se) {
+            if (se.code().value() == ENOENT) { ++c.rm; return read_miss; }
+            ++c.other;
+        } catch (...) {
+            ++c.other;
+        }
+        return read_error;
+    };
+
+    while (now() - t0 < o.duration) {
+        ++c.it;
+        if (open_loop) {
+            arrival += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(gap(gen)));
+            std::this_thread::sleep_until(arrival);
+        }
+        auto started = std::chrono::steady_clock::now();
+
+        if (wl) {
+            // A miss and the write that fills it are one read request
+            const auto req = wl->next(gen);
+            std::string s;
+            switch (read_one(req.key, s)) {
+                case read_ok: c.hits.hit((long long)req.size); break;
+                case read_miss:
+                    c.hits.miss((long long)req.size);
+                    write_one(req.key, payload(req.key, req.size));
+                    break;
+                default: break;
+            }
+            record(SimLatency::read, started);
+            ms_sleep(o.read_sleep_ms);
+            continue;
+        }
+
+        bool do_write = (u01(gen) < o.write_prob);
+        if (do_write) {
+            auto key = new_key();
+            const auto data = payload(key, o.sizes.for_key(key, o.seed));
+            started = std::chrono::steady_clock::now();
+            const bool ok = write_one(key, data);
+            record(SimLatency::write, started);
+            if (ok) sadd(rc, keyset, key);
+            ms_sleep(o.write_sleep_ms);
         } else {
             auto key = srandmember(rc, keyset);
-            if (key.empty()) { ++rm; ms_sleep(read_sleep_ms); continue; }
-            try {
-                if (use_blocking) {
-                    std::string s;
-                    if (cache.read_bytes_blocking(key, s, std::chrono::milliseconds(1000))) {
-                        ++ro; rbytes += (long)s.size();
-                    } else {
-                        ++rb; // timed out due to writer/evict fence
-                    }
-                } else {
-                    auto s = cache.read_bytes(key);
-                    ++ro; rbytes += (long)s.size();
-                }
-            } catch (const CacheBusyError&) {
-                ++rb;
-            } catch (const std::system_error& se) {
-                if (se.code().value() == ENOENT) { ++rm; srem(rc, keyset, key); }
-                else ++other;
-            } catch (...) {
-                ++other;
+            if (key.empty()) { ++c.rm; ms_sleep(o.read_sleep_ms); continue; }
+            started = std::chrono::steady_clock::now();
+            std::string s;
+            const auto r = read_one(key, s);
+            record(SimLatency::read, started);
+            switch (r) {
+                case read_ok: c.hits.hit((long long)s.size()); break;
+                case read_miss:
+                    c.hits.miss((long long)o.sizes.for_key(key, o.seed));
+                    srem(rc, keyset, key);
+                    break;
+                default: break;
             }
-            ms_sleep(read_sleep_ms);
+            ms_sleep(o.read_sleep_ms);
         }
     }
 
-    std::cout << "PID " << pid
-              << " it=" << it
-              << " R(ok/busy/miss)=" << ro << "/" << rb << "/" << rm
-              << " Rbytes=" << rbytes
-              << " W(ok/busy/exist)=" << wo << "/" << wb << "/" << we
-              << " Wbytes=" << wbytes
-              << " other=" << other
-              << std::endl;
+    redisFree(rc);
+}
+
+// 'index' is the worker number, 0..processes-1; it determines the simulated clock skew.
+int worker(const SimOptions& o, int index)
+{
+    pid_t pid = getpid();
+    const std::string who = "PID " + std::to_string(pid);
+    redisContext* rc = rc_connect(o.redis_host, o.redis_port, o.redis_db);
+    if (!rc) return 1;
+
+    // One cache for the process, or one per thread
+    const int threads = std::max(o.threads, 1);
+    std::vector<std::unique_ptr<RedisFileCache>> caches;
+    for (int t = 0; t < (o.share_cache ? 1 : threads); ++t)
+        caches.push_back(make_cache(o, index, "trace-" + std::to_string(pid) + (t ? "-" + std::to_string(t) : "")));
+    if (o.clock_skew_ms != 0) {
+        std::cout << who << " worker=" << index
+                  << " clock=" << (o.lru_clock == LruClock::redis ? "redis" : "steady")
+                  << " skew_ms=" << caches[0]->get_clock_skew_ms() << std::endl;
+    }
+
+    std::mutex cache_mtx;
+    SimLatency lat;
+    std::vector<WorkerCounts> counts(threads);
+    auto run = [&](int t) {
+        try {
+            run_requests(o, index, t, o.share_cache ? *caches[0] : *caches[t],
+                         o.share_cache && threads > 1 ? &cache_mtx : nullptr, lat, counts[t]);
+        }
+        catch (const std::exception& e) {
+            std::cerr << who << " thread " << t << ": " << e.what() << '\n';
+        }
+    };
+    if (threads == 1) run(0);
+    else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) pool.emplace_back(run, t);
+        for (auto& th : pool) th.join();
+    }
+
+    const WorkerCounts total = sum_thread_counts(counts, who, std::cout);
+
+    // For the parent's run totals
+    const std::string run_stats = o.ns + ":sim:stats:" + std::to_string(o.run_id);
+    const HitStats& hits = total.hits;
+    if (auto* r = (redisReply*)redisCommand(rc, "HINCRBY %s hits %lld", run_stats.c_str(), hits.hits)) freeReplyObject(r);
+    if (auto* r = (redisReply*)redisCommand(rc, "HINCRBY %s misses %lld", run_stats.c_str(), hits.misses)) freeReplyObject(r);
+    if (auto* r = (redisReply*)redisCommand(rc, "HINCRBY %s hit_bytes %lld", run_stats.c_str(), hits.hit_bytes)) freeReplyObject(r);
+    if (auto* r = (redisReply*)redisCommand(rc, "HINCRBY %s miss_bytes %lld", run_stats.c_str(), hits.miss_bytes)) freeReplyObject(r);
+    lat.print(who + " ");
+    lat.save(rc, o.ns + ":sim:lat:" + std::to_string(o.run_id), std::to_string(pid));
+
+    if (o.metrics) {
+        for (size_t t = 0; t < caches.size(); ++t)
+            print_metrics(caches.size() > 1 ? who + "/" + std::to_string(t) : who, caches[t]->metrics());
+    }
 
     redisFree(rc);
     return 0;
 }
 
+// ------------------ EMULATED NODES ------------------
+/**
+ * Node 'n' of a --nodes run: a process group of its own, with o.processes
+ * workers that reach Redis through a DelayProxy, as from another host. Each
+ * node has its own Redis address (the proxy's port), and so its own
+ * LocalLeaseTable; all nodes share o.cache_dir, as hosts share a network
+ * file system.
+ */
+static int node(const SimOptions& o, int n) {
+    ::setpgid(0, 0);
+    const std::string who = "node " + std::to_string(n);
+    std::unique_ptr<DelayProxy> proxy;
+    try {
+        proxy.reset(new DelayProxy(o.redis_host, o.redis_port, o.node_delay_ms, o.node_jitter_ms, o.seed + (uint64_t)n));
+    }
+    catch (const std::exception& e) {
+        std::cerr << who << ": " << e.what() << '\n';
+        return 1;
+    }
+
+    SimOptions no = o;
+    no.redis_host = "127.0.0.1";
+    no.redis_port = proxy->port();
+    std::cout << who << " pgid=" << ::getpgrp()
+              << " redis=" << no.redis_host << ":" << no.redis_port
+              << " delay_ms=" << o.node_delay_ms
+              << " jitter_ms=" << o.node_jitter_ms
+              << std::endl;
+
+    // Fork before the proxy starts its threads; the workers' connections wait in its listen backlog
+    std::vector<pid_t> pids;
+    for (int i = 0; i < o.processes; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) std::exit(worker(no, n * o.processes + i));
+        if (pid < 0) { perror("fork"); break; }
+        pids.push_back(pid);
+    }
+    proxy->start();
+
+    int status = pids.size() == (size_t)o.processes ? 0 : 1;
+    for (auto pid : pids) {
+        int st = 0;
+        if (waitpid(pid, &st, 0) != pid || !WIFEXITED(st) || WEXITSTATUS(st) != 0) status = 1;
+    }
+    proxy->stop();
+
+    const auto s = proxy->stats();
+    std::cout << who << " proxy connections=" << s.connections
+              << " bytes_up=" << s.bytes_up
+              << " bytes_down=" << s.bytes_down
+              << std::endl;
+    // The proxy's port is ephemeral, so nothing else will use or remove this node's table
+    if (o.share_read_leases)
+        LocalLeaseTable::remove(LocalLeaseTable::name_for(no.ns, no.redis_host, no.redis_port, no.redis_db));
+    return status;
+}
+
 // ---------- DEBUG HELPERS ----------
 static void debug_print_total(redisContext* rc, const std::string& total_key) {
     if (auto* r = (redisReply*)redisCommand(rc, "GET %s", total_key.c_str())) {
@@ -229,17 +652,17 @@ static void debug_print_total(redisContext* rc, const std::string& total_key) {
     }
 }
 
-static void debug_print_sizes(redisContext* rc, const std::string& h_sizes, int top) {
-    if (auto* r = (redisReply*)redisCommand(rc, "HLEN %s", h_sizes.c_str())) {
+static void debug_print_sizes(redisContext* rc, const std::string& h_meta, int top) {
+    if (auto* r = (redisReply*)redisCommand(rc, "HLEN %s", h_meta.c_str())) {
         std::unique_ptr<redisReply, void(*)(void*)> G(r, freeReplyObject);
         long long n = (r->type == REDIS_REPLY_INTEGER) ? r->integer : 0;
-        std::cout << "  sizes.count=" << n << "\n";
+        std::cout << "  meta.count=" << n << "\n";
     }
     // Show a handful using HSCAN
     std::string cursor = "0";
     int shown = 0;
     while (shown < top) {
-        if (auto* r = (redisReply*)redisCommand(rc, "HSCAN %s %s COUNT %d", h_sizes.c_str(), cursor.c_str(), top*2)) {
+        if (auto* r = (redisReply*)redisCommand(rc, "HSCAN %s %s COUNT %d", h_meta.c_str(), cursor.c_str(), top*2)) {
             std::unique_ptr<redisReply, void(*)(void*)> G(r, freeReplyObject);
             if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) break;
             // next cursor
@@ -249,7 +672,7 @@ static void debug_print_sizes(redisContext* rc, const std::string& h_sizes, int
             for (size_t i=0; i+1<kv->elements && shown<top; i+=2) {
                 std::string k = (kv->element[i]->type==REDIS_REPLY_STRING) ? std::string(kv->element[i]->str, kv->element[i]->len) : "";
                 std::string v = (kv->element[i+1]->type==REDIS_REPLY_STRING) ? std::string(kv->element[i+1]->str, kv->element[i+1]->len) : "";
-                std::cout << "    size[" << k << "]=" << v << "\n";
+                std::cout << "    meta[" << k << "]=" << v << "\n";   // size:created_ms:flags
                 ++shown;
             }
             if (cursor == "0") break;
@@ -280,18 +703,66 @@ static void debug_print_lru(redisContext* rc, const std::string& z_lru, int top)
     }
 }
 
-static void debug_print_evictions(redisContext* rc, const std::string& ns, int top) {
-    std::string logkey = ns + ":evict:log";
-    if (auto* r = (redisReply*)redisCommand(rc, "LRANGE %s 0 %d", logkey.c_str(), top-1)) {
+// An ns:events entry's fields as "f1=v1 f2=v2 ..."
+static std::string event_fields(const redisReply* entry) {
+    std::string out;
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 2) return out;
+    const auto* fields = entry->element[1];
+    for (size_t f = 0; f + 1 < fields->elements; f += 2) {
+        if (!out.empty()) out += ' ';
+        out += std::string(fields->element[f]->str, fields->element[f]->len) + "="
+             + std::string(fields->element[f+1]->str, fields->element[f+1]->len);
+    }
+    return out;
+}
+
+static void debug_print_events(redisContext* rc, const std::string& ns, int top) {
+    std::string events = ns + ":events";
+    if (auto* r = (redisReply*)redisCommand(rc, "XREVRANGE %s + - COUNT %d", events.c_str(), top)) {
+        std::unique_ptr<redisReply, void(*)(void*)> G(r, freeReplyObject);
+        std::cout << "  events (most recent first):\n";
+        if (r->type == REDIS_REPLY_ARRAY) {
+            for (size_t i=0; i<r->elements; ++i) {
+                const auto* e = r->element[i];
+                const std::string id = (e->type == REDIS_REPLY_ARRAY && e->elements > 0) ? std::string(e->element[0]->str, e->element[0]->len) : "";
+                std::cout << "    " << id << " " << event_fields(e) << "\n";
+            }
+        }
+    }
+}
+
+// Keys are '<writer pid>-<hex>.bin'; count evictions by the pid that wrote the victim. With skewed
+// steady clocks the evictions pile up on the workers whose clocks are behind; with the Redis clock
+// they track actual access recency and so spread across the writers.
+// The stream is capped (set_event_stream_maxlen()), so a long run counts only its latest evictions.
+static void print_evictions_by_writer(redisContext* rc, const std::string& ns) {
+    std::string events = ns + ":events";
+    std::map<std::string, long> by_writer;
+    long total = 0;
+    if (auto* r = (redisReply*)redisCommand(rc, "XRANGE %s - +", events.c_str())) {
         std::unique_ptr<redisReply, void(*)(void*)> G(r, freeReplyObject);
-        std::cout << "  evict.log (most recent first):\n";
         if (r->type == REDIS_REPLY_ARRAY) {
             for (size_t i=0; i<r->elements; ++i) {
-                std::string v = (r->element[i]->type==REDIS_REPLY_STRING) ? std::string(r->element[i]->str, r->element[i]->len) : "";
-                std::cout << "    " << v << "\n";
+                const auto* e = r->element[i];
+                if (e->type != REDIS_REPLY_ARRAY || e->elements < 2) continue;
+                std::string type, key;
+                const auto* fields = e->element[1];
+                for (size_t f = 0; f + 1 < fields->elements; f += 2) {
+                    const std::string name(fields->element[f]->str, fields->element[f]->len);
+                    if (name == "type") type.assign(fields->element[f+1]->str, fields->element[f+1]->len);
+                    else if (name == "key") key.assign(fields->element[f+1]->str, fields->element[f+1]->len);
+                }
+                if (type != "evict") continue;
+                ++by_writer[key.substr(0, key.find('-'))];
+                ++total;
             }
         }
     }
+    std::cout << "evictions by writer pid (total=" << total << "):\n";
+    for (const auto& kv : by_writer) {
+        std::cout << "  " << kv.first << " " << kv.second
+                  << " (" << (total ? (100 * kv.second / total) : 0) << "%)\n";
+    }
 }
 
 static void debug_print_active_write_locks(redisContext* rc, const std::string& ns, int max_show) {
@@ -324,123 +795,78 @@ static void debug_print_active_write_locks(redisContext* rc, const std::string&
     }
 }
 
+// Everything under the namespace: the index, locks and eviction fences, the stats hash, sweep and
+// audit state, events, and the sim: totals of an earlier run.
 static void clean_run_state(redisContext* rc, const std::string& ns) {
-    del(rc, ns + ":keys:set");
-    del(rc, ns + ":idx:lru");
-    del(rc, ns + ":idx:size");
-    del(rc, ns + ":idx:total");
-    del(rc, ns + ":purge:mutex");
-    del(rc, ns + ":evict:log");
-
-    del_matching(rc, ns + ":lock:write:*");
-    del_matching(rc, ns + ":lock:readers:*");
-    del_matching(rc, ns + ":lock:evict:*");
+    std::string pattern;
+    for (char c : ns) {
+        if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') pattern.push_back('\\');
+        pattern.push_back(c);
+    }
+    del_matching(rc, pattern + ":*");
 }
 
-// ------------------ UPDATED MAIN ------------------
-int main(int argc, char** argv) {
-    int processes = 4;
-    int duration = 20;
-    std::string cache_dir = "/tmp/poc-cache";
-    std::string redis_host = "127.0.0.1";
-    int redis_port = 6379;
-    int redis_db = 0;
-    std::string ns = "poc-cache";
-    double write_prob = 0.15;
-    int read_sleep_ms = 5;
-    int write_sleep_ms = 20;
-    int key_suffix_chars = 4;
-    bool blocking = false;
-    long long max_bytes = 0; // 0 => unbounded
-    int monitor_every_ms = 1000; // parent monitor tick
-    bool debug = false;
-    int  debug_every_ms = 2000;   // how often to print debug info
-    int  debug_top = 10;          // how many items to show for LRU/sizes
-    bool clean_start = false;     // clear the Redis namespace before starting
-
-    for (int i=1; i<argc; ++i) {
-        if (!strcmp(argv[i], "--processes") && i+1<argc) processes = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--duration") && i+1<argc) duration = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--cache-dir") && i+1<argc) cache_dir = argv[++i];
-        else if (!strcmp(argv[i], "--redis-host") && i+1<argc) redis_host = argv[++i];
-        else if (!strcmp(argv[i], "--redis-port") && i+1<argc) redis_port = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--redis-db") && i+1<argc) redis_db = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--namespace") && i+1<argc) ns = argv[++i];
-        else if (!strcmp(argv[i], "--write-prob") && i+1<argc) write_prob = std::atof(argv[++i]);
-        else if (!strcmp(argv[i], "--read-sleep") && i+1<argc) read_sleep_ms = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--write-sleep") && i+1<argc) write_sleep_ms = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--key-suffix-chars") && i+1<argc) key_suffix_chars = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--blocking")) blocking = true;
-        else if (!strcmp(argv[i], "--clean-start")) clean_start = true;
-        else if (!strcmp(argv[i], "--max-bytes") && i+1<argc) max_bytes = std::atoll(argv[++i]);
-        else if (!strcmp(argv[i], "--monitor-ms") && i+1<argc) monitor_every_ms = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--debug")) debug = true;
-        else if (!strcmp(argv[i], "--debug-interval-ms") && i+1<argc) debug_every_ms = std::atoi(argv[++i]);
-        else if (!strcmp(argv[i], "--debug-top") && i+1<argc) debug_top = std::atoi(argv[++i]);
-    }
-
-    ::mkdir(cache_dir.c_str(), 0777);
-
-    // Parent hiredis connection for prep & monitoring
-    redisContext* rc = rc_connect(redis_host, redis_port, redis_db);
-    if (!rc) return 1;
-
-    if (clean_start) {
-        clean_run_state(rc, ns);
+/**
+ * One run of o.processes workers (or one, in this process, when processes
+ * is 0) for o.duration seconds, monitored from 'rc'. The workers' totals are
+ * printed and returned in 'result'. 'rc' is replaced when the run drops and
+ * reopens it, and is null if that fails.
+ */
+static int run(const SimOptions& o, redisContext*& rc, RunResult& result) {
+    if (o.clean_start) {
+        clean_run_state(rc, o.ns);
+        // Lease counts from an earlier run would point at leases that no longer exist
+        LocalLeaseTable::remove(LocalLeaseTable::name_for(o.ns, o.redis_host, o.redis_port, o.redis_db));
     }
 
-    const std::string keyset = ns + ":keys:set";
-    const std::string z_lru = ns + ":idx:lru";
-    const std::string h_sizes = ns + ":idx:size";
-    const std::string total_key = ns + ":idx:total";
+    const std::string z_lru = o.ns + ":idx:lru";
+    const std::string h_meta = o.ns + ":idx:meta";
+    const std::string total_key = o.ns + ":idx:total";
 
     // Kludge for debugging; Single process version, else ... [rest of main]
-    if (processes == 0) {
+    if (o.processes == 0) {
         long long total_bytes = get_ll(rc, "GET %s", total_key);
-        long long nkeys = get_ll(rc, "SCARD %s", keyset);
+        long long nkeys = get_ll(rc, "HLEN %s", h_meta);
 
         std::cout << "total_bytes=" << total_bytes
                   << " keys=" << nkeys
-                  << (max_bytes>0 ? (" cap=" + std::to_string(max_bytes)) : "")
+                  << (o.max_bytes>0 ? (" cap=" + std::to_string(o.max_bytes)) : "")
                   << "\n";
 
         redisFree(rc);
 
-        worker(cache_dir, ns, redis_host, redis_port, redis_db,
-                          write_prob, duration, read_sleep_ms, write_sleep_ms,
-                          key_suffix_chars, blocking, max_bytes);
+        worker(o, 0);
 
-        rc = rc_connect(redis_host, redis_port, redis_db);
+        rc = rc_connect(o.redis_host, o.redis_port, o.redis_db);
         if (!rc) return 1;
 
         total_bytes = get_ll(rc, "GET %s", total_key);
-        nkeys = get_ll(rc, "SCARD %s", keyset);
+        nkeys = get_ll(rc, "HLEN %s", h_meta);
 
         std::cout << "total_bytes=" << total_bytes
                   << " keys=" << nkeys
-                  << (max_bytes>0 ? (" cap=" + std::to_string(max_bytes)) : "")
+                  << (o.max_bytes>0 ? (" cap=" + std::to_string(o.max_bytes)) : "")
                   << "\n";
-
-        redisFree(rc);
+        result.hits = print_hit_ratios(rc, o);
+        result.latencies = print_latencies(rc, o);
         return 0;
     }
 
     // Monitor keys for reporting
 
-    // Spawn workers (fork)
-    std::vector<pid_t> pids; pids.reserve(processes);
-    for (int i=0; i<processes; ++i) {
+    // Spawn workers, or nodes of workers (fork); flush first, or the children print what the parent has buffered
+    std::cout.flush();
+    const int children = o.nodes > 0 ? o.nodes : o.processes;
+    std::vector<pid_t> pids; pids.reserve(children);
+    for (int i=0; i<children; ++i) {
         pid_t pid = fork();
         if (pid == 0) {
             // child
-            return worker(cache_dir, ns, redis_host, redis_port, redis_db,
-                          write_prob, duration, read_sleep_ms, write_sleep_ms,
-                          key_suffix_chars, blocking, max_bytes);
+            std::exit(o.nodes > 0 ? node(o, i) : worker(o, i));
         } else if (pid > 0) {
             pids.push_back(pid);
         } else {
             perror("fork");
-            redisFree(rc);
             return 1;
         }
     }
@@ -460,28 +886,158 @@ int main(int argc, char** argv) {
         }
 
         long long total_bytes = get_ll(rc, "GET %s", total_key);
-        long long nkeys       = get_ll(rc, "SCARD %s", keyset);
+        long long nkeys       = get_ll(rc, "HLEN %s", h_meta);
         auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
             std::chrono::steady_clock::now() - t_start).count();
 
         std::cout << "[monitor t=" << elapsed
                   << "s] total_bytes=" << total_bytes
                   << " keys=" << nkeys
-                  << (max_bytes>0 ? (" cap=" + std::to_string(max_bytes)) : "")
+                  << (o.max_bytes>0 ? (" cap=" + std::to_string(o.max_bytes)) : "")
                   << "\n";
 
-        if (debug) {
+        if (o.debug) {
             std::cout << "DEBUG:\n";
             debug_print_total(rc, total_key);
-            debug_print_lru(rc, z_lru, debug_top);
-            debug_print_sizes(rc, h_sizes, debug_top);
-            debug_print_evictions(rc, ns, debug_top);
-            debug_print_active_write_locks(rc, ns, /*max_show=*/debug_top);
+            debug_print_lru(rc, z_lru, o.debug_top);
+            debug_print_sizes(rc, h_meta, o.debug_top);
+            debug_print_events(rc, o.ns, o.debug_top);
+            debug_print_active_write_locks(rc, o.ns, /*max_show=*/o.debug_top);
         }
 
         if (live == 0) break;
-        usleep((debug ? debug_every_ms : monitor_every_ms) * 1000);
+        usleep((o.debug ? o.debug_every_ms : o.monitor_every_ms) * 1000);
+    }
+
+    result.hits = print_hit_ratios(rc, o);
+    result.latencies = print_latencies(rc, o);
+    if (o.clock_skew_ms != 0) {
+        print_evictions_by_writer(rc, o.ns);
+    }
+    return 0;
+}
+
+// ------------------ UPDATED MAIN ------------------
+int main(int argc, char** argv) {
+    SimOptions o;
+    std::string workload = "uniform", size_dist = "uniform", trace_file, thread_sweep;
+
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "--processes") && i+1<argc) o.processes = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--duration") && i+1<argc) o.duration = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--cache-dir") && i+1<argc) o.cache_dir = argv[++i];
+        else if (!strcmp(argv[i], "--fanout-levels") && i+1<argc) o.fanout_levels = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--temp-sweep-ms") && i+1<argc) o.temp_sweep_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--audit-ms") && i+1<argc) o.audit_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--redis-host") && i+1<argc) o.redis_host = argv[++i];
+        else if (!strcmp(argv[i], "--redis-port") && i+1<argc) o.redis_port = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--redis-db") && i+1<argc) o.redis_db = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--namespace") && i+1<argc) o.ns = argv[++i];
+        else if (!strcmp(argv[i], "--write-prob") && i+1<argc) o.write_prob = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--read-sleep") && i+1<argc) o.read_sleep_ms = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--write-sleep") && i+1<argc) o.write_sleep_ms = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--key-suffix-chars") && i+1<argc) o.key_suffix_chars = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--blocking")) o.blocking = true;
+        else if (!strcmp(argv[i], "--clean-start")) o.clean_start = true;
+        else if (!strcmp(argv[i], "--metrics")) o.metrics = true;
+        else if (!strcmp(argv[i], "--trace-dir") && i+1<argc) o.trace_dir = argv[++i];
+        else if (!strcmp(argv[i], "--max-bytes") && i+1<argc) o.max_bytes = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--lru-mode") && i+1<argc) {
+            const std::string m = argv[++i];
+            o.lru_mode = (m == "sampled") ? LruMode::sampled : LruMode::exact;
+        }
+        else if (!strcmp(argv[i], "--lru-samples") && i+1<argc) o.lru_samples = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lru-clock") && i+1<argc) {
+            const std::string c = argv[++i];
+            o.lru_clock = (c == "steady") ? LruClock::steady : LruClock::redis;
+        }
+        else if (!strcmp(argv[i], "--clock-skew-ms") && i+1<argc) o.clock_skew_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--lease-ttl-ms") && i+1<argc) o.lease_ttl_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--share-read-leases")) o.share_read_leases = true;
+        else if (!strcmp(argv[i], "--track-lock-state")) o.track_lock_state = true;
+        else if (!strcmp(argv[i], "--read-mode") && i+1<argc) {
+            const std::string m = argv[++i];
+            o.read_mode = (m == "optimistic") ? ReadMode::optimistic
+                        : (m == "open-fd") ? ReadMode::open_fd : ReadMode::locked;
+        }
+        else if (!strcmp(argv[i], "--touch-granularity-ms") && i+1<argc) o.touch_granularity_ms = std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--monitor-ms") && i+1<argc) o.monitor_every_ms = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--debug")) o.debug = true;
+        else if (!strcmp(argv[i], "--debug-interval-ms") && i+1<argc) o.debug_every_ms = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--debug-top") && i+1<argc) o.debug_top = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--workload") && i+1<argc) workload = argv[++i];
+        else if (!strcmp(argv[i], "--keys") && i+1<argc) o.keys = (size_t)std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--zipf-skew") && i+1<argc) o.zipf_skew = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--scan-prob") && i+1<argc) o.scan_prob = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--scan-length") && i+1<argc) o.scan_length = (size_t)std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--trace") && i+1<argc) trace_file = argv[++i];
+        else if (!strcmp(argv[i], "--size-dist") && i+1<argc) size_dist = argv[++i];
+        else if (!strcmp(argv[i], "--size-min") && i+1<argc) o.sizes.min = (size_t)std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--size-max") && i+1<argc) o.sizes.max = (size_t)std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--size-median") && i+1<argc) o.sizes.median = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--size-sigma") && i+1<argc) o.sizes.sigma = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--pareto-alpha") && i+1<argc) o.sizes.alpha = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i+1<argc) o.seed = (uint64_t)std::atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--rate") && i+1<argc) o.rate = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--csv") && i+1<argc) o.csv = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i+1<argc) o.threads = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--share-cache")) o.share_cache = true;
+        else if (!strcmp(argv[i], "--thread-sweep") && i+1<argc) thread_sweep = argv[++i];
+        else if (!strcmp(argv[i], "--nodes") && i+1<argc) o.nodes = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--node-delay-ms") && i+1<argc) o.node_delay_ms = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--node-jitter-ms") && i+1<argc) o.node_jitter_ms = std::atof(argv[++i]);
+    }
+
+    try {
+        o.workload = Workload::parse(workload);
+        o.sizes.kind = SizeDistribution::parse(size_dist);
+        if (!trace_file.empty()) o.trace = load_trace(trace_file);
+        if (o.workload == Workload::trace && o.trace.empty())
+            throw std::invalid_argument("--workload trace needs a --trace file with at least one request");
+        if (o.zipf_skew < 0) throw std::invalid_argument("--zipf-skew must be >= 0");
+        if (o.threads < 1) throw std::invalid_argument("--threads must be >= 1");
+        if (o.nodes > 0 && o.processes < 1) throw std::invalid_argument("--nodes needs --processes >= 1");
+        // e.g. 1,2,4,8
+        std::istringstream sweep(thread_sweep);
+        for (std::string n; std::getline(sweep, n, ',');) {
+            o.thread_sweep.push_back(std::stoi(n));
+            if (o.thread_sweep.back() < 1) throw std::invalid_argument("--thread-sweep counts must be >= 1");
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "RedisFileCacheLRU_Simulator: " << e.what() << "\n";
+        return 1;
+    }
+    o.run_id = (long)getpid();
+
+    ::mkdir(o.cache_dir.c_str(), 0777);
+    if (!o.trace_dir.empty()) ::mkdir(o.trace_dir.c_str(), 0777);
+
+    // Parent hiredis connection for prep & monitoring
+    redisContext* rc = rc_connect(o.redis_host, o.redis_port, o.redis_db);
+    if (!rc) return 1;
+
+    if (o.thread_sweep.empty()) {
+        RunResult result;
+        const int status = run(o, rc, result);
+        if (rc) redisFree(rc);
+        return status;
+    }
+
+    // One run per thread count, each from the same starting state when --clean-start is given
+    std::vector<std::pair<int, RunResult>> runs;
+    for (int threads : o.thread_sweep) {
+        SimOptions so = o;
+        so.threads = threads;
+        std::cout << "=== threads=" << threads << (o.share_cache ? " (shared cache)" : "") << std::endl;
+        RunResult result;
+        if (run(so, rc, result) != 0 || !rc) {
+            if (rc) redisFree(rc);
+            return 1;
+        }
+        runs.emplace_back(threads, std::move(result));
     }
+    print_scaling(std::cout, o.duration, runs);
 
     redisFree(rc);
     return 0;
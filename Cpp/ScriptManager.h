@@ -8,6 +8,9 @@
 // ---------- ScriptManager.h ----------
 
 #include <hiredis/hiredis.h>
+#include "CacheMetrics.h"
+#include "CacheTrace.h"
+
 #include <string>
 #include <unordered_map>
 #include <memory>
@@ -24,38 +27,65 @@ public:
     // Register a script body and load it immediately; returns the SHA1.
     const std::string& register_and_load(const std::string& name, const std::string& body) {
         auto sha = script_load(body);
-        entries_[name] = {body, sha};
+        entries_[name] = {body, sha, metrics_ ? &metrics_->script(name) : nullptr, "script:" + name};
         return entries_[name].sha;
     }
 
+    // Count and time every call of each script in 'm' (null == stop): latency, errors and
+    // NOSCRIPT reloads. 'm' must outlive this object.
+    void set_metrics(CacheMetrics* m) {
+        metrics_ = m;
+        for (auto& kv : entries_) kv.second.calls = m ? &m->script(kv.first) : nullptr;
+    }
+
+    // Write a span for every call to 't' (null == stop); 't' must outlive this object.
+    void set_tracer(TraceWriter* t) { tracer_ = t; }
+
     // Return the current SHA for a known script name
     const std::string& sha(const std::string& name) const {
         return entries_.at(name).sha;
     }
 
     // EVALSHA returning long long; auto-recovers on NOSCRIPT by reloading the script and retrying once.
+    // 'nkeys' must be keys.size(); otherwise Redis would shift the extra keys into ARGV.
     long long evalsha_ll(const std::string& name,
                          int nkeys, const std::vector<std::string>& keys,
                          const std::vector<std::string>& argv) {
         auto it = entries_.find(name);
         if (it == entries_.end()) throw std::runtime_error("Unknown script: " + name);
+        if (nkeys != (int)keys.size())
+            throw std::invalid_argument("Script " + name + " called with " + std::to_string(keys.size())
+                                        + " keys but nkeys " + std::to_string(nkeys));
+        auto* calls = it->second.calls;
+        ScopedLatency timer(calls);
+        TraceSpan span(tracer_, it->second.span.c_str());
 
         try {
-            return evalsha_ll_raw(it->second.sha, nkeys, keys, argv);
-        } catch (const std::runtime_error& e) {
-            std::string msg = e.what();
-            if (msg.find("NOSCRIPT") != std::string::npos) {
-                // Reload & retry once
-                it->second.sha = script_load(it->second.body);
+            try {
                 return evalsha_ll_raw(it->second.sha, nkeys, keys, argv);
+            } catch (const std::runtime_error& e) {
+                std::string msg = e.what();
+                if (msg.find("NOSCRIPT") != std::string::npos) {
+                    // Reload & retry once
+                    if (calls) calls->reloads.fetch_add(1, std::memory_order_relaxed);
+                    span.arg("reload", "NOSCRIPT");
+                    it->second.sha = script_load(it->second.body);
+                    return evalsha_ll_raw(it->second.sha, nkeys, keys, argv);
+                }
+                throw;
             }
+        } catch (const std::exception& e) {
+            if (calls) calls->errors.fetch_add(1, std::memory_order_relaxed);
+            span.arg("error", e.what());
             throw;
         }
     }
 
 private:
-    struct Entry { std::string body; std::string sha; };
+    struct Entry { std::string body; std::string sha; CacheMetrics::Calls* calls; std::string span; };
     redisContext* rc_;
+    CacheMetrics* metrics_ = nullptr;
+    TraceWriter* tracer_ = nullptr;
     std::unordered_map<std::string, Entry> entries_;
 
     static void reply_guard(redisReply* r) {
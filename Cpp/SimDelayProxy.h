@@ -0,0 +1,317 @@
+//
+// A TCP proxy that delays the traffic through it, so that processes on one
+// host see the network latency of a remote Redis. Used by the simulator's
+// multi-node emulation (--nodes).
+//
+
+#ifndef POC_CACHE_HIREDIS_SIMDELAYPROXY_H
+#define POC_CACHE_HIREDIS_SIMDELAYPROXY_H
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/**
+ * Listens on an ephemeral 127.0.0.1 port and relays each connection to
+ * 'upstream_host':'upstream_port' (a Unix socket if the host starts with
+ * '/', as with redis_connect()). Data is held for 'delay_ms' plus a uniform
+ * [-jitter_ms, +jitter_ms] in each direction, so a request/reply round trip
+ * takes about twice the delay. A chunk is never delivered before the one
+ * read ahead of it, since TCP does not reorder, so jitter that would
+ * reorder becomes queueing instead.
+ *
+ * The constructor binds the port and start() begins accepting; connections
+ * made in between wait in the listen backlog. That lets a process fork
+ * children that connect to port() before it starts the proxy's threads.
+ * Each connection runs four threads (a reader and a writer per direction),
+ * which is fine for the tens of connections of a simulator node. Once all
+ * four have ended, the accept loop joins them and closes the sockets, so
+ * clients that reconnect do not pile up threads and descriptors.
+ */
+class DelayProxy {
+public:
+    struct Stats {
+        uint64_t connections = 0;
+        uint64_t open = 0;          /// Connections not yet reaped
+        uint64_t bytes_up = 0;      /// Client to upstream
+        uint64_t bytes_down = 0;    /// Upstream to client
+    };
+
+    DelayProxy(const std::string& upstream_host, int upstream_port, double delay_ms, double jitter_ms,
+               uint64_t seed = 1)
+    : host_(upstream_host), port_(upstream_port), delay_ms_(std::max(delay_ms, 0.0)),
+      jitter_ms_(std::max(jitter_ms, 0.0)), seed_(seed)
+    {
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) throw std::system_error(errno, std::generic_category(), "proxy socket");
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listen_fd_, 128) < 0
+            || ::getsockname(listen_fd_, (sockaddr*)&addr, &len) < 0) {
+            const int e = errno;
+            ::close(listen_fd_);
+            throw std::system_error(e, std::generic_category(), "proxy listen");
+        }
+        listen_port_ = ntohs(addr.sin_port);
+    }
+
+    ~DelayProxy() {
+        stop();
+        ::close(listen_fd_);
+    }
+
+    DelayProxy(const DelayProxy&) = delete;
+    DelayProxy& operator=(const DelayProxy&) = delete;
+
+    /// The port clients connect to, on 127.0.0.1.
+    int port() const { return listen_port_; }
+
+    void start() {
+        if (!accept_thread_.joinable()) accept_thread_ = std::thread([this] { accept_loop(); });
+    }
+
+    /// Close every connection and stop accepting; data still held is dropped.
+    void stop() {
+        if (stopping_.exchange(true)) return;
+        if (accept_thread_.joinable()) accept_thread_.join();
+        std::lock_guard<std::mutex> g(mtx_);
+        reap();
+        for (auto& c : conns_) c->close();
+        for (auto& c : conns_) c->join();
+        conns_.clear();
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.connections = connections_.load();
+        s.bytes_up = bytes_up_.load();
+        s.bytes_down = bytes_down_.load();
+        std::lock_guard<std::mutex> g(mtx_);
+        s.open = conns_.size();
+        return s;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // One direction of a connection: 'reader' reads 'from' into the queue, 'writer' sends it to 'to' when due.
+    struct Pipe {
+        int from, to;
+        std::atomic<uint64_t>& bytes;
+        std::mt19937_64 gen;
+        std::mutex mtx;     /// Guards queue, eof and closed
+        std::condition_variable cv;
+        std::deque<std::pair<Clock::time_point, std::string>> queue;
+        Clock::time_point last{};
+        bool eof = false;
+        bool closed = false;
+        std::thread reader, writer;
+
+        Pipe(int from, int to, std::atomic<uint64_t>& bytes, uint64_t seed)
+        : from(from), to(to), bytes(bytes), gen(seed) {}
+    };
+
+    struct Connection {
+        int client, upstream;
+        std::unique_ptr<Pipe> up, down;
+        std::atomic<int> done{0};   /// Of the four threads, those that have ended
+
+        Connection(int client, int upstream) : client(client), upstream(upstream) {}
+        ~Connection() {
+            ::close(client);
+            ::close(upstream);
+        }
+
+        void close() {
+            for (Pipe* p : {up.get(), down.get()}) {
+                std::lock_guard<std::mutex> g(p->mtx);
+                p->closed = true;
+                p->cv.notify_all();
+            }
+            ::shutdown(client, SHUT_RDWR);
+            ::shutdown(upstream, SHUT_RDWR);
+        }
+
+        void join() {
+            for (Pipe* p : {up.get(), down.get()}) {
+                if (p->reader.joinable()) p->reader.join();
+                if (p->writer.joinable()) p->writer.join();
+            }
+        }
+    };
+
+    std::string host_;
+    int port_;
+    double delay_ms_;
+    double jitter_ms_;
+    uint64_t seed_;
+    int listen_fd_ = -1;
+    int listen_port_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::thread accept_thread_;
+    mutable std::mutex mtx_;    /// Guards conns_
+    std::vector<std::unique_ptr<Connection>> conns_;
+    std::atomic<uint64_t> connections_{0};
+    std::atomic<uint64_t> bytes_up_{0};
+    std::atomic<uint64_t> bytes_down_{0};
+
+    int connect_upstream() const {
+        if (!host_.empty() && host_[0] == '/') {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, host_.c_str(), sizeof(addr.sun_path) - 1);
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && ::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if (::getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &res) != 0) return -1;
+        int fd = -1;
+        for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(res);
+        if (fd >= 0) no_delay(fd);
+        return fd;
+    }
+
+    // Small writes (one Redis command) must not wait for Nagle on top of the injected delay.
+    static void no_delay(int fd) {
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // Join and drop the connections whose threads have all ended. Caller holds mtx_.
+    void reap() {
+        for (auto it = conns_.begin(); it != conns_.end(); ) {
+            if ((*it)->done == 4) {
+                (*it)->join();
+                it = conns_.erase(it);
+            }
+            else ++it;
+        }
+    }
+
+    void accept_loop() {
+        while (!stopping_) {
+            {
+                std::lock_guard<std::mutex> g(mtx_);
+                reap();
+            }
+            pollfd p{listen_fd_, POLLIN, 0};
+            if (::poll(&p, 1, 100) <= 0) continue;
+            const int client = ::accept(listen_fd_, nullptr, nullptr);
+            if (client < 0) continue;
+            const int upstream = connect_upstream();
+            if (upstream < 0) {
+                ::close(client);    // the client sees the connection close, as if Redis were down
+                continue;
+            }
+            no_delay(client);
+
+            const uint64_t n = ++connections_;
+            std::unique_ptr<Connection> c(new Connection(client, upstream));
+            c->up.reset(new Pipe(client, upstream, bytes_up_, seed_ ^ (2 * n)));
+            c->down.reset(new Pipe(upstream, client, bytes_down_, seed_ ^ (2 * n + 1)));
+            Connection* conn = c.get();
+            for (Pipe* p : {c->up.get(), c->down.get()}) {
+                p->reader = std::thread([this, p, conn] { read_loop(*p); ++conn->done; });
+                p->writer = std::thread([this, p, conn] { write_loop(*p); ++conn->done; });
+            }
+            std::lock_guard<std::mutex> g(mtx_);
+            conns_.push_back(std::move(c));
+        }
+    }
+
+    Clock::duration sample_delay(Pipe& p) const {
+        double ms = delay_ms_;
+        if (jitter_ms_ > 0) ms += std::uniform_real_distribution<double>(-jitter_ms_, jitter_ms_)(p.gen);
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(std::max(ms, 0.0)));
+    }
+
+    void read_loop(Pipe& p) {
+        char buf[64 * 1024];
+        for (;;) {
+            const ssize_t n = ::read(p.from, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            std::lock_guard<std::mutex> g(p.mtx);
+            if (n <= 0) {
+                p.eof = true;
+                p.cv.notify_all();
+                return;
+            }
+            p.last = std::max(Clock::now() + sample_delay(p), p.last);
+            p.queue.emplace_back(p.last, std::string(buf, (size_t)n));
+            p.cv.notify_all();
+        }
+    }
+
+    void write_loop(Pipe& p) {
+        std::unique_lock<std::mutex> lk(p.mtx);
+        for (;;) {
+            p.cv.wait(lk, [&p] { return p.closed || p.eof || !p.queue.empty(); });
+            if (p.closed) return;
+            if (p.queue.empty()) break;     // eof, and everything before it was sent
+            if (p.cv.wait_until(lk, p.queue.front().first, [&p] { return p.closed; })) return;
+
+            const std::string data = std::move(p.queue.front().second);
+            p.queue.pop_front();
+            lk.unlock();
+            const bool ok = send_all(p.to, data);
+            lk.lock();
+            if (!ok) {
+                ::shutdown(p.from, SHUT_RD);    // the reader stops; the peer sees its connection close
+                return;
+            }
+            p.bytes += data.size();
+        }
+        ::shutdown(p.to, SHUT_WR);
+    }
+
+    static bool send_all(int fd, const std::string& data) {
+        size_t off = 0;
+        while (off < data.size()) {
+            const ssize_t n = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += (size_t)n;
+        }
+        return true;
+    }
+};
+
+#endif //POC_CACHE_HIREDIS_SIMDELAYPROXY_H
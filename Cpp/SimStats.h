@@ -0,0 +1,103 @@
+//
+// Result aggregation for RedisFileCacheLRU_Simulator: a worker's per-thread
+// request counts and the --thread-sweep scaling table.
+//
+
+#ifndef POC_CACHE_HIREDIS_SIMSTATS_H
+#define POC_CACHE_HIREDIS_SIMSTATS_H
+
+#include "CacheMetrics.h"
+#include "SimWorkload.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// One worker thread's request counts.
+struct WorkerCounts {
+    long it=0, ro=0, rb=0, rm=0, rbytes=0;
+    long wo=0, wb=0, we=0, wbytes=0, other=0;
+    HitStats hits;
+
+    void add(const WorkerCounts& c) {
+        it += c.it; ro += c.ro; rb += c.rb; rm += c.rm; rbytes += c.rbytes;
+        wo += c.wo; wb += c.wb; we += c.we; wbytes += c.wbytes; other += c.other;
+        hits.hits += c.hits.hits; hits.misses += c.hits.misses;
+        hits.hit_bytes += c.hits.hit_bytes; hits.miss_bytes += c.hits.miss_bytes;
+    }
+
+    void print(std::ostream& out, const std::string& who) const {
+        out << who
+            << " it=" << it
+            << " R(ok/busy/miss)=" << ro << "/" << rb << "/" << rm
+            << " Rbytes=" << rbytes
+            << " W(ok/busy/exist)=" << wo << "/" << wb << "/" << we
+            << " Wbytes=" << wbytes
+            << " other=" << other
+            << " hit_ratio=" << hits.hit_ratio()
+            << " byte_hit_ratio=" << hits.byte_hit_ratio()
+            << std::endl;
+    }
+};
+
+/**
+ * A worker's totals: the sum of its threads' counts. Prints a line per
+ * thread (when there is more than one) and then the totals, labelled 'who'.
+ */
+inline WorkerCounts sum_thread_counts(const std::vector<WorkerCounts>& counts, const std::string& who,
+                                      std::ostream& out) {
+    WorkerCounts total;
+    for (size_t t = 0; t < counts.size(); ++t) {
+        if (counts.size() > 1) counts[t].print(out, who + " thread=" + std::to_string(t));
+        total.add(counts[t]);
+    }
+    total.print(out, who);
+    return total;
+}
+
+using LatencyMap = std::map<std::string, LatencyHistogram::Snapshot>;   // "<op> <kind>"
+
+/// What the parent collects from one run.
+struct RunResult {
+    HitStats hits;
+    LatencyMap latencies;
+};
+
+/**
+ * The --thread-sweep table: for each (threads, result) run of 'duration_s'
+ * seconds, throughput, its speedup over the first run, request latency and
+ * hit ratio. Throughput counts the "<op> latency" entries, i.e. requests.
+ */
+inline void print_scaling(std::ostream& out, int duration_s, const std::vector<std::pair<int, RunResult>>& runs) {
+    auto ops_s = [duration_s](const RunResult& r) {
+        long long n = 0;
+        for (const auto& kv : r.latencies)
+            if (kv.first.find(" latency") != std::string::npos) n += (long long)kv.second.count;
+        return (double)n / std::max(duration_s, 1);
+    };
+    auto pct = [](const RunResult& r, const std::string& what, double p) {
+        const auto it = r.latencies.find(what);
+        return it == r.latencies.end() ? 0ULL : (unsigned long long)it->second.percentile(p);
+    };
+
+    const double base = runs.empty() ? 0.0 : ops_s(runs.front().second);
+    out << "\nthreads  ops_s  speedup  read_p50  read_p99  write_p50  write_p99  hit_ratio\n";
+    for (const auto& run : runs) {
+        const RunResult& r = run.second;
+        const double ops = ops_s(r);
+        char line[160];
+        std::snprintf(line, sizeof(line), "%7d %6.0f %8.2f %9llu %9llu %10llu %10llu %10.3f\n",
+                      run.first, ops, base > 0 ? ops / base : 0.0,
+                      pct(r, "read latency", 0.5), pct(r, "read latency", 0.99),
+                      pct(r, "write latency", 0.5), pct(r, "write latency", 0.99),
+                      r.hits.hit_ratio());
+        out << line;
+    }
+    out.flush();
+}
+
+#endif //POC_CACHE_HIREDIS_SIMSTATS_H
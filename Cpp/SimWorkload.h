@@ -0,0 +1,244 @@
+//
+// Request generators for RedisFileCacheLRU_Simulator: key popularity, object
+// sizes, scans and trace replay, and the hit ratios they produce.
+//
+
+#ifndef POC_CACHE_HIREDIS_SIMWORKLOAD_H
+#define POC_CACHE_HIREDIS_SIMWORKLOAD_H
+
+#include "KeyHash.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * Zipf-distributed ranks in [0, n): rank k is drawn with probability
+ * proportional to 1 / (k + 1)^s. s = 0 is uniform; s near 1 is typical of
+ * web and object caches. Sampling is a binary search of the precomputed CDF
+ * (8 bytes per rank), which is exact for every s >= 0.
+ */
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t n, double s) : cdf_(std::max<size_t>(n, 1)) {
+        if (s < 0) throw std::invalid_argument("Zipf skew must be >= 0");
+        double sum = 0;
+        for (size_t k = 0; k < cdf_.size(); ++k) cdf_[k] = (sum += std::pow((double)(k + 1), -s));
+        for (auto& c : cdf_) c /= sum;
+        cdf_.back() = 1.0;
+    }
+
+    size_t operator()(std::mt19937_64& gen) const {
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+        return (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+    }
+
+    size_t size() const { return cdf_.size(); }
+
+    /// Probability of rank k.
+    double p(size_t k) const { return k == 0 ? cdf_[0] : cdf_[k] - cdf_[k - 1]; }
+
+private:
+    std::vector<double> cdf_;
+};
+
+/**
+ * Object sizes, in bytes, clamped to [min, max].
+ *
+ * uniform: between min and max.
+ * lognormal: median 'median', shape 'sigma' (the standard deviation of ln size).
+ * pareto: scale 'min', shape 'alpha'; alpha <= 1 has no finite mean, so most
+ * bytes are in a few huge objects. 'max' bounds the tail.
+ */
+struct SizeDistribution {
+    enum Kind { uniform, lognormal, pareto };
+
+    Kind kind = uniform;
+    size_t min = 200;
+    size_t max = 4000;
+    double median = 2048;
+    double sigma = 1.0;
+    double alpha = 1.2;
+
+    static Kind parse(const std::string& s) {
+        if (s == "uniform") return uniform;
+        if (s == "lognormal") return lognormal;
+        if (s == "pareto") return pareto;
+        throw std::invalid_argument("unknown size distribution: " + s);
+    }
+
+    size_t operator()(std::mt19937_64& gen) const {
+        double v = 0;
+        switch (kind) {
+            case uniform:
+                return std::uniform_int_distribution<size_t>(min, std::max(min, max))(gen);
+            case lognormal:
+                v = std::lognormal_distribution<double>(std::log(median), sigma)(gen);
+                break;
+            case pareto: {
+                // Inverse CDF: x_m / U^(1/alpha), with U in (0, 1]
+                const double u = 1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+                v = (double)min / std::pow(u, 1.0 / alpha);
+                break;
+            }
+        }
+        return (size_t)std::min<double>(std::max<double>(v, (double)min), (double)max);
+    }
+
+    /// The size of the object named 'key': drawn once per key, the same in every worker.
+    size_t for_key(const std::string& key, uint64_t seed) const {
+        std::mt19937_64 gen(fnv1a_64(key) ^ seed);
+        return (*this)(gen);
+    }
+};
+
+/// One request of a recorded access trace; size < 0 means the trace did not record one.
+struct TraceRecord {
+    std::string key;
+    long long size = -1;
+};
+
+/**
+ * Read an access trace: one request per line, '<key>' or '<key> <size>',
+ * with the fields separated by a comma, tab or spaces. Blank lines, lines
+ * that start with '#' and a 'key,...' CSV header are skipped; fields after
+ * the size are ignored, so a log with more columns can be cut down with
+ * 'cut' or 'awk' to the key and size.
+ */
+inline std::vector<TraceRecord> load_trace(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::system_error(errno, std::generic_category(), "trace " + path);
+
+    std::vector<TraceRecord> trace;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        TraceRecord r;
+        if (!(fields >> r.key) || r.key[0] == '#' || (trace.empty() && r.key == "key")) continue;
+        std::string size;
+        if (fields >> size) {
+            try { r.size = std::stoll(size); }
+            catch (const std::exception&) { throw std::runtime_error("trace " + path + ": bad size in: " + line); }
+        }
+        trace.push_back(std::move(r));
+    }
+    return trace;
+}
+
+/**
+ * Request counts for a read-through cache: a request is a hit if the read
+ * found the entry, and a miss (after which the entry is written) if not.
+ * Reads that were busy are retried or dropped by the caller and are not
+ * requests here.
+ */
+struct HitStats {
+    long long hits = 0;
+    long long misses = 0;
+    long long hit_bytes = 0;    /// Bytes of the objects that were hits
+    long long miss_bytes = 0;   /// Bytes of the objects that were misses
+
+    void hit(long long bytes) { ++hits; hit_bytes += bytes; }
+    void miss(long long bytes) { ++misses; miss_bytes += bytes; }
+
+    double hit_ratio() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+    double byte_hit_ratio() const {
+        return hit_bytes + miss_bytes ? (double)hit_bytes / (double)(hit_bytes + miss_bytes) : 0.0;
+    }
+};
+
+/**
+ * The request stream of one worker in the 'zipf', 'scan' and 'trace'
+ * workloads ('uniform' is the simulator's own random reads and writes).
+ * Objects are named 'obj-<n>.bin', n in [0, keys), and rank 0 is the most
+ * popular; a trace names its own objects.
+ *
+ * zipf: Zipf(keys, skew) popularity; with 'scan_prob' > 0, each request
+ * starts a scan of 'scan_length' keys instead with that probability.
+ * scan: back-to-back scans of 'scan_length' consecutive keys, each from a
+ * random key, the pattern that flushes an LRU cache.
+ * trace: the trace from the worker's own starting offset, looping, so that
+ * workers replay it out of step.
+ */
+class Workload {
+public:
+    enum Kind { uniform, zipf, scan, trace };
+
+    struct Request {
+        std::string key;
+        size_t size;
+    };
+
+    static Kind parse(const std::string& s) {
+        if (s == "uniform") return uniform;
+        if (s == "zipf") return zipf;
+        if (s == "scan") return scan;
+        if (s == "trace") return trace;
+        throw std::invalid_argument("unknown workload: " + s);
+    }
+
+    /// 'worker' of 'workers' picks this worker's trace offset.
+    Workload(Kind kind, size_t keys, double skew, double scan_prob, size_t scan_length,
+             const SizeDistribution& sizes, uint64_t seed,
+             std::vector<TraceRecord> records = {}, int worker = 0, int workers = 1)
+    : kind_(kind), keys_(std::max<size_t>(keys, 1)), scan_prob_(scan_prob),
+      scan_length_(std::max<size_t>(scan_length, 1)), sizes_(sizes), seed_(seed),
+      trace_(std::move(records))
+    {
+        if (kind_ == uniform) throw std::invalid_argument("the uniform workload has no request stream");
+        if (kind_ == zipf) zipf_.reset(new ZipfDistribution(keys_, skew));
+        if (kind_ == trace) {
+            if (trace_.empty()) throw std::invalid_argument("empty trace");
+            next_ = trace_.size() * (size_t)worker / (size_t)std::max(workers, 1);
+        }
+    }
+
+    Request next(std::mt19937_64& gen) {
+        if (kind_ == trace) {
+            const TraceRecord& r = trace_[next_];
+            next_ = (next_ + 1) % trace_.size();
+            return {r.key, r.size >= 0 ? (size_t)r.size : sizes_.for_key(r.key, seed_)};
+        }
+
+        if (scan_left_ == 0 && (kind_ == scan || (scan_prob_ > 0 && u01_(gen) < scan_prob_))) {
+            scan_left_ = scan_length_;
+            next_ = std::uniform_int_distribution<size_t>(0, keys_ - 1)(gen);
+        }
+        size_t n;
+        if (scan_left_ > 0) {
+            --scan_left_;
+            n = next_;
+            next_ = (next_ + 1) % keys_;
+        }
+        else n = (*zipf_)(gen);
+
+        std::string key = "obj-" + std::to_string(n) + ".bin";
+        const size_t size = sizes_.for_key(key, seed_);
+        return {std::move(key), size};
+    }
+
+private:
+    Kind kind_;
+    size_t keys_;
+    double scan_prob_;
+    size_t scan_length_;
+    SizeDistribution sizes_;
+    uint64_t seed_;
+    std::vector<TraceRecord> trace_;
+    std::unique_ptr<ZipfDistribution> zipf_;
+    std::uniform_real_distribution<double> u01_{0.0, 1.0};
+    size_t next_ = 0;       /// Next key of a scan, or next trace record
+    size_t scan_left_ = 0;  /// Keys left in the current scan
+};
+
+#endif //POC_CACHE_HIREDIS_SIMWORKLOAD_H
@@ -0,0 +1,258 @@
+//
+// Microbenchmarks (Google Benchmark) for the cache hot paths. The program
+// starts its own redis-server on a Unix socket and puts the caches on tmpfs,
+// so the numbers are the cache's own work and its Redis round trips, not a
+// disk or a network.
+//
+// cmake -DBUILD_BENCHMARKS=ON .. && make BenchRedisFileCacheLRU
+// ./benchmarks/BenchRedisFileCacheLRU --benchmark_out=bench.json --benchmark_out_format=json
+//
+// Set BENCH_REDIS_SERVER to the redis-server to run if it is not on PATH.
+//
+
+#include "RedisFileCacheLRU.h"
+#include "CacheMetrics.h"
+
+#include <benchmark/benchmark.h>
+#include <hiredis/hiredis.h>
+
+#include <ftw.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string g_dir;      // scratch directory: the Redis socket and one cache directory per namespace
+std::string g_socket;   // g_dir/redis.sock
+pid_t g_redis = -1;     // the redis-server this program started
+
+std::atomic<long> g_key_serial{0};
+
+int rm_entry(const char* path, const struct stat*, int, struct FTW*) { return ::remove(path); }
+
+void remove_tree(const std::string& dir) { ::nftw(dir.c_str(), rm_entry, 16, FTW_DEPTH | FTW_PHYS); }
+
+// On tmpfs when there is one, so file I/O is only memory copies.
+std::string make_scratch_dir() {
+    for (const char* base : {"/dev/shm", "/tmp"}) {
+        std::string tmpl = std::string(base) + "/poc-bench-XXXXXX";
+        if (::mkdtemp(&tmpl[0])) return tmpl;
+    }
+    throw std::system_error(errno, std::generic_category(), "mkdtemp");
+}
+
+// redis-server with no TCP port and no persistence, listening on g_socket.
+void start_redis() {
+    const char* server = std::getenv("BENCH_REDIS_SERVER");
+    if (!server) server = "redis-server";
+
+    g_redis = ::fork();
+    if (g_redis < 0) throw std::system_error(errno, std::generic_category(), "fork");
+    if (g_redis == 0) {
+        ::execlp(server, server, "--port", "0", "--unixsocket", g_socket.c_str(), "--unixsocketperm", "700",
+                 "--save", "", "--appendonly", "no", "--loglevel", "warning", (char*)nullptr);
+        std::perror(server);
+        ::_exit(127);
+    }
+
+    // Wait for the socket to accept connections
+    for (int i = 0; i < 500; ++i) {
+        if (redisContext* c = redisConnectUnix(g_socket.c_str())) {
+            const bool up = !c->err;
+            redisFree(c);
+            if (up) return;
+        }
+        if (::waitpid(g_redis, nullptr, WNOHANG) == g_redis) {
+            g_redis = -1;
+            throw std::runtime_error(std::string(server) + " exited at startup");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    throw std::runtime_error(std::string(server) + " did not open " + g_socket);
+}
+
+void stop_redis() {
+    if (g_redis <= 0) return;
+    ::kill(g_redis, SIGTERM);
+    ::waitpid(g_redis, nullptr, 0);
+    g_redis = -1;
+}
+
+std::string next_key() { return "k" + std::to_string(g_key_serial.fetch_add(1)); }
+
+// Threads of one run share this; repetitions of a run reuse it, with new keys.
+std::string ns_for(const char* bench, const benchmark::State& state, int args = 1) {
+    std::string ns = std::string("bench-") + bench;
+    for (int i = 0; i < args; ++i) ns += "-" + std::to_string(state.range(i));
+    return ns + "-t" + std::to_string(state.threads());
+}
+
+// Entries per thread: enough to spread the keys, capped at 16 MB.
+size_t entries_for(size_t size) { return std::max<size_t>(4, std::min<size_t>(64, (16u << 20) / size)); }
+
+/// Empty a namespace behind its caches' backs: the files and the index keys that grow with the entries.
+void drop_namespace(const std::string& ns, const std::string& dir) {
+    remove_tree(dir);
+    ::mkdir(dir.c_str(), 0755);
+    if (redisContext* c = redisConnectUnix(g_socket.c_str())) {
+        const std::string keys[] = {ns + ":idx:meta", ns + ":idx:lru", ns + ":idx:atime", ns + ":idx:total", ns + ":events"};
+        for (const auto& k : keys)
+            if (auto* r = static_cast<redisReply*>(redisCommand(c, "DEL %s", k.c_str()))) freeReplyObject(r);
+        redisFree(c);
+    }
+}
+
+/**
+ * Throughput, and from the cache's metrics each Lua script's mean time
+ * ('<script>_us') and calls per operation ('<script>_calls'). The scripts
+ * are timed where the hot paths call them, so a change to one shows up as a
+ * change to its own counter in the JSON results.
+ */
+void finish(benchmark::State& state, const RedisFileCache& cache, size_t size) {
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t)size);
+
+    const auto s = cache.metrics().snapshot();
+    const double ops = state.iterations() ? (double)state.iterations() : 1.0;
+    for (const auto& kv : s.scripts) {
+        if (!kv.second.latency.count) continue;
+        state.counters[kv.first + "_us"] = benchmark::Counter(kv.second.latency.mean_us(), benchmark::Counter::kAvgThreads);
+        state.counters[kv.first + "_calls"] = benchmark::Counter((double)kv.second.latency.count / ops, benchmark::Counter::kAvgThreads);
+    }
+}
+
+// Reads of state.range(0) bytes with ReadMode state.range(1). Each thread reads its own entries; all share a namespace.
+void BM_Read(benchmark::State& state) {
+    const size_t size = (size_t)state.range(0);
+    const std::string ns = ns_for("read", state, 2);
+    const std::string dir = g_dir + "/" + ns;
+    RedisFileCache cache(dir, g_socket, 0, 0, 60000, ns);
+    cache.set_read_mode((ReadMode)state.range(1));
+
+    const std::string data(size, 'r');
+    std::vector<std::string> keys(entries_for(size));
+    for (auto& k : keys) {
+        k = next_key();
+        cache.write_bytes_create(k, data);
+    }
+    cache.metrics().reset();
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.read_bytes(keys[i++ % keys.size()]));
+    }
+
+    finish(state, cache, size);
+    if (state.thread_index() == 0) remove_tree(dir);
+}
+BENCHMARK(BM_Read)
+    ->ArgsProduct({benchmark::CreateRange(1 << 10, 1 << 20, 8), {(int)ReadMode::locked, (int)ReadMode::optimistic, (int)ReadMode::open_fd}})
+    ->ArgNames({"bytes", "mode"})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+// Create-only writes of state.range(0) bytes: lock, temp file, fsync, rename and the publish script.
+// Each thread has its own namespace, emptied (untimed) every few entries to bound tmpfs use.
+void BM_Write(benchmark::State& state) {
+    const size_t size = (size_t)state.range(0);
+    const std::string ns = ns_for("write", state) + "-" + std::to_string(state.thread_index());
+    const std::string dir = g_dir + "/" + ns;
+    RedisFileCache cache(dir, g_socket, 0, 0, 60000, ns);
+
+    const std::string data(size, 'w');
+    const size_t batch = 4 * entries_for(size);
+    size_t n = 0;
+    for (auto _ : state) {
+        cache.write_bytes_create(next_key(), data);
+        if (++n % batch == 0) {
+            state.PauseTiming();
+            drop_namespace(ns, dir);
+            state.ResumeTiming();
+        }
+    }
+
+    finish(state, cache, size);
+    remove_tree(dir);
+}
+BENCHMARK(BM_Write)
+    ->RangeMultiplier(8)->Range(1 << 10, 1 << 20)
+    ->ArgName("bytes")
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+/**
+ * Writes into a full cache, so that each one runs ensure_capacity() and
+ * evicts about one entry (purge factor 0). All threads share the namespace,
+ * and so the purge mutex. 'evict_us' is the mean time of one eviction and
+ * 'evictions' the evictions per write.
+ */
+void BM_EnsureCapacity(benchmark::State& state) {
+    const size_t size = (size_t)state.range(0);
+    const std::string ns = ns_for("capacity", state);
+    const std::string dir = g_dir + "/" + ns;
+    const size_t n = entries_for(size);
+    RedisFileCache cache(dir, g_socket, 0, 0, 60000, ns, (long long)(n * size * (size_t)state.threads()));
+    cache.set_purge_factor(0.0);
+
+    const std::string data(size, 'c');
+    for (size_t i = 0; i < n; ++i) cache.write_bytes_create(next_key(), data);
+    cache.metrics().reset();
+
+    for (auto _ : state) {
+        cache.write_bytes_create(next_key(), data);
+    }
+
+    finish(state, cache, size);
+    auto s = cache.metrics().snapshot();
+    state.counters["evict_us"] = benchmark::Counter(s.ops["evict"].mean_us(), benchmark::Counter::kAvgThreads);
+    state.counters["evictions"] = benchmark::Counter(
+        (double)s.counters["evictions"] / (double)std::max<int64_t>(1, state.iterations()), benchmark::Counter::kAvgThreads);
+    if (state.thread_index() == 0) remove_tree(dir);
+}
+BENCHMARK(BM_EnsureCapacity)
+    ->RangeMultiplier(8)->Range(1 << 10, 1 << 20)
+    ->ArgName("bytes")
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    try {
+        g_dir = make_scratch_dir();
+        g_socket = g_dir + "/redis.sock";
+        start_redis();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "BenchRedisFileCacheLRU: " << e.what() << "\n";
+        stop_redis();
+        if (!g_dir.empty()) remove_tree(g_dir);
+        return 1;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    stop_redis();
+    remove_tree(g_dir);
+    return 0;
+}
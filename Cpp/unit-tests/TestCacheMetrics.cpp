@@ -0,0 +1,165 @@
+//
+// CppUnit tests for CacheMetrics and LatencyHistogram. No Redis needed.
+//
+
+#include "CacheMetrics.h"
+#include "run_tests_cppunit.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+class CacheMetricsTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(CacheMetricsTest);
+        CPPUNIT_TEST(test_bucket_bounds);
+        CPPUNIT_TEST(test_percentiles);
+        CPPUNIT_TEST(test_snapshot_add);
+        CPPUNIT_TEST(test_concurrent_record);
+        CPPUNIT_TEST(test_counters_and_reset);
+        CPPUNIT_TEST(test_redis_time_by_op);
+        CPPUNIT_TEST(test_prometheus);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    // Every value lands in a bucket whose upper bound is >= the value and within 1/16 of it.
+    void test_bucket_bounds() {
+        for (uint64_t v : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 1000ULL, 123456ULL, 1ULL << 39}) {
+            const int i = LatencyHistogram::index(v);
+            CPPUNIT_ASSERT(i >= 0 && i < LatencyHistogram::bucket_count);
+            const uint64_t ub = LatencyHistogram::upper_bound(i);
+            CPPUNIT_ASSERT(ub >= v);
+            CPPUNIT_ASSERT(ub - v <= v / 16);
+            if (i > 0) CPPUNIT_ASSERT(LatencyHistogram::upper_bound(i - 1) < v);
+        }
+        CPPUNIT_ASSERT_EQUAL(LatencyHistogram::bucket_count - 1, LatencyHistogram::index(~0ULL));
+    }
+
+    void test_percentiles() {
+        LatencyHistogram h;
+        for (uint64_t v = 1; v <= 1000; ++v) h.record(v);
+        const auto s = h.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1000, s.count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1000, s.max_us);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(500.5, s.mean_us(), 1e-9);
+
+        const uint64_t p50 = s.percentile(0.5), p99 = s.percentile(0.99);
+        CPPUNIT_ASSERT(p50 >= 500 && p50 <= 500 + 500 / 16);
+        CPPUNIT_ASSERT(p99 >= 990 && p99 <= 990 + 990 / 16);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1000, s.percentile(1.0));
+
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, LatencyHistogram().snapshot().percentile(0.5));
+    }
+
+    // Merged snapshots give the percentiles of all the values recorded.
+    void test_snapshot_add() {
+        LatencyHistogram a, b;
+        for (uint64_t v = 1; v <= 500; ++v) a.record(v);
+        for (uint64_t v = 501; v <= 1000; ++v) b.record(v);
+        LatencyHistogram::Snapshot s;
+        s.add(a.snapshot());
+        s.add(b.snapshot());
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1000, s.count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1000, s.max_us);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(500.5, s.mean_us(), 1e-9);
+        const uint64_t p99 = s.percentile(0.99);
+        CPPUNIT_ASSERT(p99 >= 990 && p99 <= 990 + 990 / 16);
+    }
+
+    void test_concurrent_record() {
+        LatencyHistogram h;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t)
+            threads.emplace_back([&h, t] { for (int i = 0; i < 10000; ++i) h.record((uint64_t)(t * 100 + i % 100)); });
+        for (auto& th : threads) th.join();
+
+        const auto s = h.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)80000, s.count);
+        uint64_t total = 0;
+        for (auto b : s.buckets) total += b;
+        CPPUNIT_ASSERT_EQUAL(s.count, total);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)799, s.max_us);
+    }
+
+    void test_counters_and_reset() {
+        CacheMetrics m;
+        m.add(CacheMetrics::reads_ok);
+        m.add(CacheMetrics::bytes_read, 4096);
+        m.op(CacheMetrics::read).record(12);
+        m.script("acquire_read").record(7);
+        m.script("acquire_read").record(9);
+
+        auto s = m.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.counters["reads_ok"]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)4096, s.counters["bytes_read"]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.ops["read"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.ops["write"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)2, s.scripts["acquire_read"].latency.count);
+
+        m.reset();
+        s = m.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.counters["reads_ok"]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.ops["read"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.scripts["acquire_read"].latency.count);
+    }
+
+    // Redis calls are charged to the innermost OpContext, and the report ranks them by time.
+    void test_redis_time_by_op() {
+        CacheMetrics m;
+        m.command("TIME").record(5);    // outside any operation
+        {
+            CacheMetrics::OpContext read(CacheMetrics::read);
+            m.op(CacheMetrics::read).record(1000);
+            m.script("read_acq").record(300);
+            m.command("HSET").record(100);
+            {
+                CacheMetrics::OpContext evict(CacheMetrics::evict);
+                m.script("can_evict").record(50);
+            }
+            m.script("read_acq").record(500);
+        }
+        CPPUNIT_ASSERT_EQUAL((int)CacheMetrics::op_count, CacheMetrics::current_op());
+
+        auto s = m.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)800, s.scripts["read_acq"].us_by_op[CacheMetrics::read]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)2, s.scripts["read_acq"].calls_by_op[CacheMetrics::read]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)50, s.scripts["can_evict"].us_by_op[CacheMetrics::evict]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.scripts["can_evict"].us_by_op[CacheMetrics::read]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)5, s.commands["TIME"].us_by_op[CacheMetrics::op_count]);
+
+        const std::string report = m.redis_report();
+        const auto read_at = report.find("read: 1 ops");
+        const auto acq_at = report.find("script:read_acq");
+        const auto hset_at = report.find("cmd:HSET");
+        CPPUNIT_ASSERT(read_at != std::string::npos);
+        CPPUNIT_ASSERT(read_at < acq_at && acq_at < hset_at);
+        CPPUNIT_ASSERT(report.find(" 80.0%  script:read_acq") != std::string::npos);
+        CPPUNIT_ASSERT(report.find("evict: 0 ops") != std::string::npos);
+        CPPUNIT_ASSERT(report.find("other: ") != std::string::npos);
+    }
+
+    void test_prometheus() {
+        CacheMetrics m;
+        m.add(CacheMetrics::evictions, 3);
+        m.op(CacheMetrics::write).record(4);      // <= 4 us, on the bound
+        m.op(CacheMetrics::write).record(1000);   // <= 1024 us
+        { ScopedLatency t(m.script("evict_one")); }
+        m.script("evict_one").reloads.fetch_add(2);
+        m.command("ZRANGE").errors.fetch_add(1);
+
+        const std::string text = m.prometheus("t");
+        CPPUNIT_ASSERT(text.find("# TYPE t_evictions_total counter\nt_evictions_total 3\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("# TYPE t_op_duration_seconds histogram\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_op_duration_seconds_bucket{op=\"write\",le=\"2e-06\"} 0\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_op_duration_seconds_bucket{op=\"write\",le=\"4e-06\"} 1\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_op_duration_seconds_bucket{op=\"write\",le=\"0.001024\"} 2\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_op_duration_seconds_bucket{op=\"write\",le=\"+Inf\"} 2\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_op_duration_seconds_count{op=\"write\"} 2\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_script_duration_seconds_count{script=\"evict_one\"} 1\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_script_reloads_total{script=\"evict_one\"} 2\n") != std::string::npos);
+        CPPUNIT_ASSERT(text.find("t_redis_command_errors_total{command=\"ZRANGE\"} 1\n") != std::string::npos);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CacheMetricsTest);
+
+int main(int argc, char *argv[]) { return run_tests<CacheMetricsTest>(argc, argv) ? 0 : 1; }
@@ -0,0 +1,131 @@
+//
+// TestLeaseKeeper.cpp
+// CppUnit tests for LeaseKeeper (lock lease heartbeat).
+//
+
+#include "LeaseKeeper.h"
+#include "run_tests_cppunit.h"
+
+#include <hiredis/hiredis.h>
+
+#include <memory>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+
+namespace {
+struct RcCloser { void operator()(redisContext* c) const { if (c) redisFree(c); } };
+using RcPtr = std::unique_ptr<redisContext, RcCloser>;
+
+inline RcPtr rc_connect(const std::string& host, int port, int db) {
+    redisContext* rc = redisConnect(host.c_str(), port);
+    if (!rc || rc->err) {
+        if (rc) { fprintf(stderr, "redis err: %s\n", rc->errstr); redisFree(rc); }
+        return RcPtr(nullptr);
+    }
+    if (db != 0) {
+        if (auto* r = (redisReply*)redisCommand(rc, "SELECT %d", db)) freeReplyObject(r);
+    }
+    if (auto* r = (redisReply*)redisCommand(rc, "HELLO 2")) freeReplyObject(r); // prefer RESP2
+    return RcPtr(rc);
+}
+
+inline std::string rand_hex(int n=8) {
+    static thread_local std::mt19937_64 gen{std::random_device{}()};
+    static const char* hexd="0123456789abcdef";
+    std::uniform_int_distribution<int> d(0,15);
+    std::string s; s.reserve(n);
+    for (int i=0;i<n;++i) s.push_back(hexd[d(gen)]);
+    return s;
+}
+
+inline long long exists(RcPtr& rc, const std::string& key) {
+    long long n = -1;
+    if (auto* r = (redisReply*)redisCommand(rc.get(), "EXISTS %s", key.c_str())) {
+        if (r->type == REDIS_REPLY_INTEGER) n = r->integer;
+        freeReplyObject(r);
+    }
+    return n;
+}
+
+inline void del(RcPtr& rc, const std::string& key) {
+    if (auto* r = (redisReply*)redisCommand(rc.get(), "DEL %s", key.c_str())) freeReplyObject(r);
+}
+} // namespace
+
+class LeaseKeeperTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LeaseKeeperTest);
+        CPPUNIT_TEST(testWriteLeaseIsRenewed);
+        CPPUNIT_TEST(testReleasedLeaseExpires);
+        CPPUNIT_TEST(testReadLeaseIsRenewed);
+        CPPUNIT_TEST(testStolenLeaseIsLost);
+    CPPUNIT_TEST_SUITE_END();
+
+  public:
+    std::string host   = getenv("REDIS_HOST") ? getenv("REDIS_HOST") : std::string("127.0.0.1");
+    int         port   = getenv("REDIS_PORT") ? std::atoi(getenv("REDIS_PORT")) : 6379;
+    int         db     = getenv("REDIS_DB")   ? std::atoi(getenv("REDIS_DB"))   : 0;
+
+    RcPtr rc;
+    std::string key;
+
+    void setUp() override {
+        rc = rc_connect(host, port, db);
+        CPPUNIT_ASSERT(rc && "redis connect failed in LeaseKeeper tests");
+        key = "lk:test:" + rand_hex(6);
+    }
+    void tearDown() override {
+        if (rc) del(rc, key);
+        rc.reset();
+    }
+
+    void testWriteLeaseIsRenewed() {
+        LeaseKeeper lk(host, port, db, /*ttl_ms*/300);
+        if (auto* r = (redisReply*)redisCommand(rc.get(), "SET %s tok PX 300", key.c_str())) freeReplyObject(r);
+        lk.hold_write(key, "tok");
+
+        // Several TTLs later the lock is still there
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        CPPUNIT_ASSERT_EQUAL(1LL, exists(rc, key));
+        CPPUNIT_ASSERT(!lk.lost("tok"));
+        CPPUNIT_ASSERT(lk.renewals() > 0);
+    }
+
+    void testReleasedLeaseExpires() {
+        LeaseKeeper lk(host, port, db, /*ttl_ms*/300);
+        if (auto* r = (redisReply*)redisCommand(rc.get(), "SET %s tok PX 300", key.c_str())) freeReplyObject(r);
+        lk.hold_write(key, "tok");
+        lk.release("tok");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(600));
+        CPPUNIT_ASSERT_EQUAL(0LL, exists(rc, key));
+    }
+
+    void testReadLeaseIsRenewed() {
+        LeaseKeeper lk(host, port, db, /*ttl_ms*/300);
+        // Score is the lease expiry; start it one TTL from now in server time
+        if (auto* r = (redisReply*)redisCommand(rc.get(), "EVAL %s 1 %s",
+                "local t = redis.call('TIME'); redis.call('ZADD', KEYS[1], t[1]*1000 + math.floor(t[2]/1000) + 300, 'tok');"
+                "return redis.call('PEXPIRE', KEYS[1], 300)", key.c_str())) freeReplyObject(r);
+        lk.hold_read(key, "tok");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        CPPUNIT_ASSERT_EQUAL(1LL, exists(rc, key));
+        CPPUNIT_ASSERT(!lk.lost("tok"));
+    }
+
+    void testStolenLeaseIsLost() {
+        LeaseKeeper lk(host, port, db, /*ttl_ms*/300);
+        // Someone else owns the lock
+        if (auto* r = (redisReply*)redisCommand(rc.get(), "SET %s other PX 5000", key.c_str())) freeReplyObject(r);
+        lk.hold_write(key, "tok");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        CPPUNIT_ASSERT(lk.lost("tok"));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(LeaseKeeperTest);
+
+int main(int argc, char *argv[]) { return run_tests<LeaseKeeperTest>(argc, argv) ? 0 : 1; }
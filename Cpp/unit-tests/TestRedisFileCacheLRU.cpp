@@ -7,6 +7,8 @@
 // No main() here; integrate with your existing CppUnit runner.
 
 #include "RedisFileCacheLRU.h"
+#include "LockStateCache.h"
+#include "CacheMetrics.h"
 
 #include "run_tests_cppunit.h"
 
@@ -17,13 +19,19 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <map>
 #include <random>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <algorithm>
 #include <cerrno>
+#include <fstream>
+#include <iterator>
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <dirent.h>
 #include <unistd.h>
 
@@ -75,6 +83,65 @@ inline void del_namespace(RcPtr& rc, const std::string& ns) {
     } while (cursor != "0");
 }
 
+/// Return the ZSCORE of 'member' in 'zset' as an integer, or -1 if it is not a member.
+inline long long zscore(RcPtr& rc, const std::string& zset, const std::string& member) {
+    long long score = -1;
+    if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZSCORE %s %b", zset.c_str(),
+                                                         member.data(), member.size()))) {
+        if (r->type == REDIS_REPLY_STRING) score = std::stoll(std::string(r->str, r->len));
+        freeReplyObject(r);
+    }
+    return score;
+}
+
+/// The size field of a key's packed idx:meta value ("size:created_ms:flags"); -1 if absent.
+inline long long meta_size(RcPtr& rc, const std::string& h_meta, const std::string& key) {
+    long long sz = -1;
+    if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s %b", h_meta.c_str(), key.data(), key.size()))) {
+        if (r->type == REDIS_REPLY_STRING) sz = std::stoll(std::string(r->str, r->len));
+        freeReplyObject(r);
+    }
+    return sz;
+}
+
+/// Every event in the stream 'events' (oldest first) as a field/value map.
+inline std::vector<std::map<std::string, std::string>> read_events(RcPtr& rc, const std::string& events) {
+    std::vector<std::map<std::string, std::string>> out;
+    if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "XRANGE %s - +", events.c_str()))) {
+        if (r->type == REDIS_REPLY_ARRAY) {
+            for (size_t i = 0; i < r->elements; ++i) {
+                const auto* fields = r->element[i]->element[1];
+                std::map<std::string, std::string> ev;
+                for (size_t f = 0; f + 1 < fields->elements; f += 2)
+                    ev[std::string(fields->element[f]->str, fields->element[f]->len)]
+                        = std::string(fields->element[f+1]->str, fields->element[f+1]->len);
+                out.push_back(ev);
+            }
+        }
+        freeReplyObject(r);
+    }
+    return out;
+}
+
+/// The number of events of 'type' in the stream 'events'.
+inline long long count_events(RcPtr& rc, const std::string& events, const std::string& type) {
+    long long n = 0;
+    for (const auto& ev : read_events(rc, events)) if (ev.count("type") && ev.at("type") == type) ++n;
+    return n;
+}
+
+/// Return the Redis server's TIME in ms since the epoch, or -1 on error.
+inline long long redis_time_ms(RcPtr& rc) {
+    long long ms = -1;
+    if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "TIME"))) {
+        if (r->type == REDIS_REPLY_ARRAY && r->elements == 2)
+            ms = std::stoll(std::string(r->element[0]->str, r->element[0]->len)) * 1000
+                 + std::stoll(std::string(r->element[1]->str, r->element[1]->len)) / 1000;
+        freeReplyObject(r);
+    }
+    return ms;
+}
+
 /// Return true if the file exists and is a regular file.
 inline bool file_exists(const std::string& p) {
     struct stat st{};
@@ -146,6 +213,32 @@ class RedisFileCacheLRUTest : public CppUnit::TestFixture {
         CPPUNIT_TEST(test_blocking_writer);
         CPPUNIT_TEST(test_blocking_reader);
         CPPUNIT_TEST(test_lru_eviction);
+        CPPUNIT_TEST(test_sampled_lru_eviction);
+        CPPUNIT_TEST(test_coalesced_lru_touches);
+        CPPUNIT_TEST(test_coalesced_touch_after_eviction);
+        CPPUNIT_TEST(test_touch_after_eviction);
+        CPPUNIT_TEST(test_redis_lru_clock_ignores_host_skew);
+        CPPUNIT_TEST(test_stale_reader_lease_is_pruned);
+        CPPUNIT_TEST(test_fencing_tokens_with_heartbeat);
+        CPPUNIT_TEST(test_local_read_lease_sharing);
+        CPPUNIT_TEST(test_local_read_lease_renewal);
+        CPPUNIT_TEST(test_local_read_lease_handover);
+        CPPUNIT_TEST(test_tracked_lock_state_reads);
+        CPPUNIT_TEST(test_optimistic_reads);
+        CPPUNIT_TEST(test_open_fd_eviction_ignores_readers);
+        CPPUNIT_TEST(test_open_fd_reads_under_concurrent_eviction);
+        CPPUNIT_TEST(test_fanout_layout);
+        CPPUNIT_TEST(test_hashed_names);
+        CPPUNIT_TEST(test_binary_key_encoding);
+        CPPUNIT_TEST(test_index_schema_version);
+        CPPUNIT_TEST(test_index_schema_migration);
+        CPPUNIT_TEST(test_reconcile_after_index_loss);
+        CPPUNIT_TEST(test_temp_file_sweeper);
+        CPPUNIT_TEST(test_index_audit);
+        CPPUNIT_TEST(test_index_audit_churn);
+        CPPUNIT_TEST(test_operation_metrics);
+        CPPUNIT_TEST(test_trace_file);
+        CPPUNIT_TEST(test_event_stream);
     CPPUNIT_TEST_SUITE_END();
 
   public:
@@ -176,6 +269,7 @@ class RedisFileCacheLRUTest : public CppUnit::TestFixture {
         }
         // Fully remove the temp cache directory and its contents
         remove_path_recursive(cache_dir);
+        LocalLeaseTable::remove(LocalLeaseTable::name_for(ns, host, port, db));
     }
 
     // ---------- TESTS ----------
@@ -193,21 +287,14 @@ class RedisFileCacheLRUTest : public CppUnit::TestFixture {
         std::string got = c.read_bytes(key);
         CPPUNIT_ASSERT_EQUAL(data, got);
 
-        // Indices: sizes, total, lru, keys set
-        const std::string h_sizes = ns + ":idx:size";
+        // Indices: meta, total, lru, schema version
+        const std::string h_meta  = ns + ":idx:meta";
         const std::string k_total = ns + ":idx:total";
         const std::string z_lru   = ns + ":idx:lru";
-        const std::string s_keys  = ns + ":keys:set";
+        const std::string k_schema = ns + ":idx:schema";
 
-        // Size
-        {
-            auto r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s %b", h_sizes.c_str(), key.data(), (size_t) key.size()));
-            CPPUNIT_ASSERT(r && r->type == REDIS_REPLY_STRING);
-            std::string sz(r->str, r->len);
-            freeReplyObject(r);
-            DBG(std::cerr << "size: " << sz << std::endl);
-            CPPUNIT_ASSERT_EQUAL((long long)data.size(), std::stoll(sz));
-        }
+        // Size; the first field of the packed meta value
+        CPPUNIT_ASSERT_EQUAL((long long)data.size(), meta_size(rc, h_meta, key));
         // Total
         {
             auto r = static_cast<redisReply *>(redisCommand(rc.get(), "GET %s", k_total.c_str()));
@@ -217,11 +304,11 @@ class RedisFileCacheLRUTest : public CppUnit::TestFixture {
             DBG(std::cerr << "total: " << total << std::endl);
             CPPUNIT_ASSERT_EQUAL((long long)data.size(), total);
         }
-        // Keys set
+        // Schema version
         {
-            auto r = static_cast<redisReply *>(redisCommand(rc.get(), "SISMEMBER %s %b", s_keys.c_str(), key.data(), (size_t) key.size()));
-            CPPUNIT_ASSERT(r && r->type == REDIS_REPLY_INTEGER);
-            CPPUNIT_ASSERT_EQUAL((long long)1, r->integer);
+            auto r = static_cast<redisReply *>(redisCommand(rc.get(), "GET %s", k_schema.c_str()));
+            CPPUNIT_ASSERT(r && r->type == REDIS_REPLY_STRING);
+            CPPUNIT_ASSERT_EQUAL(std::to_string(RedisFileCache::index_schema_version), std::string(r->str, r->len));
             freeReplyObject(r);
         }
         // LRU touched on read: ensure member exists
@@ -401,14 +488,942 @@ class RedisFileCacheLRUTest : public CppUnit::TestFixture {
         }
         CPPUNIT_ASSERT_MESSAGE("Gone (" + std::to_string(gone) + ") should be >= 1", gone >= 1);
 
-        // Eviction log should have entries (best-effort)
-        const std::string evlog = ns + ":evict:log";
-        long long evcount = 0;
-        if (auto* r = (redisReply*)redisCommand(rc.get(), "LLEN %s", evlog.c_str())) {
-            if (r->type == REDIS_REPLY_INTEGER) evcount = r->integer;
+        // The event stream should hold the evictions, inside a purge
+        const std::string events = ns + ":events";
+        CPPUNIT_ASSERT(count_events(rc, events, "evict") >= 1);
+        CPPUNIT_ASSERT(count_events(rc, events, "purge_start") >= 1);
+        CPPUNIT_ASSERT_EQUAL(count_events(rc, events, "purge_start"), count_events(rc, events, "purge_stop"));
+        CPPUNIT_ASSERT_EQUAL((long long)keys.size(), count_events(rc, events, "publish"));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_sampled_lru_eviction() {
+        DBG(std::cerr << __func__ << std::endl);
+        const long long cap = 8 * 1024; // 8 KB
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, cap);
+        c.set_purge_mtx_ttl(20);
+        c.set_lru_mode(LruMode::sampled);
+        // Sample more keys than the test writes so the choice is deterministic: always the true oldest.
+        c.set_lru_samples(16);
+
+        std::vector<std::string> keys;
+        for (int i=0; i<6; ++i) {
+            const std::string key = "sev-" + rand_hex(4) + ".bin";
+            c.write_bytes_create(key, std::string(4096, char('A' + i)));
+            keys.push_back(key);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50)); // separate LRU timestamps
+        }
+
+        const std::string total_k = ns + ":idx:total";
+        long long total = 0;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "GET %s", total_k.c_str()))) {
+            if (r->type == REDIS_REPLY_STRING) total = std::stoll(std::string(r->str, r->len));
+            else if (r->type == REDIS_REPLY_INTEGER) total = r->integer;
+            freeReplyObject(r);
+        }
+        CPPUNIT_ASSERT_MESSAGE("Total (" + std::to_string(total) +") should be less than cap (" + std::to_string(cap) + ").", total <= cap);
+
+        // With a full sample, the first file written is the first evicted and the last one survives.
+        CPPUNIT_ASSERT_MESSAGE("The oldest file should be evicted", !file_exists(cache_dir + "/" + keys.front()));
+        CPPUNIT_ASSERT_MESSAGE("The newest file should remain", file_exists(cache_dir + "/" + keys.back()));
+
+        // The read/write path must not touch the global LRU ZSET in sampled mode.
+        const std::string z_lru = ns + ":idx:lru";
+        const std::string h_atime = ns + ":idx:atime";
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZCARD %s", z_lru.c_str()))) {
+            CPPUNIT_ASSERT_EQUAL((long long)0, r->integer);
+            freeReplyObject(r);
+        }
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HEXISTS %s %b", h_atime.c_str(),
+                                                             keys.back().data(), keys.back().size()))) {
+            CPPUNIT_ASSERT_EQUAL((long long)1, r->integer);
+            freeReplyObject(r);
+        }
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_coalesced_lru_touches() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string z_lru = ns + ":idx:lru";
+
+        // A long granularity: reads right after the publish touch are dropped altogether.
+        c.set_touch_coalescing(/*granularity_ms*/60000, /*flush_ms*/60000, /*batch_max*/1000);
+        const std::string key = "tc-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "abc");
+        const long long published = zscore(rc, z_lru, key);
+        CPPUNIT_ASSERT(published > 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        c.read_bytes(key);
+        c.flush_lru_touches();
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("A touch inside the granularity window is skipped", published, zscore(rc, z_lru, key));
+
+        // A short granularity: the read is recorded locally and only reaches Redis on flush.
+        c.set_touch_coalescing(/*granularity_ms*/1, /*flush_ms*/60000, /*batch_max*/1000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        c.read_bytes(key);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("The touch should still be pending", published, zscore(rc, z_lru, key));
+        c.flush_lru_touches();
+        CPPUNIT_ASSERT_MESSAGE("The flushed touch should move the key forward", zscore(rc, z_lru, key) > published);
+        DBG(std::cerr << std::endl);
+    }
+
+    // In sampled mode, a touch flushed after the key was evicted does not put it back in idx:atime.
+    void test_coalesced_touch_after_eviction() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string h_atime = ns + ":idx:atime";
+        c.set_lru_mode(LruMode::sampled);
+        c.set_touch_coalescing(/*granularity_ms*/1, /*flush_ms*/60000, /*batch_max*/1000);
+
+        const std::string gone = "tce-" + rand_hex(6) + ".bin";
+        const std::string kept = "tce-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(gone, "abc");
+        c.write_bytes_create(kept, "abc");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        c.read_bytes(gone);
+        c.read_bytes(kept);
+
+        c.index_remove_on_delete(gone, "evict");
+        c.flush_lru_touches();
+        for (const auto& k : {gone, kept}) {
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HEXISTS %s %b", h_atime.c_str(), k.data(), k.size()))) {
+                CPPUNIT_ASSERT_EQUAL_MESSAGE(k, k == kept ? 1LL : 0LL, r->integer);
+                freeReplyObject(r);
+            }
+        }
+        DBG(std::cerr << std::endl);
+    }
+
+    // An immediate touch that races an eviction does not put the key back in the LRU index, in either mode
+    void test_touch_after_eviction() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string z_lru = ns + ":idx:lru", h_atime = ns + ":idx:atime";
+        auto in_index = [&](const std::string& cmd, const std::string& k) {
+            bool found = false;
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), (cmd + " %b").c_str(), k.data(), k.size()))) {
+                found = r->type == REDIS_REPLY_STRING || (r->type == REDIS_REPLY_INTEGER && r->integer == 1);
+                freeReplyObject(r);
+            }
+            return found;
+        };
+
+        for (LruMode mode : {LruMode::exact, LruMode::sampled}) {
+            c.set_lru_mode(mode);
+            const std::string check = mode == LruMode::exact ? "ZSCORE " + z_lru : "HEXISTS " + h_atime;
+            const std::string gone = "te-" + rand_hex(6) + ".bin";
+            const std::string kept = "te-" + rand_hex(6) + ".bin";
+            c.write_bytes_create(gone, "abc");
+            c.write_bytes_create(kept, "abc");
+
+            c.index_remove_on_delete(gone, "evict");
+            c.touch_lru_now(gone, c.now_ms());
+            c.touch_lru_now(kept, c.now_ms());
+            CPPUNIT_ASSERT(!in_index(check, gone));
+            CPPUNIT_ASSERT(in_index(check, kept));
+        }
+
+        // A coalesced exact-mode batch is counted like any other command
+        c.set_lru_mode(LruMode::exact);
+        c.set_touch_coalescing(/*granularity_ms*/1, /*flush_ms*/60000, /*batch_max*/1000);
+        const std::string key = "te-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "abc");
+        const auto before = c.metrics().snapshot().commands["ZADD"].latency.count;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));    // past the publish's touch window
+        c.read_bytes(key);
+        c.flush_lru_touches();
+        CPPUNIT_ASSERT_EQUAL(before + 1, c.metrics().snapshot().commands["ZADD"].latency.count);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_redis_lru_clock_ignores_host_skew() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string z_lru = ns + ":idx:lru";
+        CPPUNIT_ASSERT(c.get_lru_clock() == LruClock::redis);
+
+        // This 'host' booted an hour after the others.
+        c.set_clock_skew_ms(-3600 * 1000);
+
+        const std::string key = "clk-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "abc");
+        const long long score = zscore(rc, z_lru, key);
+        const long long server = redis_time_ms(rc);
+        DBG(std::cerr << "score: " << score << ", server: " << server << std::endl);
+        CPPUNIT_ASSERT_MESSAGE("The LRU score should follow the Redis clock", std::llabs(server - score) < 5000);
+
+        // The same host with its own steady_clock is an hour behind the Redis clock and
+        // behind its own previous touch.
+        c.set_lru_clock(LruClock::steady);
+        const std::string key2 = "clk-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key2, "abc");
+        CPPUNIT_ASSERT_MESSAGE("A skewed steady clock should look older", zscore(rc, z_lru, key2) < score);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_stale_reader_lease_is_pruned() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+
+        const std::string key = "lease-" + rand_hex(6) + ".bin";
+        const std::string rlock = ns + ":lock:readers:" + key;
+        const long long now = redis_time_ms(rc);
+
+        // A reader that is still alive blocks the writer...
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZADD %s %lld live", rlock.c_str(), now + 60000)))
+            freeReplyObject(r);
+        CPPUNIT_ASSERT_THROW_MESSAGE("A live reader lease should block the writer",
+                                     c.write_bytes_create(key, "abc"), CacheBusyError);
+
+        // ...but one whose lease ran out (a crashed reader) does not, even though the key has no TTL.
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZADD %s %lld live", rlock.c_str(), now - 1)))
+            freeReplyObject(r);
+        c.write_bytes_create(key, "abc");
+        CPPUNIT_ASSERT(file_exists(cache_dir + "/" + key));
+
+        // Same for eviction, and a normal read leaves no lease behind.
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZADD %s %lld dead", rlock.c_str(), now - 1)))
+            freeReplyObject(r);
+        CPPUNIT_ASSERT_EQUAL(std::string("abc"), c.read_bytes(key));
+        CPPUNIT_ASSERT_MESSAGE("A stale reader lease should not block eviction", c.can_evict_now(key));
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "EXISTS %s", rlock.c_str()))) {
+            CPPUNIT_ASSERT_EQUAL((long long)0, r->integer);
+            freeReplyObject(r);
+        }
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_fencing_tokens_with_heartbeat() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        c.enable_lease_heartbeat(/*lease_ttl_ms*/500);
+        CPPUNIT_ASSERT(c.lease_heartbeat_enabled());
+
+        const std::string k1 = "fence-" + rand_hex(6) + ".bin";
+        const std::string k2 = "fence-" + rand_hex(6) + ".bin";
+        const long long f1 = c.write_bytes_create(k1, "abc");
+        const long long f2 = c.write_bytes_create(k2, "def");
+        CPPUNIT_ASSERT(f1 > 0);
+        CPPUNIT_ASSERT_MESSAGE("Fencing tokens must increase", f2 > f1);
+        CPPUNIT_ASSERT_EQUAL(std::string("abc"), c.read_bytes(k1));
+
+        // Locks taken with the heartbeat use the short TTL
+        const std::string wlock = ns + ":lock:write:" + k1;
+        long long f3 = 0;
+        const std::string token = c.acquire_write(k1, f3);
+        CPPUNIT_ASSERT(f3 > f2);
+        long long pttl = -1;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "PTTL %s", wlock.c_str()))) {
+            pttl = r->integer;
+            freeReplyObject(r);
+        }
+        CPPUNIT_ASSERT_MESSAGE("PTTL (" + std::to_string(pttl) + ") should be <= the lease TTL", pttl > 0 && pttl <= 500);
+        c.release_write(k1, token);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_local_read_lease_sharing() {
+        DBG(std::cerr << __func__ << std::endl);
+        // Two cache instances stand in for two processes on the same node
+        RedisFileCache a(cache_dir, host, port, db, 60000, ns, 0);
+        RedisFileCache b(cache_dir, host, port, db, 60000, ns, 0);
+        a.set_local_lease_sharing(true);
+        b.set_local_lease_sharing(true);
+
+        const std::string key = "share-" + rand_hex(6) + ".bin";
+        a.write_bytes_create(key, "abc");
+        const std::string rlock = ns + ":lock:readers:" + key;
+        auto zcard = [&]() {
+            long long n = -1;
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZCARD %s", rlock.c_str()))) {
+                n = r->integer;
+                freeReplyObject(r);
+            }
+            return n;
+        };
+
+        const auto la = a.acquire_read(key);
+        const auto lb = b.acquire_read(key);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("The second reader should join the first lease", la.token, lb.token);
+        CPPUNIT_ASSERT_EQUAL(1LL, zcard());
+
+        // The writer still sees a reader until the last local reader leaves
+        a.release_read(key, la);
+        CPPUNIT_ASSERT_EQUAL(1LL, zcard());
+        b.release_read(key, lb);
+        CPPUNIT_ASSERT_EQUAL(0LL, zcard());
+
+        // The normal path still works with sharing on
+        CPPUNIT_ASSERT_EQUAL(std::string("abc"), b.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL(0LL, zcard());
+        DBG(std::cerr << std::endl);
+    }
+
+    // A shared lease kept alive by the heartbeat past its TTL is still joined, and lives until its last reader leaves
+    void test_local_read_lease_renewal() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache a(cache_dir, host, port, db, 60000, ns, 0);
+        RedisFileCache b(cache_dir, host, port, db, 60000, ns, 0);
+        for (RedisFileCache* c : {&a, &b}) {
+            c->enable_lease_heartbeat(/*lease_ttl_ms*/300);
+            c->set_local_lease_sharing(true);
+        }
+
+        const std::string key = "renew-" + rand_hex(6) + ".bin";
+        a.write_bytes_create(key, "abc");
+        const std::string rlock = ns + ":lock:readers:" + key;
+        auto zcard = [&]() {
+            long long n = -1;
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZCARD %s", rlock.c_str()))) {
+                n = r->integer;
+                freeReplyObject(r);
+            }
+            return n;
+        };
+
+        const auto l1 = a.acquire_read(key);
+        std::this_thread::sleep_for(std::chrono::milliseconds(700));
+        const auto l2 = b.acquire_read(key);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("A renewed lease should still be joined", l1.token, l2.token);
+        CPPUNIT_ASSERT_EQUAL(l1.local.gen, l2.local.gen);
+        const auto l3 = a.acquire_read(key);
+        CPPUNIT_ASSERT_EQUAL(l1.token, l3.token);
+
+        // a still holds the lease through l3, so its heartbeat keeps renewing it
+        a.release_read(key, l1);
+        b.release_read(key, l2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(700));
+        CPPUNIT_ASSERT_EQUAL(1LL, zcard());
+        a.release_read(key, l3);
+        CPPUNIT_ASSERT_EQUAL(0LL, zcard());
+        DBG(std::cerr << std::endl);
+    }
+
+    // Readers moved to a newer lease keep renewing it after the reader that brought it leaves
+    void test_local_read_lease_handover() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache a(cache_dir, host, port, db, 60000, ns, 0);
+        RedisFileCache b(cache_dir, host, port, db, 60000, ns, 0);
+        a.enable_lease_heartbeat(/*lease_ttl_ms*/300);
+        b.enable_lease_heartbeat(/*lease_ttl_ms*/1000);
+        a.set_local_lease_sharing(true);
+        b.set_local_lease_sharing(true);
+
+        const std::string key = "handover-" + rand_hex(6) + ".bin";
+        a.write_bytes_create(key, "abc");
+        const std::string rlock = ns + ":lock:readers:" + key;
+        auto zscore = [&](const std::string& token) {
+            long long score = -1;
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZSCORE %s %s", rlock.c_str(), token.c_str()))) {
+                if (r->type == REDIS_REPLY_STRING) score = std::stoll(std::string(r->str, r->len));
+                freeReplyObject(r);
+            }
+            return score;
+        };
+
+        // a's lease never has more than 300 ms left, less than b wants, so b brings its own and a's reader moves to it
+        const auto la = a.acquire_read(key);
+        const auto lb = b.acquire_read(key);
+        CPPUNIT_ASSERT(la.token != lb.token);
+        CPPUNIT_ASSERT_EQUAL(-1LL, zscore(la.token));
+        CPPUNIT_ASSERT(zscore(lb.token) > 0);
+
+        // b leaves; its lease would run out after 1000 ms unless a's heartbeat renews it
+        b.release_read(key, lb);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        CPPUNIT_ASSERT_MESSAGE("The moved reader's heartbeat should renew the slot's lease", zscore(lb.token) > 0);
+
+        a.release_read(key, la);
+        CPPUNIT_ASSERT_EQUAL(-1LL, zscore(lb.token));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_tracked_lock_state_reads() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        c.set_lock_state_tracking(true);
+        c.set_read_mode(ReadMode::optimistic);
+        auto script_calls = [&c](const char* name) {
+            auto s = c.metrics().snapshot();
+            return s.scripts[name].latency.count;
+        };
+
+        const std::string key = "track-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "tracked");
+
+        // Only the first lookup asks Redis; the rest, including the checks after each read, are local
+        CPPUNIT_ASSERT_EQUAL(std::string("tracked"), c.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL(std::string("tracked"), c.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL(c.lock_state()->lookups() - 1, c.lock_state()->hits());
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, script_calls("read_validate"));
+
+        // Tracked reads take no reader lease
+        const std::string rlock = ns + ":lock:readers:" + key;
+        {
+            auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "EXISTS %s", rlock.c_str()));
+            CPPUNIT_ASSERT(r && r->type == REDIS_REPLY_INTEGER);
+            CPPUNIT_ASSERT_EQUAL(0LL, r->integer);
             freeReplyObject(r);
         }
-        CPPUNIT_ASSERT(evcount >= 1);
+
+        // A writer lock invalidates the cached state; the read falls back to a validated read
+        const std::string wlock = ns + ":lock:write:" + key;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "SET %s token PX 3000", wlock.c_str()))) freeReplyObject(r);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));     // let the push arrive
+        CPPUNIT_ASSERT_EQUAL(std::string("tracked"), c.read_bytes(key));
+        CPPUNIT_ASSERT(c.lock_state()->invalidations() >= 1);
+        CPPUNIT_ASSERT(script_calls("read_validate") >= 1);
+
+        // Locked reads take the reader lease whatever the tracked state, so they still see the writer
+        c.set_read_mode(ReadMode::locked);
+        CPPUNIT_ASSERT_THROW(c.read_bytes(key), CacheBusyError);
+
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "DEL %s", wlock.c_str()))) freeReplyObject(r);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const auto acquired = script_calls("read_acq");
+        CPPUNIT_ASSERT_EQUAL(std::string("tracked"), c.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL(acquired + 1, script_calls("read_acq"));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_optimistic_reads() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        c.set_read_mode(ReadMode::optimistic);
+
+        const std::string key = "opt-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "optimistic");
+        CPPUNIT_ASSERT_EQUAL(std::string("optimistic"), c.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL(0LL, c.get_optimistic_retries());
+
+        // A reader holding no lease does not block the evictor
+        CPPUNIT_ASSERT(c.can_evict_now(key));
+
+        // With the eviction fence still set, validation fails; the read is retried, then taken under a lock
+        CPPUNIT_ASSERT_EQUAL(std::string("optimistic"), c.read_bytes(key));
+        CPPUNIT_ASSERT_EQUAL((long long)c.get_optimistic_attempts(), c.get_optimistic_retries());
+
+        // Once the entry is evicted the read is a miss
+        const std::string p = cache_dir + "/" + key;
+        ::unlink(p.c_str());
+        bool miss = false;
+        try { c.read_bytes(key); }
+        catch (const std::system_error& se) { miss = se.code().value() == ENOENT; }
+        CPPUNIT_ASSERT(miss);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_open_fd_eviction_ignores_readers() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+
+        const std::string key = "fd-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "abc");
+
+        // A live reader lease blocks a locked-mode evictor...
+        const std::string rlock = ns + ":lock:readers:" + key;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZADD %s %lld tok", rlock.c_str(),
+                redis_time_ms(rc) + 60000))) freeReplyObject(r);
+        CPPUNIT_ASSERT(!c.can_evict_now(key));
+
+        // ...but not one in open_fd mode
+        c.set_read_mode(ReadMode::open_fd);
+        CPPUNIT_ASSERT(c.can_evict_now(key));
+        DBG(std::cerr << std::endl);
+    }
+
+    // Readers (one cache instance per thread; the class is not thread safe) read while a
+    // writer keeps the cache over capacity. Every read must return a whole entry or miss.
+    void test_open_fd_reads_under_concurrent_eviction() {
+        DBG(std::cerr << __func__ << std::endl);
+        const size_t entry = 256 * 1024;     // several read() calls per entry
+        const long long cap = 4 * (long long)entry;
+        auto payload = [entry](int i) { return std::string(entry, char('a' + i % 26)); };
+        auto key_for = [](int i) { return "fd-" + std::to_string(i) + ".bin"; };
+
+        std::atomic<int> written{0};
+        std::atomic<bool> done{false};
+        std::atomic<long long> hits{0}, misses{0}, bad{0};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&, t]() {
+                RedisFileCache c(cache_dir, host, port, db, 60000, ns, cap);
+                c.set_read_mode(ReadMode::open_fd);
+                std::mt19937 gen(t);
+                while (!done) {
+                    const int n = written;
+                    if (n == 0) { std::this_thread::yield(); continue; }
+                    const int i = std::uniform_int_distribution<int>(std::max(0, n - 6), n - 1)(gen);
+                    try {
+                        if (c.read_bytes(key_for(i)) == payload(i)) ++hits; else ++bad;
+                    } catch (const std::system_error& se) {
+                        if (se.code().value() == ENOENT) ++misses; else ++bad;
+                    } catch (...) { ++bad; }
+                }
+            });
+        }
+
+        RedisFileCache w(cache_dir, host, port, db, 60000, ns, cap);
+        w.set_read_mode(ReadMode::open_fd);
+        w.set_purge_mtx_ttl(1);
+        for (int i = 0; i < 60; ++i) {
+            w.write_bytes_create(key_for(i), payload(i));
+            written = i + 1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        done = true;
+        for (auto& th : readers) th.join();
+
+        const long long evcount = count_events(rc, ns + ":events", "evict");
+        DBG(std::cerr << "hits=" << hits << " misses=" << misses << " evictions=" << evcount << std::endl);
+        CPPUNIT_ASSERT_EQUAL(0LL, bad.load());
+        CPPUNIT_ASSERT(hits > 0);
+        CPPUNIT_ASSERT_MESSAGE("Readers should never hold up eviction", evcount >= 40);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_fanout_layout() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        c.set_fanout_levels(2);
+
+        const std::string key = "fan-" + rand_hex(6) + ".bin";
+        const std::string sub = RedisFileCache::fanout_subdir(key, 2);
+        CPPUNIT_ASSERT_EQUAL((size_t)5, sub.size());    // "xx/yy"
+
+        // Directories are created by the first write
+        CPPUNIT_ASSERT(!file_exists(cache_dir + "/" + sub + "/" + key));
+        c.write_bytes_create(key, "fanned out");
+        CPPUNIT_ASSERT(file_exists(cache_dir + "/" + sub + "/" + key));
+        CPPUNIT_ASSERT(!file_exists(cache_dir + "/" + key));
+        CPPUNIT_ASSERT_EQUAL(std::string("fanned out"), c.read_bytes(key));
+
+        // Eviction finds the file in its subdirectory
+        std::string victim; long long freed = 0;
+        CPPUNIT_ASSERT(c.try_evict_one(victim, freed));
+        CPPUNIT_ASSERT_EQUAL(key, victim);
+        CPPUNIT_ASSERT(!file_exists(cache_dir + "/" + sub + "/" + key));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_hashed_names() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        CPPUNIT_ASSERT_THROW(c.write_bytes_create("/a/b.nc", "x"), std::invalid_argument);
+        c.set_hashed_names(true);
+
+        // A natural key: a URL path with a constraint expression
+        const std::string key = "/data/" + rand_hex(6) + "/sst.nc.dap?dap4.ce=/sst[0:1:10][0:1:20]";
+        const std::string name = RedisFileCache::hashed_name(key);
+        CPPUNIT_ASSERT_EQUAL((size_t)32, name.size());
+
+        c.write_bytes_create(key, "payload");
+        CPPUNIT_ASSERT(c.exists(key));
+        CPPUNIT_ASSERT(file_exists(cache_dir + "/" + name));
+        CPPUNIT_ASSERT_EQUAL(std::string("payload"), c.read_bytes(key));
+
+        // The index holds the fixed-width name and the payload size
+        CPPUNIT_ASSERT_EQUAL(7LL, meta_size(rc, ns + ":idx:meta", name));
+
+        // A file whose header names another key (a hash collision) is a miss
+        {
+            const std::string p = cache_dir + "/" + name;
+            const std::string other = RedisFileCache::key_header("some other key") + "payload";
+            FILE* f = std::fopen(p.c_str(), "wb");
+            CPPUNIT_ASSERT(f);
+            std::fwrite(other.data(), 1, other.size(), f);
+            std::fclose(f);
+        }
+        bool miss = false;
+        try { c.read_bytes(key); }
+        catch (const std::system_error& se) { miss = se.code().value() == ENOENT; }
+        CPPUNIT_ASSERT(miss);
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_binary_key_encoding() {
+        DBG(std::cerr << __func__ << std::endl);
+        const std::string key = "/data/" + rand_hex(6) + "/granule.h5?dap4.ce=/lat;/lon";
+        const std::string z_lru = ns + ":idx:lru";
+
+        for (const auto enc : {KeyEncoding::binary64, KeyEncoding::binary128}) {
+            const size_t id_len = (enc == KeyEncoding::binary64) ? 8 : 16;
+            RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+            c.set_key_encoding(enc);
+
+            c.write_bytes_create(key, "binary");
+            CPPUNIT_ASSERT_EQUAL(std::string("binary"), c.read_bytes(key));
+
+            // The file is named by the hash in hex; the index holds the raw bytes
+            const std::string name = c.entry_name(key);
+            CPPUNIT_ASSERT_EQUAL(2 * id_len, name.size());
+            CPPUNIT_ASSERT(file_exists(cache_dir + "/" + name));
+
+            auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "ZRANGE %s 0 -1", z_lru.c_str()));
+            CPPUNIT_ASSERT(r && r->type == REDIS_REPLY_ARRAY && r->elements == 1);
+            CPPUNIT_ASSERT_EQUAL(id_len, (size_t)r->element[0]->len);
+            freeReplyObject(r);
+
+            // Eviction maps the binary id back to the file
+            std::string victim; long long freed = 0;
+            CPPUNIT_ASSERT(c.try_evict_one(victim, freed));
+            CPPUNIT_ASSERT_EQUAL(6LL, freed);
+            CPPUNIT_ASSERT(!file_exists(cache_dir + "/" + name));
+        }
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_index_schema_version() {
+        DBG(std::cerr << __func__ << std::endl);
+        const std::string k_schema = ns + ":idx:schema";
+
+        // A version 1 index (no schema key, idx:size present) must be migrated first
+        const std::string h_sizes = ns + ":idx:size";
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HSET %s old.bin 10", h_sizes.c_str()))) freeReplyObject(r);
+        CPPUNIT_ASSERT_THROW(RedisFileCache(cache_dir, host, port, db, 60000, ns, 0), std::runtime_error);
+
+        // An unknown version is refused
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "SET %s 99", k_schema.c_str()))) freeReplyObject(r);
+        CPPUNIT_ASSERT_THROW(RedisFileCache(cache_dir, host, port, db, 60000, ns, 0), std::runtime_error);
+
+        // Publish and evict each update the index in one script
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "DEL %s %s", k_schema.c_str(), h_sizes.c_str()))) freeReplyObject(r);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string key = "meta-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "12345");
+        CPPUNIT_ASSERT_EQUAL(5LL, meta_size(rc, ns + ":idx:meta", key));
+        CPPUNIT_ASSERT_EQUAL(5LL, c.get_total_bytes());
+        CPPUNIT_ASSERT_EQUAL(5LL, c.index_remove_on_delete(key));
+        CPPUNIT_ASSERT_EQUAL(-1LL, c.index_remove_on_delete(key));     // a second evictor subtracts nothing
+        CPPUNIT_ASSERT_EQUAL(0LL, c.get_total_bytes());
+        DBG(std::cerr << std::endl);
+    }
+
+    // A version 1 index becomes a packed one, flagged for key headers when the writers use hashed names.
+    void test_index_schema_migration() {
+        DBG(std::cerr << __func__ << std::endl);
+        const std::string h_meta = ns + ":idx:meta", h_sizes = ns + ":idx:size", k_schema = ns + ":idx:schema";
+        const std::string key = "/data/" + rand_hex(6) + "/sst.nc?sst[0:1:10]";
+        const std::string name = RedisFileCache::hashed_name(key);
+        {
+            RedisFileCache w(cache_dir, host, port, db, 60000, ns, 0);
+            w.set_hashed_names(true);
+            w.write_bytes_create(key, "payload");
+        }
+        auto meta_field = [&](const std::string& n) {
+            std::string v;
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s %s", h_meta.c_str(), n.c_str()))) {
+                if (r->type == REDIS_REPLY_STRING) v.assign(r->str, r->len);
+                freeReplyObject(r);
+            }
+            return v;
+        };
+        // Turn the namespace back into version 1: sizes in idx:size, no meta, no schema version
+        auto to_v1 = [&] {
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HSET %s %s 7", h_sizes.c_str(), name.c_str()))) freeReplyObject(r);
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "DEL %s %s", h_meta.c_str(), k_schema.c_str()))) freeReplyObject(r);
+        };
+        CPPUNIT_ASSERT_EQUAL(std::string(":1"), meta_field(name).substr(meta_field(name).rfind(':')));
+
+        to_v1();
+        CPPUNIT_ASSERT_THROW(RedisFileCache(cache_dir, host, port, db, 60000, ns, 0), std::runtime_error);
+        auto st = RedisFileCache::migrate_index_schema(host, port, db, ns, true);
+        CPPUNIT_ASSERT(st.had_version.empty());
+        CPPUNIT_ASSERT_EQUAL(1LL, st.entries);
+        CPPUNIT_ASSERT_EQUAL(7LL, st.total_bytes);
+        const std::string m = meta_field(name);
+        CPPUNIT_ASSERT_EQUAL(std::string("7:"), m.substr(0, 2));
+        CPPUNIT_ASSERT_EQUAL(std::string(":1"), m.substr(m.rfind(':')));
+
+        // A second run finds the current version and changes nothing
+        st = RedisFileCache::migrate_index_schema(host, port, db, ns, true);
+        CPPUNIT_ASSERT_EQUAL(std::to_string(RedisFileCache::index_schema_version), st.had_version);
+        CPPUNIT_ASSERT_EQUAL(0LL, st.entries);
+
+        // The migrated entry reads, and an audit pass keeps it
+        {
+            RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+            c.set_hashed_names(true);
+            CPPUNIT_ASSERT_EQUAL(7LL, c.get_total_bytes());
+            CPPUNIT_ASSERT_EQUAL(std::string("payload"), c.read_bytes(key));
+            const auto a = c.audit_index(1000, 1);
+            CPPUNIT_ASSERT(a.pass_complete);
+            CPPUNIT_ASSERT_EQUAL(0LL, a.dropped);
+            CPPUNIT_ASSERT_EQUAL(0LL, a.size_fixed);
+        }
+
+        // Without key headers the entry is not flagged
+        to_v1();
+        st = RedisFileCache::migrate_index_schema(host, port, db, ns, false);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.entries);
+        const std::string plain = meta_field(name);
+        CPPUNIT_ASSERT_EQUAL(std::string(":0"), plain.substr(plain.rfind(':')));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_reconcile_after_index_loss() {
+        DBG(std::cerr << __func__ << std::endl);
+        const std::string h_meta = ns + ":idx:meta";
+        const std::string k1 = "rec1-" + rand_hex(6) + ".bin";
+        const std::string k2 = "rec2-" + rand_hex(6) + ".bin";
+        {
+            RedisFileCache w(cache_dir, host, port, db, 60000, ns, 0);
+            CPPUNIT_ASSERT(w.index_created());
+            w.set_fanout_levels(1);
+            w.write_bytes_create(k1, "abc");
+            w.write_bytes_create(k2, "defgh");
+        }
+
+        // A writer that died before publishing left its temp file behind
+        const std::string tmp = cache_dir + "/" + RedisFileCache::fanout_subdir(k1, 1) + "/." + k1 + ".Ab12Cd";
+        { std::ofstream(tmp) << "partial"; }
+        struct timeval old[2] = {{1000000000, 0}, {1000000000, 0}};
+        ::utimes(tmp.c_str(), old);
+
+        // Redis restarted without persistence
+        del_namespace(rc, ns);
+
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        CPPUNIT_ASSERT(c.index_created());
+        c.set_fanout_levels(1);
+        auto st = c.reconcile(2, 60000);
+        CPPUNIT_ASSERT_EQUAL(2LL, st.files);
+        CPPUNIT_ASSERT_EQUAL(2LL, st.added);
+        CPPUNIT_ASSERT_EQUAL(8LL, st.bytes_added);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.temp_removed);
+        CPPUNIT_ASSERT(!file_exists(tmp));
+        CPPUNIT_ASSERT_EQUAL(8LL, c.get_total_bytes());
+        CPPUNIT_ASSERT_EQUAL(3LL, meta_size(rc, h_meta, k1));
+        CPPUNIT_ASSERT(zscore(rc, ns + ":idx:lru", k2) > 0);
+
+        // Indexing is idempotent; an entry whose file is gone is dropped
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HSET %s ghost.bin 4:0:0", h_meta.c_str()))) freeReplyObject(r);
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "INCRBY %s:idx:total 4", ns.c_str()))) freeReplyObject(r);
+        st = c.reconcile(2, 60000);
+        CPPUNIT_ASSERT_EQUAL(0LL, st.added);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.stale_dropped);
+        CPPUNIT_ASSERT_EQUAL(-1LL, meta_size(rc, h_meta, "ghost.bin"));
+        CPPUNIT_ASSERT_EQUAL(8LL, c.get_total_bytes());
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_temp_file_sweeper() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 1000, ns, 0);
+        struct timeval old[2] = {{1000000000, 0}, {1000000000, 0}};
+        auto make_temp = [&](const std::string& name, bool stale) {
+            const std::string p = cache_dir + "/." + name + ".Q1w2E3";
+            { std::ofstream(p) << "0123456789"; }
+            if (stale) ::utimes(p.c_str(), old);
+            return p;
+        };
+
+        const std::string orphan = make_temp("orphan-" + rand_hex(6), true);
+        const std::string fresh = make_temp("fresh-" + rand_hex(6), false);     // a writer may still be busy
+        const std::string locked_name = "locked-" + rand_hex(6);
+        const std::string locked = make_temp(locked_name, true);                // a writer holds the lock
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "SET %s:lock:write:%s t PX 60000",
+                                                              ns.c_str(), locked_name.c_str()))) freeReplyObject(r);
+
+        const auto st = c.sweep_temp_files();
+        CPPUNIT_ASSERT_EQUAL(3LL, st.examined);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.removed);
+        CPPUNIT_ASSERT_EQUAL(10LL, st.bytes);
+        CPPUNIT_ASSERT(!file_exists(orphan));
+        CPPUNIT_ASSERT(file_exists(fresh));
+        CPPUNIT_ASSERT(file_exists(locked));
+
+        long long swept = -1;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s:stats temp_swept_bytes", ns.c_str()))) {
+            if (r->type == REDIS_REPLY_STRING) swept = std::stoll(std::string(r->str, r->len));
+            freeReplyObject(r);
+        }
+        CPPUNIT_ASSERT_EQUAL(10LL, swept);
+
+        // With an interval set, a write runs the sweep; the next one within the interval does not
+        c.set_temp_sweep_interval(60000);
+        const std::string orphan2 = make_temp("orphan2-" + rand_hex(6), true);
+        c.write_bytes_create("sw1-" + rand_hex(6), "x");
+        CPPUNIT_ASSERT(!file_exists(orphan2));
+        const std::string orphan3 = make_temp("orphan3-" + rand_hex(6), true);
+        c.write_bytes_create("sw2-" + rand_hex(6), "x");
+        CPPUNIT_ASSERT(file_exists(orphan3));
+        DBG(std::cerr << std::endl);
+    }
+
+    void test_index_audit() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string h_meta = ns + ":idx:meta", k_total = ns + ":idx:total";
+        const std::string k1 = "aud1-" + rand_hex(6), k2 = "aud2-" + rand_hex(6), k3 = "aud3-" + rand_hex(6);
+        c.write_bytes_create(k1, "abc");
+        c.write_bytes_create(k2, "defgh");
+        c.write_bytes_create(k3, "xy");
+        CPPUNIT_ASSERT_EQUAL(10LL, c.get_total_bytes());
+
+        auto cmd = [&](const std::string& fmt_cmd) {
+            if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), fmt_cmd.c_str()))) freeReplyObject(r);
+        };
+        // k2 indexed with the wrong size (and the total to match), k3's file gone, and a stray INCRBY
+        std::string m2;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s %s", h_meta.c_str(), k2.c_str()))) {
+            m2.assign(r->str, r->len);
+            freeReplyObject(r);
+        }
+        cmd("HSET " + h_meta + " " + k2 + " 50" + m2.substr(m2.find(':')));
+        cmd("INCRBY " + k_total + " 145");
+        ::unlink((cache_dir + "/" + k3).c_str());
+
+        const auto st = c.audit_index(100, 2);
+        CPPUNIT_ASSERT(st.pass_complete);
+        CPPUNIT_ASSERT_EQUAL(3LL, st.checked);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.dropped);
+        CPPUNIT_ASSERT_EQUAL(1LL, st.size_fixed);
+        CPPUNIT_ASSERT_EQUAL(-45LL, st.bytes_corrected);
+        CPPUNIT_ASSERT_EQUAL(100LL, st.drift);
+        CPPUNIT_ASSERT_EQUAL(0LL, st.churn);
+        CPPUNIT_ASSERT_EQUAL(8LL, c.get_total_bytes());
+        CPPUNIT_ASSERT_EQUAL(5LL, meta_size(rc, h_meta, k2));
+        CPPUNIT_ASSERT_EQUAL(-1LL, meta_size(rc, h_meta, k3));
+
+        long long drift = -1;
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "HGET %s:stats audit_drift_bytes", ns.c_str()))) {
+            if (r->type == REDIS_REPLY_STRING) drift = std::stoll(std::string(r->str, r->len));
+            freeReplyObject(r);
+        }
+        CPPUNIT_ASSERT_EQUAL(100LL, drift);
+
+        // A clean index audits clean
+        const auto again = c.audit_index(100, 2);
+        CPPUNIT_ASSERT_EQUAL(0LL, again.dropped + again.size_fixed + again.drift);
+        DBG(std::cerr << std::endl);
+    }
+
+    // An entry published during a pass may be counted twice, so only drift beyond the churn is corrected;
+    // the next pass corrects the rest.
+    void test_index_audit_churn() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string k_total = ns + ":idx:total";
+        c.write_bytes_create("ach1-" + rand_hex(6), "abcde");
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "INCRBY %s 7", k_total.c_str()))) freeReplyObject(r);
+
+        // Begin a pass, publish during it, then finish it; a small hash is scanned whole, new entry included
+        c.scripts_->evalsha_ll("audit_begin", 2, {c.k_audit_pass_, k_total}, {});
+        c.write_bytes_create("ach2-" + rand_hex(6), "xyz");
+        if (auto* r = static_cast<redisReply *>(redisCommand(rc.get(), "SET %s:audit:cursor 1", ns.c_str()))) freeReplyObject(r);
+        const auto st = c.audit_index(100, 1);
+        CPPUNIT_ASSERT(st.pass_complete);
+        CPPUNIT_ASSERT_EQUAL(3LL, st.churn);
+        CPPUNIT_ASSERT_EQUAL(4LL, st.drift);
+        CPPUNIT_ASSERT_EQUAL(11LL, c.get_total_bytes());
+
+        const auto next = c.audit_index(100, 1);
+        CPPUNIT_ASSERT_EQUAL(0LL, next.churn);
+        CPPUNIT_ASSERT_EQUAL(3LL, next.drift);
+        CPPUNIT_ASSERT_EQUAL(8LL, c.get_total_bytes());
+
+        // A pass ends once: ending it again changes nothing
+        CPPUNIT_ASSERT_EQUAL(0LL, c.scripts_->evalsha_ll("audit_end", 3, {c.k_audit_pass_, k_total, ns + ":events"},
+                                                         {"1", "0"}));
+        CPPUNIT_ASSERT_EQUAL(8LL, c.get_total_bytes());
+        DBG(std::cerr << std::endl);
+    }
+
+    // Each outcome lands in its counter, and each timed step in its histogram.
+    void test_operation_metrics() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const auto& m = c.metrics();
+
+        const std::string key = "m-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "12345");
+        CPPUNIT_ASSERT_EQUAL(std::string("12345"), c.read_bytes(key));
+        try { c.write_bytes_create(key, "x"); } catch (const std::system_error&) {}
+        try { c.read_bytes("missing-" + rand_hex(6) + ".bin"); } catch (const std::system_error&) {}
+
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, m.get(CacheMetrics::writes_ok));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, m.get(CacheMetrics::write_exists));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)5, m.get(CacheMetrics::bytes_written));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, m.get(CacheMetrics::reads_ok));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, m.get(CacheMetrics::read_misses));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)5, m.get(CacheMetrics::bytes_read));
+
+        auto s = m.snapshot();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)2, s.ops["write"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)2, s.ops["read"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.ops["fsync"].count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.ops["rename"].count);
+        CPPUNIT_ASSERT(s.ops["write_lock"].count >= 1);
+        CPPUNIT_ASSERT(!s.scripts.empty());
+        CPPUNIT_ASSERT(s.scripts["write_acq"].calls_by_op[CacheMetrics::write] >= 1);
+        CPPUNIT_ASSERT(c.metrics().redis_report().find("write: 2 ops") != std::string::npos);
+        CPPUNIT_ASSERT(c.metrics().prometheus().find("poc_cache_writes_ok_total 1\n") != std::string::npos);
+        DBG(std::cerr << std::endl);
+    }
+
+    // Each phase of a write, a read and a miss is a span in a complete JSON array.
+    void test_trace_file() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string trace = "/tmp/poc-trace-" + rand_hex(6) + ".json";
+        c.set_trace_file(trace);
+        CPPUNIT_ASSERT(c.tracing());
+
+        const std::string key = "t-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "traced");
+        CPPUNIT_ASSERT_EQUAL(std::string("traced"), c.read_bytes(key));
+        try { c.read_bytes("missing-" + rand_hex(6) + ".bin"); } catch (const std::system_error&) {}
+        c.set_trace_file("");
+        CPPUNIT_ASSERT(!c.tracing());
+
+        std::ifstream in(trace);
+        const std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        ::unlink(trace.c_str());
+        CPPUNIT_ASSERT(json.size() > 4 && json.front() == '[' && json.compare(json.size() - 2, 2, "]\n") == 0);
+        for (const char* span : {"write_bytes_create", "acquire_write", "script:write_acq", "write_tmp", "fsync",
+                                 "rename", "index_publish", "read_bytes", "acquire_read", "open", "read_loop"}) {
+            CPPUNIT_ASSERT_MESSAGE(span, json.find(std::string("{\"name\":\"") + span + "\"") != std::string::npos);
+        }
+        CPPUNIT_ASSERT(json.find("\"key\":\"" + key + "\"") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"result\":\"miss\"") != std::string::npos);
+
+        // Binary bytes are escaped, so the file stays valid UTF-8; well-formed UTF-8 is kept
+        CPPUNIT_ASSERT_EQUAL(std::string("a\\u00ff\xc3\xa9\\u00c3\\\"\\u0001"),
+                             TraceWriter::escape(std::string("a\xff\xc3\xa9\xc3\"\x01")));
+        DBG(std::cerr << std::endl);
+    }
+
+    // Index changes are logged to ns:events with the key and size; a MAXLEN of 0 stops logging.
+    void test_event_stream() {
+        DBG(std::cerr << __func__ << std::endl);
+        RedisFileCache c(cache_dir, host, port, db, 60000, ns, 0);
+        const std::string events = ns + ":events";
+
+        const std::string key = "e-" + rand_hex(6) + ".bin";
+        c.write_bytes_create(key, "12345");
+        auto evs = read_events(rc, events);
+        CPPUNIT_ASSERT_EQUAL((size_t)1, evs.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("publish"), evs[0]["type"]);
+        CPPUNIT_ASSERT_EQUAL(key, evs[0]["key"]);
+        CPPUNIT_ASSERT_EQUAL(std::string("5"), evs[0]["size"]);
+
+        // A file removed behind the cache's back is dropped by the audit: a drift fix
+        ::unlink((cache_dir + "/" + key).c_str());
+        c.audit_index(1000, 1);
+        evs = read_events(rc, events);
+        CPPUNIT_ASSERT_EQUAL((size_t)2, evs.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("drift_fix"), evs[1]["type"]);
+        CPPUNIT_ASSERT_EQUAL(std::string("drop"), evs[1]["fix"]);
+        CPPUNIT_ASSERT_EQUAL(key, evs[1]["key"]);
+        CPPUNIT_ASSERT_EQUAL(std::string("5"), evs[1]["size"]);
+
+        c.set_event_stream_maxlen(0);
+        c.write_bytes_create("e-" + rand_hex(6) + ".bin", "x");
+        CPPUNIT_ASSERT_EQUAL((size_t)2, read_events(rc, events).size());
         DBG(std::cerr << std::endl);
     }
 };
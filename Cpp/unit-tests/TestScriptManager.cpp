@@ -38,6 +38,7 @@ class ScriptManagerTest : public CppUnit::TestFixture {
         CPPUNIT_TEST(testRegisterLoadAndEval);
         CPPUNIT_TEST(testReloadOnNoScript);
         CPPUNIT_TEST(testEvalKeysAndArgs);
+        CPPUNIT_TEST(testCallMetrics);
     CPPUNIT_TEST_SUITE_END();
 
   public:
@@ -103,6 +104,35 @@ class ScriptManagerTest : public CppUnit::TestFixture {
         long long v1 = sm.evalsha_ll(name, 2, std::vector<std::string>{"k1","k2"}, std::vector<std::string>{"10"});
         // 10 + #KEYS(=2) == 12
         CPPUNIT_ASSERT_EQUAL(12LL, v1);
+
+        // A key count that does not match the keys would move keys into ARGV
+        CPPUNIT_ASSERT_THROW(sm.evalsha_ll(name, 1, std::vector<std::string>{"k1","k2"}, std::vector<std::string>{"10"}),
+                             std::invalid_argument);
+    }
+
+    void testCallMetrics() {
+        CacheMetrics m;
+        ScriptManager sm(rc.get());
+        sm.set_metrics(&m);
+        sm.register_and_load("one", "return 1");
+        sm.register_and_load("boom", "return redis.error_reply('boom')");
+
+        CPPUNIT_ASSERT_EQUAL(1LL, sm.evalsha_ll("one", 0, {}, {}));
+        if (auto* r = (redisReply*)redisCommand(rc.get(), "SCRIPT FLUSH")) freeReplyObject(r);
+        {
+            CacheMetrics::OpContext ctx(CacheMetrics::read);
+            CPPUNIT_ASSERT_EQUAL(1LL, sm.evalsha_ll("one", 0, {}, {}));
+        }
+        CPPUNIT_ASSERT_THROW(sm.evalsha_ll("boom", 0, {}, {}), std::runtime_error);
+
+        auto s = m.snapshot();
+        const auto& one = s.scripts["one"];
+        CPPUNIT_ASSERT_EQUAL((uint64_t)2, one.latency.count);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, one.reloads);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, one.errors);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, one.calls_by_op[CacheMetrics::read]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, one.calls_by_op[CacheMetrics::op_count]);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.scripts["boom"].errors);
     }
 };
 
@@ -0,0 +1,161 @@
+//
+// CppUnit tests for the simulator's delay proxy (SimDelayProxy.h), against a
+// local echo server. No Redis needed.
+//
+
+#include "SimDelayProxy.h"
+#include "run_tests_cppunit.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+class SimDelayProxyTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SimDelayProxyTest);
+        CPPUNIT_TEST(test_round_trip_delay);
+        CPPUNIT_TEST(test_order_and_eof);
+        CPPUNIT_TEST(test_upstream_down);
+        CPPUNIT_TEST(test_reaps_closed_connections);
+    CPPUNIT_TEST_SUITE_END();
+
+    // Echoes each connection in turn until EOF, then closes it.
+    struct EchoServer {
+        int fd = -1;
+        int port = 0;
+        std::thread t;
+
+        EchoServer() {
+            fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            CPPUNIT_ASSERT(::bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+            CPPUNIT_ASSERT(::listen(fd, 4) == 0);
+            ::getsockname(fd, (sockaddr*)&addr, &len);
+            port = ntohs(addr.sin_port);
+            t = std::thread([this] {
+                int c;
+                while ((c = ::accept(fd, nullptr, nullptr)) >= 0) {
+                    char buf[4096];
+                    ssize_t n;
+                    while ((n = ::read(c, buf, sizeof(buf))) > 0)
+                        if (::send(c, buf, (size_t)n, MSG_NOSIGNAL) != n) break;
+                    ::close(c);
+                }
+            });
+        }
+
+        ~EchoServer() {
+            ::shutdown(fd, SHUT_RDWR);
+            t.join();
+            ::close(fd);
+        }
+    };
+
+    static int connect_to(int port) {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t)port);
+        CPPUNIT_ASSERT(::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        return fd;
+    }
+
+    static std::string read_all(int fd, size_t max) {
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while (out.size() < max && (n = ::read(fd, buf, std::min(sizeof(buf), max - out.size()))) > 0)
+            out.append(buf, (size_t)n);
+        return out;
+    }
+
+public:
+    // The delay applies in each direction, so a round trip takes at least twice as long.
+    void test_round_trip_delay() {
+        EchoServer echo;
+        DelayProxy proxy("127.0.0.1", echo.port, 25, 0);
+        proxy.start();
+
+        const int c = connect_to(proxy.port());
+        const auto t0 = std::chrono::steady_clock::now();
+        CPPUNIT_ASSERT_EQUAL((ssize_t)4, ::send(c, "ping", 4, MSG_NOSIGNAL));
+        CPPUNIT_ASSERT_EQUAL(std::string("ping"), read_all(c, 4));
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        ::close(c);
+
+        CPPUNIT_ASSERT(ms >= 50);
+        CPPUNIT_ASSERT(ms < 2000);
+        proxy.stop();
+        const auto s = proxy.stats();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)1, s.connections);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)4, s.bytes_up);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)4, s.bytes_down);
+    }
+
+    // Jitter never reorders the byte stream, and a half-close passes through once the data before it has.
+    void test_order_and_eof() {
+        EchoServer echo;
+        DelayProxy proxy("127.0.0.1", echo.port, 1, 5, 42);
+        proxy.start();
+
+        std::string data(1 << 20, '\0');
+        for (size_t i = 0; i < data.size(); ++i) data[i] = (char)(i * 7 + i / 4096);
+
+        const int c = connect_to(proxy.port());
+        for (size_t off = 0; off < data.size(); off += 1000) {
+            const size_t n = std::min<size_t>(1000, data.size() - off);
+            CPPUNIT_ASSERT_EQUAL((ssize_t)n, ::send(c, data.data() + off, n, MSG_NOSIGNAL));
+        }
+        ::shutdown(c, SHUT_WR);
+        const std::string back = read_all(c, data.size() + 1);
+        ::close(c);
+
+        CPPUNIT_ASSERT_EQUAL(data.size(), back.size());
+        CPPUNIT_ASSERT(data == back);
+    }
+
+    // With nothing listening upstream, the client's connection is closed.
+    void test_upstream_down() {
+        int port;
+        {
+            EchoServer gone;
+            port = gone.port;
+        }
+        DelayProxy proxy("127.0.0.1", port, 0, 0);
+        proxy.start();
+
+        const int c = connect_to(proxy.port());
+        char b;
+        CPPUNIT_ASSERT(::read(c, &b, 1) <= 0);
+        ::close(c);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, proxy.stats().connections);
+    }
+
+    // A connection closed at both ends is dropped, so clients that reconnect do not pile up.
+    void test_reaps_closed_connections() {
+        EchoServer echo;
+        DelayProxy proxy("127.0.0.1", echo.port, 1, 0);
+        proxy.start();
+
+        for (int i = 0; i < 5; ++i) {
+            const int c = connect_to(proxy.port());
+            CPPUNIT_ASSERT_EQUAL((ssize_t)1, ::send(c, "x", 1, MSG_NOSIGNAL));
+            CPPUNIT_ASSERT_EQUAL(std::string("x"), read_all(c, 1));
+            ::close(c);
+        }
+        const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (proxy.stats().open > 0 && std::chrono::steady_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        const auto s = proxy.stats();
+        CPPUNIT_ASSERT_EQUAL((uint64_t)5, s.connections);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)0, s.open);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SimDelayProxyTest);
+
+int main(int argc, char *argv[]) { return run_tests<SimDelayProxyTest>(argc, argv) ? 0 : 1; }
@@ -0,0 +1,131 @@
+//
+// CppUnit tests for the simulator's result aggregation (SimStats.h). No Redis needed.
+//
+
+#include "SimStats.h"
+#include "run_tests_cppunit.h"
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class SimStatsTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SimStatsTest);
+        CPPUNIT_TEST(test_thread_counts);
+        CPPUNIT_TEST(test_scaling_table);
+    CPPUNIT_TEST_SUITE_END();
+
+    static std::vector<std::string> lines(const std::string& s) {
+        std::vector<std::string> out;
+        std::istringstream in(s);
+        for (std::string l; std::getline(in, l);) if (!l.empty()) out.push_back(l);
+        return out;
+    }
+
+    // 'n' requests of 'us' microseconds each
+    static LatencyHistogram::Snapshot requests(int n, uint64_t us) {
+        LatencyHistogram h;
+        for (int i = 0; i < n; ++i) h.record(us);
+        return h.snapshot();
+    }
+
+public:
+    // A worker's totals are the sum of its threads' counts; each thread gets its own line when there are several.
+    void test_thread_counts() {
+        std::vector<WorkerCounts> counts(3);
+        for (int t = 0; t < 3; ++t) {
+            WorkerCounts& c = counts[t];
+            c.it = 10 * (t + 1);
+            c.ro = t + 1; c.rb = 1; c.rm = t; c.rbytes = 100 * (t + 1);
+            c.wo = t; c.wb = 2; c.we = 1; c.wbytes = 50 * t; c.other = t;
+            for (int i = 0; i <= t; ++i) c.hits.hit(100);
+            c.hits.miss(300);
+        }
+
+        std::ostringstream out;
+        const WorkerCounts total = sum_thread_counts(counts, "PID 7", out);
+        CPPUNIT_ASSERT_EQUAL(60L, total.it);
+        CPPUNIT_ASSERT_EQUAL(6L, total.ro);
+        CPPUNIT_ASSERT_EQUAL(3L, total.rb);
+        CPPUNIT_ASSERT_EQUAL(3L, total.rm);
+        CPPUNIT_ASSERT_EQUAL(600L, total.rbytes);
+        CPPUNIT_ASSERT_EQUAL(3L, total.wo);
+        CPPUNIT_ASSERT_EQUAL(6L, total.wb);
+        CPPUNIT_ASSERT_EQUAL(3L, total.we);
+        CPPUNIT_ASSERT_EQUAL(150L, total.wbytes);
+        CPPUNIT_ASSERT_EQUAL(3L, total.other);
+        CPPUNIT_ASSERT_EQUAL(6LL, total.hits.hits);
+        CPPUNIT_ASSERT_EQUAL(3LL, total.hits.misses);
+        CPPUNIT_ASSERT_EQUAL(600LL, total.hits.hit_bytes);
+        CPPUNIT_ASSERT_EQUAL(900LL, total.hits.miss_bytes);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(6.0 / 9.0, total.hits.hit_ratio(), 1e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.4, total.hits.byte_hit_ratio(), 1e-12);
+
+        const auto l = lines(out.str());
+        CPPUNIT_ASSERT_EQUAL((size_t)4, l.size());
+        CPPUNIT_ASSERT_EQUAL(0, (int)l[0].find("PID 7 thread=0 it=10 "));
+        CPPUNIT_ASSERT_EQUAL(0, (int)l[2].find("PID 7 thread=2 it=30 "));
+        CPPUNIT_ASSERT_EQUAL(0, (int)l[3].find("PID 7 it=60 R(ok/busy/miss)=6/3/3 Rbytes=600 W(ok/busy/exist)=3/6/3 Wbytes=150 other=3 "));
+
+        // One thread: just the totals
+        std::ostringstream one;
+        sum_thread_counts({counts[0]}, "PID 8", one);
+        CPPUNIT_ASSERT_EQUAL((size_t)1, lines(one.str()).size());
+        CPPUNIT_ASSERT_EQUAL(0, (int)one.str().find("PID 8 it=10 "));
+    }
+
+    // Throughput counts requests only, and speedup is against the first run.
+    void test_scaling_table() {
+        std::vector<std::pair<int, RunResult>> runs(2);
+        runs[0].first = 1;
+        runs[0].second.latencies["read latency"] = requests(100, 10);
+        runs[0].second.latencies["write latency"] = requests(50, 12);
+        runs[0].second.latencies["read lock"] = requests(1000, 1);     // not a request
+        runs[0].second.hits.hits = 1;
+        runs[0].second.hits.misses = 1;
+        runs[1].first = 4;
+        runs[1].second.latencies["read latency"] = requests(300, 10);
+        runs[1].second.latencies["write latency"] = requests(150, 12);
+        runs[1].second.hits.hits = 3;
+        runs[1].second.hits.misses = 1;
+
+        std::ostringstream out;
+        print_scaling(out, 10, runs);
+        const auto l = lines(out.str());
+        CPPUNIT_ASSERT_EQUAL((size_t)3, l.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("threads  ops_s  speedup  read_p50  read_p99  write_p50  write_p99  hit_ratio"), l[0]);
+
+        struct Row { int threads; double ops, speedup; unsigned long long r50, r99, w50, w99; double hit_ratio; };
+        auto parse = [](const std::string& s) {
+            Row r{};
+            std::istringstream in(s);
+            in >> r.threads >> r.ops >> r.speedup >> r.r50 >> r.r99 >> r.w50 >> r.w99 >> r.hit_ratio;
+            CPPUNIT_ASSERT(!in.fail());
+            return r;
+        };
+        const Row a = parse(l[1]), b = parse(l[2]);
+        CPPUNIT_ASSERT_EQUAL(1, a.threads);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(15.0, a.ops, 0.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, a.speedup, 0.0);
+        CPPUNIT_ASSERT_EQUAL(10ULL, a.r50);
+        CPPUNIT_ASSERT_EQUAL(10ULL, a.r99);
+        CPPUNIT_ASSERT_EQUAL(12ULL, a.w50);
+        CPPUNIT_ASSERT_EQUAL(12ULL, a.w99);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, a.hit_ratio, 0.0);
+
+        CPPUNIT_ASSERT_EQUAL(4, b.threads);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(45.0, b.ops, 0.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, b.speedup, 0.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75, b.hit_ratio, 0.0);
+
+        // No runs: just the header
+        std::ostringstream none;
+        print_scaling(none, 10, {});
+        CPPUNIT_ASSERT_EQUAL((size_t)1, lines(none.str()).size());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SimStatsTest);
+
+int main(int argc, char *argv[]) { return run_tests<SimStatsTest>(argc, argv) ? 0 : 1; }
@@ -0,0 +1,125 @@
+//
+// CppUnit tests for the simulator's workload generators (SimWorkload.h). No Redis needed.
+//
+
+#include "SimWorkload.h"
+#include "run_tests_cppunit.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+class SimWorkloadTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SimWorkloadTest);
+        CPPUNIT_TEST(test_zipf);
+        CPPUNIT_TEST(test_sizes);
+        CPPUNIT_TEST(test_scan);
+        CPPUNIT_TEST(test_trace);
+        CPPUNIT_TEST(test_hit_stats);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    // Rank frequencies follow 1/(k+1)^s; s = 0 is uniform.
+    void test_zipf() {
+        const ZipfDistribution z(1000, 1.0);
+        double h = 0;
+        for (int k = 1; k <= 1000; ++k) h += 1.0 / k;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0 / h, z.p(0), 1e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(z.p(0) / 2, z.p(1), 1e-12);
+
+        std::mt19937_64 gen(7);
+        std::vector<long> counts(1000);
+        const long n = 200000;
+        for (long i = 0; i < n; ++i) ++counts.at(z(gen));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(z.p(0), (double)counts[0] / n, 0.01);
+        CPPUNIT_ASSERT(counts[0] > counts[9] && counts[9] > counts[99]);
+
+        const ZipfDistribution flat(4, 0.0);
+        for (size_t k = 0; k < 4; ++k) CPPUNIT_ASSERT_DOUBLES_EQUAL(0.25, flat.p(k), 1e-12);
+    }
+
+    // Sizes stay within [min, max], have the configured median, and are a function of the key.
+    void test_sizes() {
+        SizeDistribution d;
+        d.kind = SizeDistribution::lognormal;
+        d.min = 1;
+        d.max = 1 << 30;
+        d.median = 10000;
+        std::mt19937_64 gen(11);
+        std::vector<size_t> v;
+        for (int i = 0; i < 20001; ++i) v.push_back(d(gen));
+        std::nth_element(v.begin(), v.begin() + 10000, v.end());
+        CPPUNIT_ASSERT(v[10000] > 9000 && v[10000] < 11000);
+
+        d.kind = SizeDistribution::pareto;
+        d.min = 100;
+        d.max = 5000;
+        for (int i = 0; i < 10000; ++i) {
+            const size_t s = d(gen);
+            CPPUNIT_ASSERT(s >= 100 && s <= 5000);
+        }
+
+        CPPUNIT_ASSERT_EQUAL(d.for_key("obj-1.bin", 3), d.for_key("obj-1.bin", 3));
+        CPPUNIT_ASSERT_THROW(SizeDistribution::parse("normal"), std::invalid_argument);
+    }
+
+    // Scans walk consecutive keys, wrapping at the end of the key space.
+    void test_scan() {
+        Workload w(Workload::scan, 10, 0.0, 0.0, 4, SizeDistribution(), 1);
+        std::mt19937_64 gen(5);
+        std::vector<int> ns;
+        for (int i = 0; i < 8; ++i) ns.push_back(std::stoi(w.next(gen).key.substr(4)));
+        for (int i : {1, 2, 3, 5, 6, 7}) CPPUNIT_ASSERT_EQUAL((ns[i - 1] + 1) % 10, ns[i]);
+
+        CPPUNIT_ASSERT_THROW(Workload(Workload::uniform, 10, 0.0, 0.0, 4, SizeDistribution(), 1), std::invalid_argument);
+    }
+
+    // Header, comments and blank lines are skipped; a missing size comes from the size distribution.
+    void test_trace() {
+        char path[] = "/tmp/sim-trace-XXXXXX";
+        const int fd = ::mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        ::close(fd);
+        {
+            std::ofstream out(path);
+            out << "key,size\n# comment\n\na.bin,100\r\nb.bin\t200 GET\nc.bin\n";
+        }
+        const auto t = load_trace(path);
+        std::remove(path);
+
+        CPPUNIT_ASSERT_EQUAL((size_t)3, t.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("a.bin"), t[0].key);
+        CPPUNIT_ASSERT_EQUAL(100LL, t[0].size);
+        CPPUNIT_ASSERT_EQUAL(200LL, t[1].size);
+        CPPUNIT_ASSERT_EQUAL(-1LL, t[2].size);
+
+        // Worker 1 of 3 starts a third of the way in and loops
+        const SizeDistribution sizes;
+        Workload w(Workload::trace, 0, 0.0, 0.0, 1, sizes, 9, t, 1, 3);
+        std::mt19937_64 gen(1);
+        CPPUNIT_ASSERT_EQUAL(std::string("b.bin"), w.next(gen).key);
+        const auto c = w.next(gen);
+        CPPUNIT_ASSERT_EQUAL(sizes.for_key("c.bin", 9), c.size);
+        CPPUNIT_ASSERT_EQUAL(std::string("a.bin"), w.next(gen).key);
+    }
+
+    void test_hit_stats() {
+        HitStats h;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, h.hit_ratio(), 0.0);
+        h.hit(100);
+        h.hit(100);
+        h.hit(100);
+        h.miss(700);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75, h.hit_ratio(), 1e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.3, h.byte_hit_ratio(), 1e-12);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SimWorkloadTest);
+
+int main(int argc, char *argv[]) { return run_tests<SimWorkloadTest>(argc, argv) ? 0 : 1; }